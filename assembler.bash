@@ -0,0 +1,2 @@
+gcc assembler.cpp src/**/*.cpp -O2 -DASSEMBLER -Iinclude -Isrc -lm -lpthread -o assembler
+./assembler "$@"
\ No newline at end of file
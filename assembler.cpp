@@ -0,0 +1,10 @@
+#include "asm_main.h"
+
+//------------------------------------------------------------------------------------
+// Standalone assembler entry point (built by assembler.bash, no window)
+// assembler [input.asm|-] [output.bin|-]
+//------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    return asm_main(argc, argv);
+}
@@ -0,0 +1,2 @@
+gcc bench.cpp src/**/*.cpp -O2 -DBENCH -Iinclude -Isrc -lm -lpthread -o bench
+./bench "$@"
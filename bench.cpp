@@ -0,0 +1,9 @@
+#include "bench_main.h"
+
+//------------------------------------------------------------------------------------
+// Benchmark entry point (built by bench.bash, no window)
+//------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    return bench_main(argc, argv);
+}
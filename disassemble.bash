@@ -0,0 +1,2 @@
+gcc disassemble.cpp src/**/*.cpp -O2 -Iinclude -Isrc -lm -lpthread -o disassemble
+./disassemble "$@"
@@ -0,0 +1,45 @@
+#include "disassembler.h"
+#include "architecture.h"
+#include "cfg.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Recover the basic-block map of a ROM, print it and save it for the VM
+static int write_block_map(const char *rom_path, const char *map_path)
+{
+    size_t size;
+    uint8_t *data = disasm_read_rom(rom_path, &size);
+    if (!data) {
+        return 1;
+    }
+
+    CfgMap map;
+    bool ok = cfg_recover(data, size, PROGRAM_ROM, &map);
+    free(data);
+    if (!ok) {
+        printf("Error: out of memory\n");
+        return 1;
+    }
+    cfg_print(&map, stdout);
+    ok = cfg_write(&map, map_path);
+    if (!ok) {
+        printf("Error: Could not write block map: %s\n", map_path);
+    }
+    cfg_free(&map);
+    return ok ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------------
+// Disassembler entry point (built by disassemble.bash)
+// disassemble [rom.bin]: annotated listing with static cost estimates on stdout
+// disassemble --blocks [rom.bin] [rom.blocks]: basic-block map for the VM
+//------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--blocks") == 0) {
+        return write_block_map(argc > 2 ? argv[2] : "roms/rom.bin", argc > 3 ? argv[3] : "roms/rom.blocks");
+    }
+
+    const char *rom_path = argc > 1 ? argv[1] : "roms/rom.bin";
+    return disasm_file(rom_path, stdout) ? 0 : 1;
+}
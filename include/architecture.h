@@ -7,6 +7,10 @@
 // 0x0000 - 0x0FFF: Font space (4KB)
 // 0x1000 - 0xFEFF: Program ROM (60KB)
 // 0xFF00 - 0xFFFF: Stack (256 bytes)
+//
+// Instruction fetches from 0x8000 - 0xBFFF go through the bank window.
+// Bank 0 is program ROM itself; BANK maps one of up to 255 more 16KB banks
+// held on the host, so ROMs can outgrow the 60KB program window.
 #define RAM_SIZE       65536
 #define FONT_ADDR      0x0000
 #define FONT_SIZE      4096
@@ -14,12 +18,21 @@
 #define PROGRAM_SIZE   61440
 #define STACK_ADDR     0xFF00
 #define STACK_SIZE     256
+#define BANK_WINDOW    0x8000
+#define BANK_SIZE      0x4000
+#define BANK_COUNT     256
 
 // Display dimensions
 #define DISPLAY_WIDTH  640
 #define DISPLAY_HEIGHT 480
 #define DISPLAY_SIZE   (DISPLAY_WIDTH * DISPLAY_HEIGHT)
 
+// Copy-on-write pages of memory and the display buffer (include/vm_fork.h)
+#define VM_PAGE_SIZE     4096
+#define VM_MEMORY_PAGES  (RAM_SIZE / VM_PAGE_SIZE)
+#define VM_DISPLAY_PAGES (DISPLAY_SIZE * 4 / VM_PAGE_SIZE)
+#define VM_PAGES         (VM_MEMORY_PAGES + VM_DISPLAY_PAGES)
+
 struct BasicVm
 {
     uint8_t registers[16];
@@ -32,6 +45,13 @@ struct BasicVm
     uint8_t delay_timer;
     uint8_t sound_timer;
     uint32_t display_buffer[DISPLAY_SIZE];
+    uint32_t rom_size; // bytes of the image loaded at PROGRAM_ROM
+    const uint8_t *bank_window; // mapped bank, NULL while bank 0 is (memory)
+    const uint8_t *banks;       // banks 1..bank_count-1, BANK_SIZE each, shared read-only
+    uint16_t bank_count;        // including bank 0
+    uint8_t bank;
+    struct VmSnapshot *snapshot;  // last synced with, NULL if never
+    uint64_t dirty_pages[(VM_PAGES + 63) / 64]; // written since then
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,345 @@
+#ifndef ASM_CONSTEXPR_H
+#define ASM_CONSTEXPR_H
+
+#include "architecture.h"
+#include "encode.h"
+#include "instructions.h"
+#include "mnemonic_hash.h"
+#include "tokenizer.h"
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+
+// Compile-time assembler for ROMs built into the binary:
+//
+//   constexpr auto rom = ASM_CONSTEXPR(R"(
+//     loop:  SUBI r1, r1, 1
+//            BNE r1, r0, loop
+//            HALT
+//   )");
+//
+// rom is a std::array<uint8_t, N> holding exactly the image assemble()
+// would produce at PROGRAM_ROM: labels, ".equ NAME, value" (a number or
+// an earlier symbol), ';' comments, the mnemonics of INSTRUCTION_LIST
+// and the field layouts of encode.h. ".section" is ignored as in a flat
+// build. Declare the result constexpr: a mistake then stops compilation,
+// and the error names one of the asm_constexpr_error_* functions below.
+// Needs C++17.
+
+#define ASM_CONSTEXPR_MAX_SYMBOLS 256
+
+// Never defined: reaching one during constant evaluation is the error
+void asm_constexpr_error_unknown_mnemonic();
+void asm_constexpr_error_invalid_operand();
+void asm_constexpr_error_operands_do_not_match();
+void asm_constexpr_error_undefined_symbol();
+void asm_constexpr_error_duplicate_symbol();
+void asm_constexpr_error_invalid_equ();
+void asm_constexpr_error_too_many_symbols();
+void asm_constexpr_error_program_too_large();
+
+struct AsmConstexprSymbol {
+  const char *name;
+  size_t length;
+  uint32_t value;
+  bool label;
+};
+
+struct AsmConstexprSymbols {
+  AsmConstexprSymbol entries[ASM_CONSTEXPR_MAX_SYMBOLS];
+  size_t count;
+};
+
+struct AsmConstexprToken {
+  char kind;      // 'r' register, 'i' number, 's' symbol
+  uint32_t value;
+  const char *start;
+  size_t length;
+};
+
+constexpr bool asm_constexpr_blank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+constexpr bool asm_constexpr_line_end(char c) {
+  return c == '\0' || c == '\n' || c == '\r' || c == ';';
+}
+
+constexpr bool asm_constexpr_symbol_start(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '.';
+}
+
+constexpr bool asm_constexpr_symbol_char(char c) {
+  return asm_constexpr_symbol_start(c) || (c >= '0' && c <= '9');
+}
+
+constexpr size_t asm_constexpr_symbol_length(const char *s) {
+  size_t length = 0;
+  if (asm_constexpr_symbol_start(s[0])) {
+    while (asm_constexpr_symbol_char(s[length])) {
+      length++;
+    }
+  }
+  return length;
+}
+
+constexpr const char *asm_constexpr_skip_blanks(const char *s) {
+  while (asm_constexpr_blank(*s)) {
+    s++;
+  }
+  return s;
+}
+
+constexpr bool asm_constexpr_same(const char *a, size_t aLength, const char *b, size_t bLength) {
+  if (aLength != bLength) {
+    return false;
+  }
+  for (size_t i = 0; i < aLength; i++) {
+    if (a[i] != b[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Directive match, case-insensitive like strncasecmp in assemble_line()
+constexpr bool asm_constexpr_directive(const char *s, const char *directive) {
+  size_t i = 0;
+  for (; directive[i] != '\0'; i++) {
+    if (mnemonic_fold(s[i]) != mnemonic_fold(directive[i])) {
+      return false;
+    }
+  }
+  return asm_constexpr_blank(s[i]);
+}
+
+// Numbers follow lex_number() in src/asm/tokenizer.cpp: decimal, 0x hex,
+// 0b binary, leading-0 octal, optional sign, wrapping to 32 bits
+constexpr AsmConstexprToken asm_constexpr_number(const char *s) {
+  const char *p = s;
+  bool negative = *p == '-';
+  if (*p == '-' || *p == '+') {
+    p++;
+  }
+  uint32_t base = 10;
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+    base = 16;
+    p += 2;
+  } else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+    base = 2;
+    p += 2;
+  } else if (p[0] == '0') {
+    base = 8;
+  }
+
+  const char *digits = p;
+  uint64_t value = 0;
+  while (asm_constexpr_symbol_char(*p)) {
+    char c = *p;
+    uint32_t digit = c >= '0' && c <= '9'   ? (uint32_t)(c - '0')
+                     : c >= 'a' && c <= 'f' ? (uint32_t)(c - 'a' + 10)
+                     : c >= 'A' && c <= 'F' ? (uint32_t)(c - 'A' + 10)
+                                            : 99;
+    value = value * base + digit;
+    if (digit >= base || value > 0xFFFFFFFFu) {
+      asm_constexpr_error_invalid_operand();
+    }
+    p++;
+  }
+  if (p == digits) {
+    asm_constexpr_error_invalid_operand();
+  }
+  uint32_t result = negative ? (uint32_t)(0u - (uint32_t)value) : (uint32_t)value;
+  return AsmConstexprToken{'i', result, s, (size_t)(p - s)};
+}
+
+constexpr AsmConstexprToken asm_constexpr_operand(const char *s) {
+  size_t length = asm_constexpr_symbol_length(s);
+  if (length == 0) {
+    if ((*s >= '0' && *s <= '9') || *s == '-' || *s == '+') {
+      return asm_constexpr_number(s);
+    }
+    asm_constexpr_error_invalid_operand();
+  }
+
+  bool digits = (length == 2 || length == 3) && (s[0] == 'r' || s[0] == 'R');
+  for (size_t i = 1; digits && i < length; i++) {
+    digits = s[i] >= '0' && s[i] <= '9';
+  }
+  if (!digits) {
+    return AsmConstexprToken{'s', 0, s, length};
+  }
+  uint32_t reg = (uint32_t)(s[1] - '0');
+  if (length == 3) {
+    reg = reg * 10 + (uint32_t)(s[2] - '0');
+  }
+  if (reg > 15) {
+    asm_constexpr_error_invalid_operand();
+  }
+  return AsmConstexprToken{'r', reg, s, length};
+}
+
+constexpr const AsmConstexprSymbol *asm_constexpr_find(const AsmConstexprSymbols &symbols,
+                                                       const char *name, size_t length) {
+  for (size_t i = 0; i < symbols.count; i++) {
+    if (asm_constexpr_same(symbols.entries[i].name, symbols.entries[i].length, name, length)) {
+      return &symbols.entries[i];
+    }
+  }
+  return nullptr;
+}
+
+constexpr void asm_constexpr_define(AsmConstexprSymbols &symbols, const char *name, size_t length,
+                                    uint32_t value, bool label) {
+  if (asm_constexpr_find(symbols, name, length) != nullptr) {
+    asm_constexpr_error_duplicate_symbol();
+  }
+  if (symbols.count == ASM_CONSTEXPR_MAX_SYMBOLS) {
+    asm_constexpr_error_too_many_symbols();
+  }
+  symbols.entries[symbols.count++] = AsmConstexprSymbol{name, length, value, label};
+}
+
+// Pass 1 (out == nullptr) defines symbols and sizes the image; pass 2
+// encodes into out. Returns the image size.
+constexpr size_t asm_constexpr_pass(const char *source, AsmConstexprSymbols &symbols, uint8_t *out) {
+  uint32_t pc = PROGRAM_ROM;
+  const char *cursor = source;
+  while (*cursor != '\0') {
+    cursor = asm_constexpr_skip_blanks(cursor);
+
+    // Labels: "name:" (several may share a line)
+    size_t nameLength = asm_constexpr_symbol_length(cursor);
+    while (nameLength > 0 && cursor[nameLength] == ':') {
+      if (out == nullptr) {
+        asm_constexpr_define(symbols, cursor, nameLength, pc, true);
+      }
+      cursor = asm_constexpr_skip_blanks(cursor + nameLength + 1);
+      nameLength = asm_constexpr_symbol_length(cursor);
+    }
+
+    if (asm_constexpr_directive(cursor, ".equ")) {
+      const char *name = asm_constexpr_skip_blanks(cursor + 4);
+      nameLength = asm_constexpr_symbol_length(name);
+      const char *value = asm_constexpr_skip_blanks(name + nameLength);
+      if (*value == ',') {
+        value = asm_constexpr_skip_blanks(value + 1);
+      }
+      if (nameLength == 0) {
+        asm_constexpr_error_invalid_equ();
+      }
+      if (out == nullptr) {
+        AsmConstexprToken token = asm_constexpr_operand(value);
+        const AsmConstexprSymbol *symbol =
+            token.kind == 's' ? asm_constexpr_find(symbols, token.start, token.length) : nullptr;
+        if (token.kind == 'r' || (token.kind == 's' && symbol == nullptr)) {
+          asm_constexpr_error_invalid_equ();
+        }
+        asm_constexpr_define(symbols, name, nameLength, symbol ? symbol->value : token.value, false);
+      }
+      cursor = value;
+    } else if (!asm_constexpr_directive(cursor, ".section") && !asm_constexpr_line_end(*cursor)) {
+      const char *mnemonic = cursor;
+      while (!asm_constexpr_line_end(*cursor) && !asm_constexpr_blank(*cursor)) {
+        cursor++;
+      }
+      int index = mnemonic_lookup(mnemonic, (size_t)(cursor - mnemonic));
+      if (index <= 0) {
+        asm_constexpr_error_unknown_mnemonic();
+      }
+      const Instruction *instruction = &instruction_rows[index];
+      InstructionFormat format = (InstructionFormat)instruction->format;
+      const char *pattern = encode_operands(format);
+
+      // Operands: operand (',' operand)*, symbols standing for immediates
+      uint32_t operands[ASM_MAX_OPERANDS] = {};
+      size_t count = 0;
+      cursor = asm_constexpr_skip_blanks(cursor);
+      while (!asm_constexpr_line_end(*cursor)) {
+        if (count == ASM_MAX_OPERANDS || (count > 0 && *cursor++ != ',')) {
+          asm_constexpr_error_invalid_operand();
+        }
+        AsmConstexprToken token = asm_constexpr_operand(asm_constexpr_skip_blanks(cursor));
+        bool matches = pattern[count] == 'r' ? token.kind == 'r' : pattern[count] == 'i' && token.kind != 'r';
+        if (!matches) {
+          asm_constexpr_error_operands_do_not_match();
+        }
+        uint32_t next_pc = pc + instruction->length / 8;
+        if (token.kind == 's' && out != nullptr) {
+          const AsmConstexprSymbol *symbol = asm_constexpr_find(symbols, token.start, token.length);
+          if (symbol == nullptr) {
+            asm_constexpr_error_undefined_symbol();
+          }
+          token.value = symbol->label && encode_is_pc_relative(instruction) ? symbol->value - next_pc
+                                                                            : symbol->value;
+        }
+        operands[count++] = token.value;
+        cursor = asm_constexpr_skip_blanks(token.start + token.length);
+      }
+      if (pattern[count] != '\0') {
+        asm_constexpr_error_operands_do_not_match();
+      }
+
+      if (out != nullptr) {
+        uint32_t value = 0;
+        switch (format) {
+        case FORMAT_BYTE:
+          value = encode_head(instruction);
+          break;
+        case FORMAT_REGISTER:
+          value = encode_register(instruction, operands[0], operands[1], operands[2]);
+          break;
+        case FORMAT_IMMEDIATE:
+        case FORMAT_STORE_BRANCH:
+          value = encode_immediate(instruction, operands[0], operands[1], operands[2]);
+          break;
+        case FORMAT_UPPER:
+          value = encode_upper(instruction, operands[0], operands[1]);
+          break;
+        case FORMAT_JUMP:
+          value = encode_jump(instruction, operands[0], operands[1]);
+          break;
+        case FORMAT_SHIFT_IMMEDIATE:
+          value = encode_shift_immediate(instruction, operands[0], operands[1], operands[2]);
+          break;
+        default:
+          asm_constexpr_error_unknown_mnemonic();
+        }
+        // Little-endian, as pack_bytes() writes them
+        for (uint32_t i = 0; i < instruction->length / 8; i++) {
+          out[pc - PROGRAM_ROM + i] = (uint8_t)(value >> (i * 8));
+        }
+      }
+      pc += instruction->length / 8;
+      if (pc - PROGRAM_ROM > PROGRAM_SIZE) {
+        asm_constexpr_error_program_too_large();
+      }
+    }
+
+    while (*cursor != '\0' && *cursor != '\n') {
+      cursor++;
+    }
+    if (*cursor == '\n') {
+      cursor++;
+    }
+  }
+  return pc - PROGRAM_ROM;
+}
+
+constexpr size_t asm_constexpr_size(const char *source) {
+  AsmConstexprSymbols symbols = {};
+  return asm_constexpr_pass(source, symbols, nullptr);
+}
+
+template <size_t Size>
+constexpr std::array<uint8_t, Size> asm_constexpr(const char *source) {
+  std::array<uint8_t, Size> image = {};
+  AsmConstexprSymbols symbols = {};
+  asm_constexpr_pass(source, symbols, nullptr);
+  asm_constexpr_pass(source, symbols, image.data());
+  return image;
+}
+
+#define ASM_CONSTEXPR(source) asm_constexpr<asm_constexpr_size(source)>(source)
+
+#endif
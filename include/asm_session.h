@@ -0,0 +1,53 @@
+#ifndef ASM_SESSION_H
+#define ASM_SESSION_H
+
+#include "assembler.h"
+#include "uthash.h"
+
+// Incremental assembler. Parsed lines are cached by their text (encodings
+// never depend on symbols, since symbolic immediates are patched later),
+// and each build re-encodes only lines missing from the cache. Bytes of a
+// line are rewritten only if its cache entry or address changed, or if it
+// names a symbol and the symbol-table version moved; the rewritten span
+// is tracked so asm_session_write() only touches what changed.
+
+typedef struct AsmCacheEntry {
+  char *text; // key: the line without its newline, NUL-terminated copy
+  size_t length;
+  AsmLine parsed;
+  uint32_t generation; // last build that used the entry
+  UT_hash_handle hh;
+} AsmCacheEntry;
+
+typedef struct {
+  AsmCacheEntry *entry;
+  uint32_t address;
+} AsmSessionLine;
+
+typedef struct {
+  uint32_t origin;
+  AsmCacheEntry *cache;
+  AsmSessionLine *lines; // previous build, compared against the next
+  size_t lineCount, lineCapacity;
+  AsmSessionLine *scratch;
+  size_t scratchCapacity;
+  SymbolTable symbols;
+  uint64_t symbolVersion; // hash of every (name, value) in definition order
+  size_t definitionLines; // lines carrying a label or .equ
+  uint32_t generation;
+  AsmResult result;       // image and diagnostics of the last build
+  size_t dirtyStart, dirtyEnd; // image bytes rewritten by the last build
+  size_t writtenSize;     // image size at the last asm_session_write
+  size_t encodedLines;    // cache misses in the last build
+  size_t patchedLines;    // lines whose bytes were rewritten
+} AsmSession;
+
+void asm_session_init(AsmSession *session, uint32_t origin);
+bool asm_session_build(AsmSession *session, const char *source, size_t length);
+
+// Write the bytes changed since the last write (and fix the file size);
+// fd must refer to the same file on every call
+bool asm_session_write(AsmSession *session, int fd);
+void asm_session_free(AsmSession *session);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef ASM_SOURCE_H
+#define ASM_SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Read-only assembly source, NUL-terminated after the last byte.
+// Regular files are mmapped; stdin ("-"), pipes and files whose size is
+// an exact multiple of the page size (no zero tail to terminate them)
+// are read into a heap buffer instead. There is no line-length limit.
+typedef struct {
+  const char *data;
+  size_t size;
+  size_t mapped; // mapping length, 0 if data is heap-allocated
+} AsmSource;
+
+bool asm_source_open(const char *path, AsmSource *source);
+void asm_source_close(AsmSource *source);
+
+#endif
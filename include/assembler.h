@@ -0,0 +1,93 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include "architecture.h"
+#include "rom_writer.h"
+#include "symbols.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// In-memory two-pass assembler. No file I/O and no global state: every
+// call owns its symbol table and fixups, so callers on different threads
+// can assemble independently. Source is a span (it need not be
+// NUL-terminated); the image is laid out for loading at `origin`.
+
+#define ASM_DIAGNOSTIC_SIZE 96
+
+typedef struct {
+  uint32_t line;
+  char message[ASM_DIAGNOSTIC_SIZE];
+} AsmDiagnostic;
+
+typedef struct {
+  RomImage image;
+  AsmDiagnostic *diagnostics;
+  size_t diagnosticCount;
+  size_t diagnosticCapacity;
+  bool ok;
+} AsmResult;
+
+// Results can be reused across calls to keep their buffers; zero-initialize
+// before the first call and release with asm_result_free()
+bool assemble(const char *source, size_t length, uint32_t origin, AsmResult *result);
+
+// Split the source at line boundaries and encode the chunks on a pool of
+// `threads` workers (0 picks one per core for large sources, otherwise 1);
+// symbols are defined and fixups patched in a final serial merge
+bool assemble_threaded(const char *source, size_t length, uint32_t origin, int threads,
+                       AsmResult *result);
+
+// One parsed and encoded line. Spans are offsets from the start of the
+// line, so a result is valid for any line with the same text; symbolic
+// immediates are encoded as 0 and named by symbolOffset/symbolLength.
+#define ASM_MAX_LINE_LABELS 8
+
+typedef enum {
+  ASM_LINE_EMPTY,       // blank, comment, labels only or an error
+  ASM_LINE_INSTRUCTION,
+  ASM_LINE_EQU,         // symbol span is the name, valueOffset the value text
+  ASM_LINE_SECTION      // ".section name": symbol span is the name (objects only)
+} AsmLineKind;
+
+typedef struct {
+  uint8_t kind;
+  uint8_t labelCount;
+  uint16_t labelLength[ASM_MAX_LINE_LABELS];
+  uint32_t labelOffset[ASM_MAX_LINE_LABELS];
+  Instruction *instruction;
+  uint32_t value;
+  uint32_t symbolOffset;
+  uint16_t symbolLength; // 0 if no symbolic operand
+  uint32_t valueOffset;
+  bool hasError;
+  char message[ASM_DIAGNOSTIC_SIZE];
+} AsmLine;
+
+// Parse and encode one line, which must end in '\n' or NUL
+void assemble_line(const char *line, AsmLine *parsed);
+
+// Resolve a symbol's immediate for the instruction ending at next_pc and
+// patch it into the encoded value
+uint32_t asm_resolve_immediate(const Instruction *instruction, uint32_t value,
+                               const Symbol *symbol, uint32_t next_pc);
+
+// Value of a .equ: a number or an already defined symbol
+bool asm_equ_value(const SymbolTable *symbols, const char *valueStr, uint32_t *value);
+
+// Assemble straight into vm->memory at PROGRAM_ROM. Fails without touching
+// memory if the source has errors or the image exceeds PROGRAM_SIZE.
+bool assemble_into_vm(BasicVm *vm, const char *source, size_t length, AsmResult *result);
+
+void asm_result_free(AsmResult *result);
+
+// Make room for one more element in a growable array
+bool asm_grow(void **items, size_t *capacity, size_t count, size_t size, size_t initial);
+
+// Append a diagnostic and mark the result failed
+void asm_error(AsmResult *result, uint32_t line, const char *fmt, ...);
+
+// "Error: <message> on line N" for every diagnostic
+void asm_print_diagnostics(const AsmResult *result, FILE *out);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef BENCH_MAIN_H
+#define BENCH_MAIN_H
+
+#include "assembler.h"
+#include "asm_source.h"
+#include "vm.h"
+
+int bench_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef BUILTIN_ROMS_H
+#define BUILTIN_ROMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// ROMs compiled into the binary by the constexpr assembler
+// (asm_constexpr.h): no files on disk and no parsing at startup.
+// vm_main runs one when given "@name" instead of a path.
+
+typedef struct {
+  const char *name;
+  const char *description;
+  const uint8_t *bytes;
+  size_t size;
+} BuiltinRom;
+
+extern const BuiltinRom builtin_roms[];
+extern const size_t builtin_rom_count;
+
+// NULL if there is no ROM of that name
+const BuiltinRom *builtin_rom_find(const char *name);
+
+#endif
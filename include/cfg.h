@@ -0,0 +1,71 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Basic-block map of a ROM image, recovered statically
+//
+// Instructions are 8, 24 or 32 bits, so bytes only decode correctly from an
+// instruction start. Recovery follows the code from the entry at the image
+// origin: both ways of a conditional branch, JAL targets, and the return
+// point after a linking JAL (rd != r0), since the callee comes back with a
+// JAL or JALR there. JALR targets are unknown. Whatever is left over is
+// swept linearly into unreachable blocks. Loop headers are the targets of
+// retreating edges in a depth-first walk from the entry.
+//
+// File: "BVMB" | version(1) | origin(u16) | imageSize(u32) | imageHash(u64) |
+//       blockCount(u32), all little-endian, then per block in address order
+//   start(u16) size(u16) instructions(u16) flags(u8) successorCount(u8)
+//   successors(2 x u16)
+#define CFG_MAGIC    "BVMB"
+#define CFG_VERSION  1
+
+#define CFG_REACHABLE    0x01
+#define CFG_ENTRY        0x02
+#define CFG_LOOP_HEADER  0x04
+#define CFG_INDIRECT     0x08 // ends in JALR
+#define CFG_CALL         0x10 // ends in a linking JAL; successors[1] is the return point
+#define CFG_EXIT         0x20 // a successor leaves the image or does not decode
+
+typedef struct {
+    uint16_t start;
+    uint16_t size;          // bytes
+    uint16_t instructions;
+    uint8_t flags;          // CFG_*
+    uint8_t successorCount;
+    uint16_t successors[2]; // block start addresses
+} CfgBlock;
+
+typedef struct CfgMap {
+    uint16_t origin;
+    uint32_t imageSize;
+    uint64_t imageHash;     // cfg_image_hash() of the image the map describes
+    CfgBlock *blocks;       // sorted by start, disjoint
+    size_t count;
+} CfgMap;
+
+// FNV-1a over the image bytes
+uint64_t cfg_image_hash(const uint8_t *bytes, size_t size);
+
+// Recover the map of size bytes loaded at origin; release with cfg_free()
+bool cfg_recover(const uint8_t *bytes, size_t size, uint16_t origin, CfgMap *map);
+
+// Block containing pc, or NULL
+const CfgBlock *cfg_find(const CfgMap *map, uint16_t pc);
+
+// Whether the map was recovered from exactly this image
+bool cfg_matches(const CfgMap *map, const uint8_t *bytes, size_t size, uint16_t origin);
+
+bool cfg_write(const CfgMap *map, const char *path);
+
+// Fails on a bad header or a truncated block table
+bool cfg_read(const char *path, CfgMap *map);
+
+void cfg_print(const CfgMap *map, FILE *out);
+
+void cfg_free(CfgMap *map);
+
+#endif // CFG_H
@@ -10,4 +10,76 @@
 // Uncomment to disable instruction execution (useful for testing assembler only)
 #define DISABLE_EXECUTION
 
+// Uncomment to count every executed instruction per PC (exact, slow)
+//#define PROFILE_EXACT
+
+// Uncomment to sample the guest PC from a SIGPROF timer (statistical, ~1% overhead)
+//#define PROFILE_SAMPLING
+
+// Sampling interval for PROFILE_SAMPLING in microseconds
+#define PROFILE_SAMPLE_US 1000
+
+// Both profilers also save their counts here, for profile-guided layout
+// (bash assembler.bash -O -p roms/profile.txt in.asm out.bin)
+#define PROFILE_PATH "roms/profile.txt"
+
+// Both profilers count into the same report, so only one may be on
+#if defined(PROFILE_EXACT) && defined(PROFILE_SAMPLING)
+#error "Define only one of PROFILE_EXACT and PROFILE_SAMPLING"
+#endif
+
+// Uncomment to read hardware perf counters (cycles, instructions, branch and
+// L1D misses) around vm_run and report them per guest instruction
+//#define PERF_COUNTERS
+
+// Uncomment with PERF_COUNTERS to also split counters by opcode class
+// (reads the counters around every step, so totals include that cost)
+//#define PERF_COUNTERS_BY_CLASS
+#if defined(PERF_COUNTERS_BY_CLASS) && !defined(PERF_COUNTERS)
+#define PERF_COUNTERS
+#endif
+
+// Uncomment to record a compact binary execution trace from vm_run
+// (decode it with trace_decode.bash)
+//#define TRACE
+#define TRACE_PATH "roms/trace.bin"
+
+// Uncomment to watch the .asm given to vm_main and patch edits into the
+// running VM, keeping RAM and registers (Linux only; lifts the instruction limit)
+//#define HOT_RELOAD
+
+// Uncomment to give vm_run the basic-block map of the ROM (include/cfg.h),
+// read from BLOCK_MAP_PATH (bash disassemble.bash --blocks rom.bin writes it)
+// or recovered at startup if that file is missing or for another ROM
+//#define BLOCK_MAP
+#define BLOCK_MAP_PATH "roms/rom.blocks"
+
+// Uncomment to decode the ROM once into PREDECODE_CACHE_DIR/<hash>.bvmd
+// (include/predecode.h); later starts with the same ROM mmap that file and
+// vm_step skips decoding
+//#define PREDECODE_CACHE
+#define PREDECODE_CACHE_DIR "roms/cache"
+
+// Uncomment to track which pages of memory and the display each VM writes,
+// so vm_snapshot(), vm_restore() and vm_fork() (include/vm_fork.h) copy
+// only those instead of the whole 1.3MB
+//#define VM_FORK
+
+// Benchmark builds (bench.bash defines BENCH) execute instructions and keep
+// the hot path free of debug output so only the interpreter is measured
+#ifdef BENCH
+#undef DEBUG
+#undef VERBOSE
+#undef DISABLE_EXECUTION
+#define QUIET
+#endif
+
+// Standalone assembler builds (assembler.bash defines ASSEMBLER) only print
+// diagnostics, so the tool can sit in a pipeline and run at disk speed
+#ifdef ASSEMBLER
+#undef DEBUG
+#undef VERBOSE
+#define QUIET
+#endif
+
 #endif // CONFIG_H
@@ -2,11 +2,13 @@
 #define DECODE_H
 
 #include "instructions.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 // Instruction decode helpers
 typedef struct {
+    uint8_t op; // IsaOp, what vm_execute_instruction dispatches on
     uint8_t opcode;
     uint8_t funct3;
     uint8_t funct4;
@@ -19,20 +21,14 @@ typedef struct {
     Instruction* instruction;
 } DecodedInstruction;
 
-// Main decode function
-DecodedInstruction vm_decode(uint32_t instruction, Instruction instructionProperties);
+// Table row of the instruction starting with these two bytes (funct4 is
+// the low nibble of the second), or NULL if no row encodes them
+Instruction *decode_lookup(uint8_t byte0, uint8_t byte1);
 
-// Individual opcode decode functions
-DecodedInstruction decode_arith_rtype(uint32_t instruction, Instruction ins);
-DecodedInstruction decode_arith_itype(uint32_t instruction, Instruction ins);
-DecodedInstruction decode_upper_imm(uint32_t instruction, Instruction ins);
-DecodedInstruction decode_store(uint32_t instruction, Instruction ins);
-DecodedInstruction decode_branch(uint32_t instruction, Instruction ins);
-DecodedInstruction decode_jump(uint32_t instruction, Instruction ins);
-DecodedInstruction decode_load(uint32_t instruction, Instruction ins);
-DecodedInstruction decode_logic_imm(uint32_t instruction, Instruction ins);
-DecodedInstruction decode_shift_imm(uint32_t instruction, Instruction ins);
-DecodedInstruction decode_halt(uint32_t instruction, Instruction ins);
-DecodedInstruction decode_bitwise_rtype(uint32_t instruction, Instruction ins);
+// Split an instruction word into the fields of ins->format
+DecodedInstruction vm_decode(uint32_t word, Instruction *ins);
+
+// Assembler syntax, e.g. "ADDI r1, r2, 0x10"; returns the length written
+int isa_disassemble(const DecodedInstruction *dec, char *out, size_t size);
 
 #endif // DECODE_H
@@ -0,0 +1,56 @@
+#ifndef DISASSEMBLER_H
+#define DISASSEMBLER_H
+
+#include "decode.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Offline ROM listing: one linear decode pass over the image with the VM's
+// decode table, split into basic blocks at branch targets and after every
+// branch, jump and HALT. Each line shows address, bytes, the instruction
+// and its static cost; each block ends with its totals.
+//
+// Costs are rough host cycles for the interpreter: a fixed fetch, lookup,
+// decode and dispatch overhead per instruction plus the work of its case in
+// vm_execute_instruction. They rank code, they do not time it, and they
+// assume every loop body runs once.
+#define DISASM_DISPATCH_CYCLES 10
+
+// Bytes that decode to no row are listed as ".byte" and skipped one at a time
+typedef struct {
+    uint16_t address;
+    uint8_t length;       // in bytes
+    bool valid;
+    DecodedInstruction dec;
+} DisasmLine;
+
+// Cycles of the instruction's own work, without DISASM_DISPATCH_CYCLES
+uint32_t disasm_op_cycles(const DecodedInstruction *dec);
+
+// Branch or JAL destination; false for everything else (JALR is indirect)
+bool disasm_target(const DisasmLine *line, uint16_t *target);
+
+// Nothing after this instruction runs in its block
+bool disasm_ends_block(const DisasmLine *line);
+
+// Decode the instruction at bytes[pos]; false leaves a one-byte invalid line
+bool disasm_decode(const uint8_t *bytes, size_t size, uint16_t origin, size_t pos, DisasmLine *line);
+
+// Decode size bytes loaded at origin. Returns the line count, lines holds
+// at most size entries; free() it.
+size_t disassemble_image(const uint8_t *bytes, size_t size, uint16_t origin, DisasmLine **lines);
+
+// Print the annotated listing of an image
+void disasm_listing(const uint8_t *bytes, size_t size, uint16_t origin, FILE *out);
+
+// Read a ROM file as vm_load_rom() would and return the bytes from
+// PROGRAM_ROM on; NULL (after an error message) if it cannot be loaded.
+// free() the result.
+uint8_t *disasm_read_rom(const char *path, size_t *size);
+
+// Listing of a ROM file, loaded at PROGRAM_ROM as vm_load_rom() does
+bool disasm_file(const char *path, FILE *out);
+
+#endif // DISASSEMBLER_H
@@ -0,0 +1,79 @@
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include "instructions.h"
+#include <stdint.h>
+
+// Field layouts of every InstructionFormat. Shared by the runtime
+// encoders (src/asm/assemble.cpp), symbol patching (src/asm/assembler.cpp)
+// and the compile-time assembler (asm_constexpr.h), so all three agree
+// bit for bit. All constexpr (C++14).
+
+// Operand kinds for tokens_match(): 'r' register, 'i' immediate
+constexpr const char *encode_operands(uint8_t format) {
+  switch (format) {
+  case FORMAT_REGISTER:
+    return "rrr";
+  case FORMAT_IMMEDIATE:
+  case FORMAT_STORE_BRANCH:
+  case FORMAT_SHIFT_IMMEDIATE:
+    return "rri";
+  case FORMAT_UPPER:
+  case FORMAT_JUMP:
+    return "ri";
+  default:
+    return "";
+  }
+}
+
+// Branches and JAL encode PC-relative offsets; everything else takes the value as-is
+constexpr bool encode_is_pc_relative(const Instruction *instruction) {
+  return instruction->opcode == 0x05 || (instruction->opcode == 0x06 && instruction->funct3 == 0x01);
+}
+
+// funct3 in bits 0-2, opcode in bits 3-7
+constexpr uint32_t encode_head(const Instruction *instruction) {
+  return (instruction->funct3 & 0b00000111) | (instruction->opcode & 0b00011111) << 3;
+}
+
+constexpr uint32_t encode_register(const Instruction *instruction, uint32_t rd, uint32_t rs1,
+                                   uint32_t rs2) {
+  return encode_head(instruction) | (instruction->funct4 & 0b00001111) << 8 | (rd & 0b00001111) << 12 |
+         (rs1 & 0b00001111) << 16 | (rs2 & 0b00001111) << 20;
+}
+
+// Also stores and branches, with rs1/rs2 in place of rd/rs1
+constexpr uint32_t encode_immediate(const Instruction *instruction, uint32_t rd, uint32_t rs1,
+                                    uint32_t imm) {
+  return encode_head(instruction) | (rd & 0b00001111) << 8 | (rs1 & 0b00001111) << 12 | imm << 16;
+}
+
+constexpr uint32_t encode_upper(const Instruction *instruction, uint32_t rd, uint32_t imm) {
+  return encode_head(instruction) | (instruction->funct4 & 0b00001111) << 8 | (rd & 0b00001111) << 12 |
+         (imm & 0xFFFF) << 16;
+}
+
+// imm[11:0] in bits 12-23, imm[19:12] in bits 24-31
+constexpr uint32_t encode_jump(const Instruction *instruction, uint32_t rd, uint32_t imm) {
+  return encode_head(instruction) | (rd & 0b00001111) << 8 | (imm & 0xFFF) << 12 |
+         ((imm >> 12) & 0xFF) << 24;
+}
+
+constexpr uint32_t encode_shift_immediate(const Instruction *instruction, uint32_t rd, uint32_t rs1,
+                                          uint32_t imm) {
+  return encode_head(instruction) | (instruction->funct4 & 0b00001111) << 8 | (rd & 0b00001111) << 12 |
+         (imm & 0xFF) << 16 | (rs1 & 0xF) << 24;
+}
+
+// Replace the immediate field of an encoded instruction
+constexpr uint32_t encode_patch_immediate(const Instruction *instruction, uint32_t value, uint32_t imm) {
+  if (instruction->format == FORMAT_JUMP) {
+    return (value & 0x00000FFF) | (imm & 0xFFF) << 12 | ((imm >> 12) & 0xFF) << 24;
+  }
+  if (instruction->format == FORMAT_SHIFT_IMMEDIATE) {
+    return (value & 0xFF00FFFF) | ((imm & 0xFF) << 16);
+  }
+  return (value & 0x0000FFFF) | ((imm & 0xFFFF) << 16);
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef HOT_RELOAD_H
+#define HOT_RELOAD_H
+
+#include "architecture.h"
+#include "asm_session.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Hot reload: a watcher thread flags saves of the ROM source, and the VM
+// loop calls hot_reload_apply() between instructions. The source is
+// reassembled incrementally and only the changed program bytes are
+// copied into memory; RAM, registers and the display are left alone.
+// The PC is remapped by label: an address N instructions past label L
+// moves to N instructions past L in the new image (or to L itself if that
+// block got shorter). Return addresses are not: JAL/JALR keep only the
+// return page in a link register, so a call in flight across a reload
+// returns by its old page.
+
+typedef struct {
+  uint32_t address;
+  char name[SYMBOL_NAME_MAX];
+} LabelAddress;
+
+// Labels of one image, sorted by address
+typedef struct {
+  LabelAddress *labels;
+  size_t count, capacity;
+} LabelMap;
+
+typedef struct HotReload {
+  const char *sourcePath;
+  AsmSession session;
+  LabelMap labels;      // labels of the image currently in memory
+  LabelMap nextLabels;  // labels of the image being swapped in
+  size_t loadedSize;    // image bytes currently in memory
+  size_t changedStart;  // program bytes replaced by the last reload
+  size_t changedEnd;
+  uint32_t reloads;
+  int notify;
+  int pending;          // set by the watcher, cleared by hot_reload_apply
+  int running;
+  pthread_t watcher;
+  bool watching;
+} HotReload;
+
+// Assemble the source into vm memory and start watching it
+bool hot_reload_start(HotReload *reload, BasicVm *vm, const char *sourcePath);
+
+inline bool hot_reload_pending(HotReload *reload) {
+  return __atomic_load_n(&reload->pending, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Reassemble and patch the running VM. On assembly errors the VM keeps
+// running the old code and false is returned.
+bool hot_reload_apply(HotReload *reload, BasicVm *vm);
+
+void hot_reload_stop(HotReload *reload);
+
+#endif
@@ -8,10 +8,108 @@
 #define BITS_20 20
 #define BITS_24 24
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <strings.h>
 
+// Operand layout of an instruction; every encoder, decoder and printer
+// is selected by this, so a new instruction of an existing format only
+// needs a table row (and its case in vm_execute_instruction)
+typedef enum {
+  FORMAT_NONE,
+  FORMAT_BYTE,             // opcode|funct3                                  HALT, CLS
+  FORMAT_REGISTER,         // + funct4 rd | rs1 rs2                (24-bit)  ADD, AND, SLL, CHAR
+  FORMAT_IMMEDIATE,        // + rd rs1 | imm16                               ADDI, ANDI, LW, JALR
+  FORMAT_STORE_BRANCH,     // + rs1 rs2 | imm16                              SB, BEQ
+  FORMAT_UPPER,            // + funct4 rd | imm16                            LUI, AUIPC
+  FORMAT_JUMP,             // + rd imm[11:0] | imm[19:12]                    JAL
+  FORMAT_SHIFT_IMMEDIATE,  // + funct4 rd | imm8 | rs1                       SLLI, SRLI
+  FORMAT_COUNT
+} InstructionFormat;
+
+// Formats whose funct4 nibble (bits 8-11) tells rows of one first byte apart
+#define FORMAT_HAS_FUNCT4(format) \
+  ((format) == FORMAT_REGISTER || (format) == FORMAT_UPPER || (format) == FORMAT_SHIFT_IMMEDIATE)
+
+#define FORMAT_LENGTH(format) \
+  ((format) == FORMAT_NONE ? 0 : (format) == FORMAT_BYTE ? 8 : (format) == FORMAT_REGISTER ? 24 : 32)
+
+// The ISA, defined once: X(mnemonic, opcode, funct3, funct4, format).
+// The first byte (opcode_funct3) and the length follow from the fields.
+// Expanded into instructions[], the IsaOp ids, the assembler's mnemonic
+// hash, the constexpr assembler and the VM's decode table, which refuses
+// to compile if two rows encode the same.
+#define INSTRUCTION_LIST(X) \
+  X(NULL, 0x00, 0x0, 0x0, FORMAT_NONE) \
+  \
+  /* Arithmetic */ \
+  X(ADD, 0x01, 0x0, 0x0, FORMAT_REGISTER) \
+  X(SUB, 0x01, 0x0, 0x1, FORMAT_REGISTER) \
+  X(MUL, 0x01, 0x0, 0x2, FORMAT_REGISTER) \
+  X(DIV, 0x01, 0x0, 0x3, FORMAT_REGISTER) \
+  \
+  /* Immediates */ \
+  X(ADDI, 0x02, 0x0, 0x0, FORMAT_IMMEDIATE) \
+  X(SUBI, 0x02, 0x1, 0x0, FORMAT_IMMEDIATE) \
+  X(MULI, 0x02, 0x2, 0x0, FORMAT_IMMEDIATE) \
+  X(DIVI, 0x02, 0x3, 0x0, FORMAT_IMMEDIATE) \
+  \
+  /* Upper Immediates */ \
+  X(LUI, 0x03, 0x0, 0x0, FORMAT_UPPER) \
+  X(AUIPC, 0x03, 0x0, 0x1, FORMAT_UPPER) \
+  \
+  /* Stores */ \
+  X(SB, 0x04, 0x0, 0x0, FORMAT_STORE_BRANCH) \
+  X(SH, 0x04, 0x1, 0x0, FORMAT_STORE_BRANCH) \
+  X(SW, 0x04, 0x2, 0x0, FORMAT_STORE_BRANCH) \
+  \
+  /* Branches */ \
+  X(BEQ, 0x05, 0x0, 0x0, FORMAT_STORE_BRANCH) \
+  X(BNE, 0x05, 0x1, 0x0, FORMAT_STORE_BRANCH) \
+  X(BLT, 0x05, 0x2, 0x0, FORMAT_STORE_BRANCH) \
+  X(BGT, 0x05, 0x3, 0x0, FORMAT_STORE_BRANCH) \
+  X(BLE, 0x05, 0x4, 0x0, FORMAT_STORE_BRANCH) \
+  X(BGE, 0x05, 0x5, 0x0, FORMAT_STORE_BRANCH) \
+  \
+  /* Jump + Link */ \
+  X(JAL, 0x06, 0x1, 0x0, FORMAT_JUMP) \
+  X(JALR, 0x06, 0x2, 0x0, FORMAT_IMMEDIATE) \
+  \
+  /* loads */ \
+  X(LW, 0x07, 0x0, 0x0, FORMAT_IMMEDIATE) \
+  X(LH, 0x07, 0x1, 0x0, FORMAT_IMMEDIATE) \
+  X(LB, 0x07, 0x2, 0x0, FORMAT_IMMEDIATE) \
+  \
+  /* Bitwise Operations */ \
+  X(AND, 0x08, 0x0, 0x0, FORMAT_REGISTER) \
+  X(OR, 0x08, 0x0, 0x1, FORMAT_REGISTER) \
+  X(XOR, 0x08, 0x0, 0x2, FORMAT_REGISTER) \
+  \
+  /* Bitwise Immediates Operations */ \
+  X(ANDI, 0x09, 0x0, 0x0, FORMAT_IMMEDIATE) \
+  X(ORI, 0x09, 0x1, 0x0, FORMAT_IMMEDIATE) \
+  X(XORI, 0x09, 0x2, 0x0, FORMAT_IMMEDIATE) \
+  \
+  /* Shifts */ \
+  X(SLL, 0x0A, 0x0, 0x0, FORMAT_REGISTER) \
+  X(SRL, 0x0A, 0x0, 0x1, FORMAT_REGISTER) \
+  \
+  /* Immediate Shifts */ \
+  X(SLLI, 0x0A, 0x1, 0x0, FORMAT_SHIFT_IMMEDIATE) \
+  X(SRLI, 0x0A, 0x1, 0x1, FORMAT_SHIFT_IMMEDIATE) \
+  \
+  /* Display */ \
+  X(CHAR, 0x0B, 0x0, 0x0, FORMAT_REGISTER) \
+  \
+  /* Banking */ \
+  X(BANK, 0x0D, 0x0, 0x0, FORMAT_IMMEDIATE) \
+  \
+  /* Byte Instructions */ \
+  X(HALT, 0x1F, 0x7, 0x0, FORMAT_BYTE) \
+  X(CLS, 0x0B, 0x7, 0x0, FORMAT_BYTE)
+  /* end */
+
 typedef struct {
   const char *name;
   uint8_t opcode;
@@ -19,11 +117,29 @@ typedef struct {
   uint8_t opcode_funct3;
   uint8_t funct4;
   uint8_t length;
+  uint8_t format; // InstructionFormat
 } Instruction;
 
+// Row ids: ISA_ADD is the index of ADD in instructions[]
+#define INSTRUCTION_ID(mnemonic, opcode, funct3, funct4, format) ISA_##mnemonic,
+typedef enum { INSTRUCTION_LIST(INSTRUCTION_ID) ISA_COUNT } IsaOp;
+#undef INSTRUCTION_ID
+
+#define INSTRUCTION_ROW(mnemonic, opcode, funct3, funct4, format) \
+  Instruction{#mnemonic, opcode, funct3, (uint8_t)((opcode) << 3 | (funct3)), funct4, \
+              FORMAT_LENGTH(format), format},
+
+// The same rows for constant expressions
+constexpr Instruction instruction_rows[] = {INSTRUCTION_LIST(INSTRUCTION_ROW)};
+
 extern Instruction instructions[];
 
+static inline IsaOp isa_op(const Instruction *instruction) {
+  return (IsaOp)(instruction - instructions);
+}
+
 Instruction *get_instruction_by_alias(char *instructionStr);
+Instruction *get_instruction_by_name(const char *name, size_t length);
 Instruction *get_instruction_by_asm(const char *asmLine);
 Instruction *get_instruction_by_opcode_funct3(uint8_t opcode, uint8_t funct3);
 Instruction *get_instruction_by_opcodefunct3(uint8_t opcodefunct3);
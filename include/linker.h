@@ -0,0 +1,24 @@
+#ifndef LINKER_H
+#define LINKER_H
+
+#include "assembler.h"
+#include "object.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Link relocatable objects into one image at `origin`. Sections reachable
+// from the first section of the first object (the entry point) through
+// relocations are kept and laid out in input order; the rest are dropped.
+// A module's own definitions win over other modules'; two modules defining
+// the same label is an error, the same constant with the same value is not.
+
+typedef struct {
+  size_t keptSections, droppedSections;
+  size_t keptBytes, droppedBytes;
+} LinkStats;
+
+// names label the objects in diagnostics; the image goes to result
+bool link_objects(const ObjectFile *objects, const char *const *names, size_t count,
+                  uint32_t origin, AsmResult *result, LinkStats *stats);
+
+#endif
@@ -0,0 +1,148 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+// Leveled asynchronous logger
+//
+// log_write() copies the format pointer and raw arguments into a record on
+// the calling thread's lock-free queue; a background thread formats and
+// writes it to stdout. Formats and %s arguments must be string literals or
+// otherwise outlive the call, since they are only read at format time;
+// wrap short-lived strings in log_text() to copy them into the record
+// (one per call).
+// If a queue is full, info/debug/trace records are dropped (and counted)
+// rather than stalling the caller; errors and warnings wait for space.
+
+typedef enum {
+    LOG_ERROR,
+    LOG_WARN,
+    LOG_INFO,
+    LOG_DEBUG,
+    LOG_TRACE
+} LogLevel;
+
+#define LOG_MAX_ARGS 8
+#define LOG_TEXT_SIZE 96
+
+typedef enum {
+    LOG_ARG_INT,
+    LOG_ARG_UINT,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STR,
+    LOG_ARG_TEXT,
+    LOG_ARG_BINARY
+} LogArgType;
+
+typedef struct {
+    uint8_t type;
+    uint8_t bits;  // LOG_ARG_BINARY width
+    uint32_t length; // LOG_ARG_TEXT span length
+    union {
+        int64_t i;
+        uint64_t u;
+        double d;
+        const char *s;
+    };
+} LogArg;
+
+typedef struct {
+    const char *fmt;
+    uint8_t level;
+    uint8_t argc;
+    LogArg args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_SIZE]; // storage for a log_text() argument
+} LogRecord;
+
+// A value rendered as grouped binary digits for a %s conversion
+typedef struct {
+    uint32_t value;
+    uint8_t bits;
+} LogBinary;
+
+inline LogBinary log_binary(uint32_t value, uint8_t bits) {
+    LogBinary binary = {value, bits};
+    return binary;
+}
+
+// A string copied into the record (truncated to LOG_TEXT_SIZE - 1 bytes);
+// pass a length for spans that are not NUL-terminated
+typedef struct {
+    const char *s;
+    size_t length;
+} LogText;
+
+inline LogText log_text(const char *s, size_t length = (size_t)-1) {
+    LogText text = {s, length};
+    return text;
+}
+
+extern int log_level;
+
+inline bool log_enabled(LogLevel level) {
+    return (int)level <= log_level;
+}
+
+void log_set_level(LogLevel level);
+
+// Send log output to another stream (stdout by default), e.g. stderr when
+// stdout carries data
+void log_set_output(FILE *out);
+
+// Enqueue a record on the calling thread's queue
+void log_submit(const LogRecord *record);
+
+// Block until everything queued so far has been written
+void log_flush();
+
+// Flush and stop the writer thread (also registered with atexit)
+void log_shutdown();
+
+inline LogArg log_arg(int value) { LogArg a; a.type = LOG_ARG_INT; a.bits = 0; a.i = value; return a; }
+inline LogArg log_arg(long value) { LogArg a; a.type = LOG_ARG_INT; a.bits = 0; a.i = value; return a; }
+inline LogArg log_arg(long long value) { LogArg a; a.type = LOG_ARG_INT; a.bits = 0; a.i = value; return a; }
+inline LogArg log_arg(unsigned int value) { LogArg a; a.type = LOG_ARG_UINT; a.bits = 0; a.u = value; return a; }
+inline LogArg log_arg(unsigned long value) { LogArg a; a.type = LOG_ARG_UINT; a.bits = 0; a.u = value; return a; }
+inline LogArg log_arg(unsigned long long value) { LogArg a; a.type = LOG_ARG_UINT; a.bits = 0; a.u = value; return a; }
+inline LogArg log_arg(double value) { LogArg a; a.type = LOG_ARG_DOUBLE; a.bits = 0; a.d = value; return a; }
+inline LogArg log_arg(const char *value) { LogArg a; a.type = LOG_ARG_STR; a.bits = 0; a.s = value; return a; }
+inline LogArg log_arg(LogText value) { LogArg a; a.type = LOG_ARG_TEXT; a.bits = 0; a.s = value.s; a.length = value.length > LOG_TEXT_SIZE ? LOG_TEXT_SIZE : (uint32_t)value.length; return a; }
+inline LogArg log_arg(LogBinary value) { LogArg a; a.type = LOG_ARG_BINARY; a.bits = value.bits; a.u = value.value; return a; }
+
+// A record has room for one log_text() copy
+template <typename T> struct LogTextCount { static const int value = 0; };
+template <> struct LogTextCount<LogText> { static const int value = 1; };
+
+template <typename... Args>
+inline void log_write(LogLevel level, const char *fmt, Args... args) {
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    static_assert((0 + ... + LogTextCount<Args>::value) <= 1, "at most one log_text() argument per record");
+    if (!log_enabled(level)) {
+        return;
+    }
+
+    LogArg packed[sizeof...(Args) + 1] = {log_arg(args)...};
+    LogRecord record;
+    record.fmt = fmt;
+    record.level = (uint8_t)level;
+    record.argc = (uint8_t)sizeof...(Args);
+    memcpy(record.args, packed, sizeof(LogArg) * sizeof...(Args));
+    record.text[0] = '\0';
+    for (size_t i = 0; i < sizeof...(Args); i++) {
+        if (packed[i].type == LOG_ARG_TEXT) {
+            size_t length = packed[i].s ? strnlen(packed[i].s, packed[i].length) : 0;
+            if (length > LOG_TEXT_SIZE - 1) {
+                length = LOG_TEXT_SIZE - 1;
+            }
+            memcpy(record.text, packed[i].s, length);
+            record.text[length] = '\0';
+            break;
+        }
+    }
+    log_submit(&record);
+}
+
+#endif // LOG_H
@@ -0,0 +1,32 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Small LZ77 codec for ROM sections, in the style of an LZ4 block
+//
+// A stream is a run of sequences, each a token byte, its literals and, for
+// all but the last sequence, a match:
+//   token: literal count (high nibble) | match length - LZ_MIN_MATCH (low nibble)
+//   a nibble of 15 is followed by bytes added to it, 255 meaning "more follows"
+//   literals, then the match offset back from the output position (u16, >= 1)
+// The last sequence ends the input after its literals. Matches may overlap
+// their own output, so runs of one byte cost a few bytes. Text compresses
+// to about half; code much less.
+#define LZ_MIN_MATCH 4
+
+// Largest output lz_compress() can produce for size input bytes
+size_t lz_compress_bound(size_t size);
+
+// Compress size bytes into out (lz_compress_bound(size) bytes); returns the
+// compressed size
+size_t lz_compress(const uint8_t *in, size_t size, uint8_t *out);
+
+// Decompress a whole stream into exactly outSize bytes, reading the input
+// front to back and writing out in order. False on a corrupt or truncated
+// stream, or one that does not fill out exactly; out may be partly written.
+bool lz_decompress(const uint8_t *in, size_t inSize, uint8_t *out, size_t outSize);
+
+#endif // LZ_H
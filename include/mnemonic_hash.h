@@ -0,0 +1,96 @@
+#ifndef MNEMONIC_HASH_H
+#define MNEMONIC_HASH_H
+
+#include "instructions.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Perfect hash from mnemonic (any case) to its index in instructions[].
+// The seed and slot table are searched by the compiler over
+// INSTRUCTION_LIST, so adding an instruction only needs a table row.
+// Needs C++14 constexpr (loops in constexpr functions).
+
+#define MNEMONIC_SLOTS 256
+#define MNEMONIC_EMPTY 0xFF
+
+constexpr char mnemonic_fold(char c) {
+  return (c >= 'a' && c <= 'z') ? (char)(c - 'a' + 'A') : c;
+}
+
+// FNV-1a over the upper-cased characters, starting from a seed
+constexpr uint32_t mnemonic_hash(const char *s, size_t length, uint32_t seed) {
+  uint32_t h = 2166136261u ^ seed;
+  for (size_t i = 0; i < length; i++) {
+    h = (h ^ (uint8_t)mnemonic_fold(s[i])) * 16777619u;
+  }
+  return h ^ (h >> 15);
+}
+
+constexpr size_t mnemonic_length(const char *s) {
+  size_t n = 0;
+  while (s[n] != '\0') {
+    n++;
+  }
+  return n;
+}
+
+#define MNEMONIC_NAME(mnemonic, opcode, funct3, funct4, format) #mnemonic,
+constexpr const char *mnemonic_names[] = {INSTRUCTION_LIST(MNEMONIC_NAME)};
+#undef MNEMONIC_NAME
+
+constexpr size_t MNEMONIC_COUNT = sizeof(mnemonic_names) / sizeof(mnemonic_names[0]);
+static_assert(MNEMONIC_COUNT < MNEMONIC_EMPTY, "too many mnemonics for uint8_t slots");
+
+struct MnemonicTable {
+  uint32_t seed;
+  uint8_t slot[MNEMONIC_SLOTS];
+};
+
+// Try seeds until every mnemonic lands in its own slot
+constexpr MnemonicTable build_mnemonic_table() {
+  for (uint32_t seed = 0; seed < 100000; seed++) {
+    MnemonicTable table = {seed, {}};
+    for (size_t i = 0; i < MNEMONIC_SLOTS; i++) {
+      table.slot[i] = MNEMONIC_EMPTY;
+    }
+
+    bool collided = false;
+    for (size_t i = 0; i < MNEMONIC_COUNT && !collided; i++) {
+      const char *name = mnemonic_names[i];
+      uint32_t slot = mnemonic_hash(name, mnemonic_length(name), seed) & (MNEMONIC_SLOTS - 1);
+      if (table.slot[slot] != MNEMONIC_EMPTY) {
+        collided = true;
+      } else {
+        table.slot[slot] = (uint8_t)i;
+      }
+    }
+
+    if (!collided) {
+      return table;
+    }
+  }
+  return MnemonicTable{0xFFFFFFFFu, {}};
+}
+
+constexpr MnemonicTable mnemonic_table = build_mnemonic_table();
+static_assert(mnemonic_table.seed != 0xFFFFFFFFu, "no perfect hash seed found for INSTRUCTION_LIST");
+
+// Index into instructions[] for a mnemonic span, or -1 if unknown
+constexpr int mnemonic_lookup(const char *s, size_t length) {
+  uint32_t slot = mnemonic_hash(s, length, mnemonic_table.seed) & (MNEMONIC_SLOTS - 1);
+  uint8_t index = mnemonic_table.slot[slot];
+  if (index == MNEMONIC_EMPTY) {
+    return -1;
+  }
+
+  // One verifying compare against the only candidate
+  const char *name = mnemonic_names[index];
+  for (size_t i = 0; i < length; i++) {
+    if (mnemonic_fold(s[i]) != name[i]) {
+      return -1;
+    }
+  }
+  return name[length] == '\0' ? index : -1;
+}
+
+#endif
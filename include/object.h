@@ -0,0 +1,75 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include "assembler.h"
+#include "rom_writer.h"
+#include "symbols.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Relocatable object: the code of one module split into sections, the
+// symbols it defines or uses, and relocations for every symbolic immediate.
+// Label values are offsets into their section; constants are absolute.
+// Sections are the linker's unit of layout and dead-code elimination, so
+// code must not fall through from one section into the next.
+//
+// File: "BVMO" | version(1) | sectionCount(u16) | symbolCount(u32) |
+//       relocationCount(u32) | codeSize(u32), all little-endian, then
+//   sections     nameLength(u8) name size(u32), in code order
+//   symbols      nameLength(u8) name kind(u8) section(u16) value(u32)
+//   relocations  section(u16) offset(u32) symbol(u32), in section order
+//   code         codeSize bytes
+#define OBJECT_MAGIC    "BVMO"
+#define OBJECT_VERSION  1
+
+#define OBJECT_UNDEFINED 0xFFFF // symbol section: defined by another module
+#define OBJECT_ABSOLUTE  0xFFFE // symbol section: .equ constant
+
+// Name of the section code goes to before any .section directive
+#define OBJECT_DEFAULT_SECTION ".text"
+
+typedef struct {
+  char name[SYMBOL_NAME_MAX];
+  uint32_t offset;          // into the object's code
+  uint32_t size;
+  size_t firstRelocation;   // relocations of a section are contiguous
+  size_t relocationCount;
+} ObjectSection;
+
+typedef struct {
+  char name[SYMBOL_NAME_MAX];
+  uint8_t kind;             // SymbolKind
+  uint16_t section;         // index, OBJECT_UNDEFINED or OBJECT_ABSOLUTE
+  uint32_t value;
+} ObjectSymbol;
+
+// An encoded instruction whose immediate names symbols[symbol]
+typedef struct {
+  uint16_t section;
+  uint32_t offset;          // of the instruction within its section
+  uint32_t symbol;
+} ObjectRelocation;
+
+typedef struct {
+  ObjectSection *sections;
+  size_t sectionCount, sectionCapacity;
+  ObjectSymbol *symbols;
+  size_t symbolCount, symbolCapacity;
+  ObjectRelocation *relocations;
+  size_t relocationCount, relocationCapacity;
+  RomImage code;
+} ObjectFile;
+
+// Assemble one module; diagnostics go to result (its image is unused).
+// Zero-initialize the object first and release it with object_free().
+bool assemble_object(const char *source, size_t length, ObjectFile *object, AsmResult *result);
+
+bool object_write(const ObjectFile *object, int fd);
+
+// Parse an object file image; fails on a bad header or truncated tables
+bool object_read(const uint8_t *data, size_t size, ObjectFile *object);
+
+void object_free(ObjectFile *object);
+
+#endif
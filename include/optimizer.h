@@ -0,0 +1,61 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "assembler.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Optimizing variant of assemble(). Lines are parsed as usual, then the
+// instruction list is rewritten before addresses are assigned:
+//   no-ops     identity immediates (ADDI rX, rX, 0, ANDI rX, rX, 0xFF, ...)
+//              and branches or plain jumps to the next instruction go away
+//   fold       two immediate ops of one kind on the same register merge
+//              (ADDI/SUBI, MULI, ANDI, ORI, XORI)
+//   thread     jumps and branches to a plain jump go to its target, and
+//              trampolines nothing reaches any more are dropped
+//   shorten    32-bit moves and clears become 24-bit OR rd, rs, rs and
+//              XOR rd, rd, rd
+//   layout     with a profile, basic blocks are reordered so hot paths
+//              are contiguous; a conditional branch whose taken side is
+//              hotter is inverted so the hot side falls through
+// Labels and literal branch offsets are both tracked as instruction
+// targets, so code never folds across one. Plain jumps are "BEQ rX, rX"
+// (also BLE/BGE); JAL writes rd even when it is r0, so it is never one.
+// Computed jumps (JALR) must land on labels or return addresses. A literal branch offset that does
+// not land on an instruction disables the rewrites for the whole source.
+
+// Execution counts for profile-guided layout. Entries name a PC of the
+// plain (source-order) build of the same source, as written by the VM
+// profilers, or a label, which holds across layouts.
+typedef struct {
+  uint32_t address;
+  const char *label;      // span in the profile text, NULL for an address
+  uint16_t labelLength;
+  uint32_t count;
+} AsmProfileEntry;
+
+typedef struct {
+  AsmProfileEntry *entries;
+  size_t count, capacity;
+} AsmProfile;
+
+// "<0xPC|label> <count>" per line; ';' and '#' start comments. Labels
+// point into text, which must outlive the profile.
+bool asm_profile_parse(const char *text, size_t length, AsmProfile *profile);
+void asm_profile_free(AsmProfile *profile);
+
+typedef struct {
+  size_t removed, removedBytes;
+  size_t folded, foldedBytes;
+  size_t threaded, threadedBytes; // retargeted jumps, dropped trampolines
+  size_t shortened, shortenedBytes;
+  size_t movedBlocks, invertedBranches;
+  uint32_t skippedLine;           // nonzero if rewrites were disabled by this line
+} AsmOptStats;
+
+// profile may be NULL to keep source order
+bool assemble_optimized(const char *source, size_t length, uint32_t origin,
+                        const AsmProfile *profile, AsmResult *result, AsmOptStats *stats);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Hardware counters sampled around guest execution (Linux perf_event_open)
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,
+    PERF_COUNTER_COUNT
+} PerfCounterId;
+
+// One bucket per 5-bit opcode
+#define PERF_OPCODE_CLASSES 32
+
+typedef struct {
+    int leader_fd;                        // group leader, -1 when unavailable
+    int fds[PERF_COUNTER_COUNT];          // -1 for counters the host refused
+    int group_slot[PERF_COUNTER_COUNT];   // position of each counter in a group read
+    int opened;
+    uint64_t begin[PERF_COUNTER_COUNT];
+    uint64_t totals[PERF_COUNTER_COUNT];
+    uint64_t guest_instructions;
+    uint64_t class_totals[PERF_OPCODE_CLASSES][PERF_COUNTER_COUNT];
+    uint64_t class_instructions[PERF_OPCODE_CLASSES];
+} PerfCounters;
+
+// Open the counter group; returns false (and explains why) when the host
+// forbids access, e.g. perf_event_paranoid is too strict. All other calls
+// are no-ops on an unopened set, so callers need no extra checks.
+bool perf_counters_open(PerfCounters *counters);
+void perf_counters_close(PerfCounters *counters);
+
+// Read the current counter values into values[PERF_COUNTER_COUNT]
+void perf_counters_read(PerfCounters *counters, uint64_t values[PERF_COUNTER_COUNT]);
+
+// Bracket the whole run
+void perf_counters_begin(PerfCounters *counters);
+void perf_counters_end(PerfCounters *counters, uint64_t guest_instructions);
+
+// Attribute the delta since before[] to one executed instruction of an opcode class
+void perf_counters_attribute(PerfCounters *counters, uint8_t opcode, const uint64_t before[PERF_COUNTER_COUNT]);
+
+// Totals normalized per guest instruction, then per opcode class
+void perf_counters_report(const PerfCounters *counters, FILE *out);
+
+#endif // PERF_COUNTERS_H
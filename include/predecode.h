@@ -0,0 +1,76 @@
+#ifndef PREDECODE_H
+#define PREDECODE_H
+
+#include "decode.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Persistent pre-decoded ROM: every byte offset of the image decoded once,
+// saved as PREDECODE_CACHE_DIR/<hash>.bvmd with the image's FNV-1a hash as
+// the name. A later start with the same ROM costs one hash and one mmap of
+// that file; vm_step then reads entries instead of decoding.
+//
+// File: "BVMD" | version(1) | entrySize(1) | origin(u16) | imageSize(u32) |
+//       reserved(4) | imageHash(u64) | reserved(8), then imageSize entries.
+// Entries are in host byte order: the cache belongs to the machine that
+// wrote it, and a file that does not match is rebuilt.
+#define PREDECODE_MAGIC       "BVMD"
+#define PREDECODE_VERSION     1
+#define PREDECODE_HEADER_SIZE 32
+
+typedef struct {
+    uint32_t word;          // raw instruction bytes, little-endian
+    uint32_t imm;
+    uint8_t op;             // IsaOp
+    uint8_t length;         // in bytes; 0 where nothing decodes
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    uint8_t funct4;
+    uint8_t reserved[2];
+} PredecodedInstruction;
+
+static_assert(sizeof(PredecodedInstruction) == 16, "cache entries are 16 bytes");
+
+typedef struct {
+    const PredecodedInstruction *entries; // one per image byte, NULL when closed
+    uint32_t size;
+    void *mapping;          // the mmap()ed file, or NULL for a heap table
+    size_t mappingSize;
+} PredecodeCache;
+
+// Map the cache file of this image, or decode the image and write the file
+// for the next start (a failed write only costs that). False if closed.
+bool predecode_open(PredecodeCache *cache, const uint8_t *image, uint32_t size, uint16_t origin,
+                    const char *dir);
+
+// Re-decode after image bytes [start, end) changed in place and the image
+// became size bytes long. A mapped table is first copied to the heap, since
+// the file belongs to the old image. False, and closed, if out of memory.
+bool predecode_update(PredecodeCache *cache, const uint8_t *image, uint32_t size, uint32_t start, uint32_t end);
+
+void predecode_close(PredecodeCache *cache);
+
+// The instruction at image offset, rebuilt from its entry
+static inline bool predecode_fetch(const PredecodeCache *cache, uint32_t offset, DecodedInstruction *dec) {
+    if (offset >= cache->size || cache->entries[offset].length == 0) {
+        return false;
+    }
+    const PredecodedInstruction *entry = &cache->entries[offset];
+    Instruction *ins = &instructions[entry->op];
+    dec->op = entry->op;
+    dec->opcode = ins->opcode;
+    dec->funct3 = ins->funct3;
+    dec->funct4 = entry->funct4;
+    dec->opcode_funct3 = ins->opcode_funct3;
+    dec->rd = entry->rd;
+    dec->rs1 = entry->rs1;
+    dec->rs2 = entry->rs2;
+    dec->imm = entry->imm;
+    dec->isHalt = entry->op == ISA_HALT;
+    dec->instruction = ins;
+    return true;
+}
+
+#endif // PREDECODE_H
@@ -0,0 +1,35 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "architecture.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Per-PC execution histogram, one bucket per guest address
+typedef struct {
+    uint32_t counts[RAM_SIZE];
+    uint64_t total;
+    const char *mode; // "exact" or "sampling"
+} PcProfile;
+
+// Clear all buckets and tag the profile with its collection mode
+void profiler_reset(PcProfile *profile, const char *mode);
+
+// Exact profiling: count one hit for the instruction about to execute
+inline void profiler_record(PcProfile *profile, uint16_t pc) {
+    profile->counts[pc]++;
+    profile->total++;
+}
+
+// Sampling profiling: arm a SIGPROF timer that records vm->program_counter
+void profiler_start_sampling(BasicVm *vm, PcProfile *profile, long interval_us);
+void profiler_stop_sampling(PcProfile *profile);
+
+// Shared report for both modes: hottest PCs with mnemonic and share of total
+void profiler_report(BasicVm *vm, const PcProfile *profile, FILE *out, int max_rows);
+
+// Write "0xPC count" lines for every hit PC, for `assembler -O -p`
+bool profiler_write(const PcProfile *profile, const char *path);
+
+#endif // PROFILER_H
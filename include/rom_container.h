@@ -0,0 +1,71 @@
+#ifndef ROM_CONTAINER_H
+#define ROM_CONTAINER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// ROM container: a header, a section table and the section payloads. Each
+// section is copied to its own guest address, so one file can carry code
+// and initialised data, and execution starts at the entry point rather
+// than at PROGRAM_ROM. Files without the magic are headerless images
+// loaded at PROGRAM_ROM, as before, and read back as one section.
+//
+// File: "BVMR" | version(1) | reserved(1) | sectionCount(u16) | entry(u16) |
+//       reserved(6) | checksum(u64), all little-endian, then per section
+//   address(u16) flags(u16) size(u32) offset(u32) fileSize(u32)
+// and the payloads at their offsets. The checksum is FNV-1a over every
+// byte after the header. rom_container_write() (rom_writer.h) writes them.
+//
+// A section flagged ROM_SECTION_LZ holds an lz.h stream of fileSize bytes
+// that decompresses to size bytes. The loader decodes it front to back
+// straight into guest memory, so the file is read once and nothing is
+// buffered in between.
+//
+// A section flagged ROM_SECTION_BANKED belongs to the bank in the high byte
+// of its flags (1 or more) and lies inside the bank window. Bank 0 is plain
+// guest memory, so its sections are unflagged.
+#define ROM_MAGIC          "BVMR"
+#define ROM_VERSION        1
+#define ROM_HEADER_SIZE    24
+#define ROM_SECTION_SIZE   16
+#define ROM_MAX_SECTIONS   1024
+
+#define ROM_SECTION_LZ     0x0001
+#define ROM_SECTION_BANKED 0x0002
+#define ROM_SECTION_BANK(flags) ((flags) >> 8)
+
+typedef struct {
+    uint16_t address;       // guest address of the first byte
+    uint16_t flags;         // ROM_SECTION_*; a file with any other set is rejected
+    uint32_t size;          // bytes in guest memory
+    uint32_t offset;        // payload position in the file
+    uint32_t fileSize;      // payload bytes in the file
+} RomSection;
+
+// A ROM file mapped read-only; sections point into the mapping
+typedef struct {
+    const uint8_t *data;
+    size_t size;
+    bool container;         // false for a headerless image
+    uint16_t entry;
+    uint16_t sectionCount;
+    uint16_t bankCount;     // 1 + the highest bank of a banked section
+} RomFile;
+
+// Map and validate a ROM file; prints the reason and returns false if it
+// cannot be loaded. Release with rom_close().
+bool rom_open(const char *path, RomFile *rom);
+
+RomSection rom_section(const RomFile *rom, uint16_t index);
+
+// Copy or decompress every section into memory (RAM_SIZE bytes), and banked
+// ones into banks ((bankCount - 1) * BANK_SIZE bytes, bank 1 first) unless
+// that is NULL. romSize is the extent of the unbanked sections at or above
+// PROGRAM_ROM, measured from PROGRAM_ROM. False if a compressed section is
+// corrupt.
+bool rom_load(const RomFile *rom, uint8_t *memory, uint8_t *banks, uint32_t *romSize);
+
+void rom_close(RomFile *rom);
+
+#endif // ROM_CONTAINER_H
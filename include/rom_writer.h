@@ -3,6 +3,7 @@
 
 #include "config.h"
 #include "instructions.h"
+#include <stdbool.h>
 
 #ifdef DEBUG
 #include "debug_utils.h"
@@ -13,7 +14,27 @@ typedef struct {
     uint8_t count;
 } BytePack;
 
+// Growable in-memory ROM, written out in one go once assembly succeeds
+typedef struct {
+    uint8_t* bytes;
+    size_t size;
+    size_t capacity;
+} RomImage;
+
 BytePack pack_bytes(Instruction* instruction, uint32_t result);
-void write_to_file(FILE* romFile, BytePack pack);
+bool rom_image_append(RomImage* image, BytePack pack);
+bool rom_image_write(const RomImage* image, int fd);
+// One image of a ROM container and where it loads; bank 0 is guest memory,
+// other banks hold their image inside the bank window
+typedef struct {
+    const RomImage* image;
+    uint16_t address;
+    uint8_t bank;
+} RomSectionImage;
+
+// Write the images as a ROM container (rom_container.h); compress stores
+// each one LZ-compressed when that is smaller
+bool rom_container_write(const RomSectionImage* sections, size_t count, uint16_t entry, bool compress, int fd);
+void rom_image_free(RomImage* image);
 
 #endif
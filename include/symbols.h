@@ -0,0 +1,40 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include "uthash.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SYMBOL_NAME_MAX 64
+
+typedef enum {
+  SYMBOL_LABEL,    // address of the following instruction
+  SYMBOL_CONSTANT  // value from .equ
+} SymbolKind;
+
+typedef struct {
+  char name[SYMBOL_NAME_MAX];
+  uint32_t value;
+  SymbolKind kind;
+  uint32_t line;
+  UT_hash_handle hh;
+} Symbol;
+
+// Hashed symbol table: O(1) define and lookup by name
+typedef struct {
+  Symbol *head;
+} SymbolTable;
+
+// Returns false if the name is too long or already defined
+bool symbol_define(SymbolTable *table, const char *name, size_t length,
+                   uint32_t value, SymbolKind kind, uint32_t line);
+Symbol *symbol_find(const SymbolTable *table, const char *name, size_t length);
+void symbol_table_free(SymbolTable *table);
+
+// Symbol names start with a letter, '_' or '.', and never look like a register
+bool is_symbol_start(char c);
+bool is_symbol_char(char c);
+bool is_register_name(const char *name, size_t length);
+
+#endif
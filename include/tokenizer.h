@@ -0,0 +1,42 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Single-pass lexer for one assembly line. Tokens are spans into the
+// caller's buffer (nothing is copied), so the line must outlive them.
+// Registers and numbers are converted while scanning; symbols are left
+// for the assembler to resolve.
+
+#define ASM_MAX_OPERANDS 4
+
+typedef enum {
+  TOKEN_REGISTER,  // r0-r15, value is the register number
+  TOKEN_IMMEDIATE, // decimal, 0x hex, 0b binary or leading-0 octal, optional sign
+  TOKEN_SYMBOL     // label or .equ name, value is unset
+} TokenKind;
+
+typedef struct {
+  const char *start;
+  uint16_t length;
+  uint8_t kind;
+  uint32_t value;
+} Token;
+
+typedef struct {
+  Token mnemonic; // length 0 for a blank or comment-only line
+  Token operands[ASM_MAX_OPERANDS];
+  uint8_t count;
+  const char *error; // offending position when tokenize_line fails
+} TokenizedLine;
+
+// Lex "MNEMONIC op, op, ..." up to end of line or ';'. Returns false on a
+// malformed operand, a number that does not fit in 32 bits, or too many operands.
+bool tokenize_line(const char *line, TokenizedLine *out);
+
+// True if the operands have exactly the kinds in pattern: 'r' register, 'i' immediate
+bool tokens_match(const TokenizedLine *line, const char *pattern);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "architecture.h"
+#include "decode.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Binary execution trace
+//
+// File: "BVMT" | version(1) | start_pc(u16 little-endian) | records...
+// Records start with a tag byte, low nibble = kind:
+//   TRACE_STEP  pc delta from the previous step, zigzag varint
+//   TRACE_REG   high nibble = register, then the new value byte
+//   TRACE_MEM   address varint, then the new value byte
+#define TRACE_MAGIC    "BVMT"
+#define TRACE_VERSION  1
+
+#define TRACE_STEP     0x1
+#define TRACE_REG      0x2
+#define TRACE_MEM      0x3
+
+// Ring buffer between the VM thread and the writer thread (power of two)
+#define TRACE_RING_SIZE (1 << 20)
+
+typedef struct {
+    uint8_t *ring;
+    uint64_t head;        // written by the VM thread
+    uint64_t tail;        // written by the writer thread
+    int running;
+    FILE *file;
+    pthread_t writer;
+    uint16_t last_pc;
+} TraceWriter;
+
+// Open the trace file and start the background writer
+bool trace_open(TraceWriter *trace, const char *path, uint16_t start_pc);
+
+// Record one executed step: pc and registers are the values before vm_step
+void trace_record_step(TraceWriter *trace, BasicVm *vm, uint16_t pc,
+                       const uint8_t registers[16], const DecodedInstruction *dec);
+
+// Drain the ring, stop the writer and close the file
+void trace_close(TraceWriter *trace);
+
+// Decode a trace file back into text
+bool trace_decode(const char *path, FILE *out);
+
+#endif // TRACE_H
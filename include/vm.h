@@ -3,14 +3,25 @@
 
 #include "architecture.h"
 #include "decode.h"
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-// VM initialization
+// VM initialization. vm_init takes a fresh VM and forgets whatever it held,
+// so release a VM before initialising it again.
 void vm_init(BasicVm *vm);
 
+// Drop the VM's base snapshot and its hold on the ROM banks
+void vm_release(BasicVm *vm);
+
+// Reference-counted ROM bank storage, shared by VMs and snapshots
+uint8_t *vm_banks_alloc(size_t size);
+void vm_banks_retain(const uint8_t *banks);
+void vm_banks_release(const uint8_t *banks);
+
 // ROM loading
 bool vm_load_rom(BasicVm *vm, const char *filename);
+bool vm_load_image(BasicVm *vm, const uint8_t *bytes, size_t size);
 
 // Execution
 bool vm_run(BasicVm *vm);
@@ -18,6 +29,34 @@ bool vm_run(BasicVm *vm);
 // Single step execution
 DecodedInstruction vm_step(BasicVm *vm);
 
+// Look up the instruction whose first byte is at pc (NULL if unknown)
+Instruction *vm_fetch_instruction(BasicVm *vm, uint16_t pc);
+
+// Code byte at addr as instruction fetch sees it, through the bank window
+static inline uint8_t vm_code_byte(const BasicVm *vm, uint16_t addr)
+{
+    uint16_t offset = addr - BANK_WINDOW;
+    return vm->bank_window && offset < BANK_SIZE ? vm->bank_window[offset] : vm->memory[addr];
+}
+
+// Map bank into the window (a pointer swap); false if the ROM has no such bank
+bool vm_select_bank(BasicVm *vm, uint8_t bank);
+
+#ifdef HOT_RELOAD
+// Poll for source changes between instructions (NULL to detach)
+struct HotReload;
+void vm_attach_hot_reload(HotReload *reload);
+#endif
+
+#ifdef BLOCK_MAP
+// Basic-block map of the loaded image, for engines that work on blocks.
+// vm_run loads it from BLOCK_MAP_PATH; a missing or stale file (or a NULL
+// path) recovers it from the image in memory instead.
+struct CfgMap;
+bool vm_load_block_map(BasicVm *vm, const char *path);
+const CfgMap *vm_block_map(void);
+#endif
+
 // Debug output
 void vm_print_state(BasicVm *vm);
 void vm_print_instruction(BasicVm *vm, DecodedInstruction decodedInstruction);
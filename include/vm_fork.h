@@ -0,0 +1,83 @@
+#ifndef VM_FORK_H
+#define VM_FORK_H
+
+#include "config.h"
+#include "architecture.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Copy-on-write snapshots for exploring many futures of one game state
+//
+// A snapshot is the whole VM state: memory and the display buffer as
+// VM_PAGE_SIZE pages, plus registers, PC, stack and bank. Pages are
+// reference counted and shared between snapshots, so a page that did not
+// change since the last snapshot is stored once however many snapshots
+// hold it. A VM remembers the snapshot it was last synced with and, under
+// VM_FORK, which pages it has written since:
+//
+//   vm_snapshot  copies only the written pages and shares the rest
+//   vm_restore   copies only the pages that differ from the VM's own
+//                snapshot (shared pages are equal by pointer) or that
+//                the VM has written
+//   vm_fork      both: the child becomes a copy of the parent
+//
+// so both cost O(dirty pages) rather than the 1.3MB of a BasicVm. Keep a
+// pool of child VMs and fork into them again and again: only the first
+// fork into a fresh VM copies everything. vm_release() a pooled VM before
+// vm_init() on it again. Without VM_FORK no writes are tracked, every page
+// counts as written and both copy everything.
+//
+// Snapshots may be shared across threads; each BasicVm belongs to one.
+// ROM banks are shared with the VM a snapshot came from, not copied; the
+// last VM or snapshot to let go of them frees them.
+
+typedef struct VmSnapshot VmSnapshot;
+
+// Capture the state of vm; NULL if out of memory. The caller owns one
+// reference and vm keeps another as its new base.
+VmSnapshot *vm_snapshot(BasicVm *vm);
+
+// Make vm a copy of snapshot; vm keeps a reference to it as its base
+void vm_restore(BasicVm *vm, VmSnapshot *snapshot);
+
+// Make child a copy of parent's current state. False if out of memory.
+bool vm_fork(BasicVm *parent, BasicVm *child);
+
+void vm_snapshot_retain(VmSnapshot *snapshot);
+void vm_snapshot_release(VmSnapshot *snapshot);
+
+// Drop the VM's base snapshot, before the VM goes away (vm_release() also
+// drops its ROM banks)
+void vm_fork_release(BasicVm *vm);
+
+// Record writes for the next snapshot or restore
+static inline void vm_dirty_pages(BasicVm *vm, uint32_t first, uint32_t last)
+{
+#ifdef VM_FORK
+    for (uint32_t page = first; page <= last; page++) {
+        vm->dirty_pages[page / 64] |= 1ull << (page % 64);
+    }
+#else
+    (void)vm;
+    (void)first;
+    (void)last;
+#endif
+}
+
+static inline void vm_dirty_memory(BasicVm *vm, uint32_t address, uint32_t size)
+{
+    if (size > 0) {
+        vm_dirty_pages(vm, address / VM_PAGE_SIZE, (address + size - 1) / VM_PAGE_SIZE);
+    }
+}
+
+// Pixels of the display buffer
+static inline void vm_dirty_display(BasicVm *vm, uint32_t pixel, uint32_t count)
+{
+    if (count > 0) {
+        vm_dirty_pages(vm, VM_MEMORY_PAGES + pixel * 4 / VM_PAGE_SIZE,
+                       VM_MEMORY_PAGES + ((pixel + count) * 4 - 1) / VM_PAGE_SIZE);
+    }
+}
+
+#endif // VM_FORK_H
@@ -1,4 +1,3 @@
-#include "asm_main.h"
 #include "vm_main.h"
 #include "raylib.h"
 
@@ -18,8 +17,11 @@ int main(void)
     //--------------------------------------------------------------------------------------
 
 
-    asm_main();
-    vm_main(0, nullptr);
+    // Assemble roms/rom.asm in memory and run it (bash assembler.bash writes rom.bin)
+    char programName[] = "main";
+    char sourcePath[] = "roms/rom.asm";
+    char *vmArgs[] = {programName, sourcePath};
+    vm_main(2, vmArgs);
 /*
     // Main game loop
     while (!WindowShouldClose())    // Detect window close button or ESC key
@@ -34,4 +34,5 @@ SLLI r1, r2, 0xe
 SRLI r1, r2, 0xf
 CLS
 CHAR r1, r2, r3
+BANK r1, r2, 0x0
 HALT
\ No newline at end of file
@@ -0,0 +1,11 @@
+; ALU loop: 200 x 255 iterations of register arithmetic
+ADDI r5, r0, 0xC8
+ADDI r1, r0, 0xFF
+ADD r2, r2, r1
+XOR r3, r3, r2
+MUL r4, r2, r3
+SUBI r1, r1, 0x1
+BNE r1, r0, 0xFFEF
+SUBI r5, r5, 0x1
+BNE r5, r0, 0xFFE3
+HALT
@@ -0,0 +1,13 @@
+; Branch-heavy: two data-dependent branches per iteration, mixed taken/not-taken
+ADDI r5, r0, 0xC8
+ADDI r1, r0, 0xFF
+ANDI r2, r1, 0x1
+BEQ r2, r0, 0x4
+ADDI r3, r3, 0x1
+BLT r1, r6, 0x4
+ADDI r4, r4, 0x1
+SUBI r1, r1, 0x1
+BNE r1, r0, 0xFFE4
+SUBI r5, r5, 0x1
+BNE r5, r0, 0xFFD8
+HALT
@@ -0,0 +1,12 @@
+; Call-heavy: JAL into a short routine and JAL back on every iteration
+ADDI r5, r0, 0xC8
+ADDI r1, r0, 0xFF
+JAL r14, 0x11
+SUBI r1, r1, 0x1
+BNE r1, r0, 0xFFF4
+SUBI r5, r5, 0x1
+BNE r5, r0, 0xFFE8
+HALT
+ADD r2, r2, r1
+ADDI r3, r3, 0x1
+JAL r15, 0xFFFE4
@@ -0,0 +1,12 @@
+; CHAR-heavy screen: four glyph blits per iteration
+ADDI r5, r0, 0xC8
+ADDI r1, r0, 0x40
+CHAR r1, r2, r3
+CHAR r4, r5, r6
+CHAR r7, r8, r9
+CHAR r10, r11, r12
+SUBI r1, r1, 0x1
+BNE r1, r0, 0xFFEC
+SUBI r5, r5, 0x1
+BNE r5, r0, 0xFFE0
+HALT
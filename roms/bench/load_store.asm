@@ -0,0 +1,13 @@
+; Load/store stream: byte and halfword round trips through memory
+ADDI r5, r0, 0xC8
+ADDI r1, r0, 0xFF
+SB r1, r2, 0x100
+LB r3, r1, 0x100
+SH r1, r3, 0x200
+LH r4, r1, 0x200
+ADD r2, r2, r3
+SUBI r1, r1, 0x1
+BNE r1, r0, 0xFFE5
+SUBI r5, r5, 0x1
+BNE r5, r0, 0xFFD9
+HALT
@@ -1,64 +1,514 @@
 #include "config.h"
-#include "asm.h"
-#include <assert.h>
+#include "asm_main.h"
+#include "assembler.h"
+#include "asm_source.h"
+#include "asm_session.h"
+#include "linker.h"
+#include "object.h"
+#include "optimizer.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
-int asm_main()
+static double now_ms()
 {
-  FILE *asmFile = fopen("roms/rom.asm", "r");
-  FILE *romFile = fopen("roms/rom.bin", "wb");
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
 
-  if (asmFile == NULL)
+// Incremental rebuild of asmPath into romFd; returns true if the ROM was written
+static bool watch_rebuild(AsmSession *session, const char *asmPath, int romFd)
+{
+  AsmSource source;
+  if (!asm_source_open(asmPath, &source))
   {
     perror("Error opening .asm file");
+    return false;
+  }
+
+  double start = now_ms();
+  bool ok = asm_session_build(session, source.data, source.size);
+  if (ok && !asm_session_write(session, romFd))
+  {
+    perror("Error writing .rom file");
+    ok = false;
+  }
+  double elapsed = now_ms() - start;
+
+  log_flush();
+  if (ok)
+  {
+    fprintf(stderr, "Assembled %s: %zu lines re-encoded, %zu patched, %zu bytes in %.2f ms\n",
+            asmPath, session->encodedLines, session->patchedLines, session->result.image.size, elapsed);
+  }
+  else
+  {
+    asm_print_diagnostics(&session->result, stderr);
+  }
+  asm_source_close(&source);
+  return ok;
+}
+
+// Rebuild whenever the source is saved. The directory is watched rather
+// than the file, since editors often save by renaming a new file over it.
+static int watch_main(const char *asmPath, const char *romPath)
+{
+#ifdef __linux__
+  if (strcmp(asmPath, "-") == 0 || strcmp(romPath, "-") == 0)
+  {
+    fprintf(stderr, "Error: --watch needs a source file and a ROM file\n");
     return 1;
   }
 
-  if (romFile == NULL)
+  int romFd = open(romPath, O_WRONLY | O_CREAT, 0644);
+  if (romFd < 0)
   {
     perror("Error opening .rom file");
     return 1;
   }
 
-  char asmLineBuffer[256];
-  AssembledOperation result;
-  uint32_t program_counter = 0;
-  uint32_t line = 1;
-  while (fgets(asmLineBuffer, sizeof(asmLineBuffer), asmFile))
+  const char *slash = strrchr(asmPath, '/');
+  const char *fileName = slash ? slash + 1 : asmPath;
+  char directory[4096] = ".";
+  if (slash != NULL)
+  {
+    snprintf(directory, sizeof(directory), "%.*s", (int)(slash - asmPath), asmPath);
+  }
+
+  int notify = inotify_init1(IN_CLOEXEC);
+  if (notify < 0 || inotify_add_watch(notify, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
   {
-    printf("----------------\n%s\n", asmLineBuffer);
-    Instruction *instruction = get_instruction_by_asm(asmLineBuffer);
+    perror("Error watching source directory");
+    close(romFd);
+    return 1;
+  }
+
+  AsmSession session;
+  asm_session_init(&session, PROGRAM_ROM);
+  watch_rebuild(&session, asmPath, romFd);
 
-    switch (instruction->opcode_funct3)
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;)
+  {
+    ssize_t n = read(notify, events, sizeof(events));
+    if (n <= 0)
     {
-    case 0x00:
+      break;
+    }
+
+    bool changed = false;
+    for (char *p = events; p < events + n;)
     {
-      printf("NULL line detected on line %d\n", line);
-      continue;
+      struct inotify_event *event = (struct inotify_event *)p;
+      if (event->len > 0 && strcmp(event->name, fileName) == 0)
+      {
+        changed = true;
+      }
+      p += sizeof(struct inotify_event) + event->len;
     }
-    default:
+
+    if (changed)
     {
-      result = handle_opcode(instruction, asmLineBuffer);
+      watch_rebuild(&session, asmPath, romFd);
     }
-    };
+  }
 
-    assert(result.hasValue == true);
+  asm_session_free(&session);
+  close(notify);
+  close(romFd);
+  return 1;
+#else
+  (void)asmPath;
+  (void)romPath;
+  fprintf(stderr, "Error: --watch needs inotify (Linux only)\n");
+  return 1;
+#endif
+}
 
-    if (!result.hasValue)
+// How -x, -e, -z and -b lay out a ROM container
+typedef struct
+{
+  uint16_t entry;
+  bool compress;
+  RomImage banks[BANK_COUNT - 1]; // banks 1 and up, assembled at BANK_WINDOW
+  int bankCount;
+} ContainerOutput;
+
+// Assemble one -b source into the bank window
+static bool assemble_bank(const char *path, RomImage *bank)
+{
+  AsmSource source;
+  if (!asm_source_open(path, &source))
+  {
+    perror(path);
+    return false;
+  }
+
+  AsmResult result = {};
+  bool ok = assemble(source.data, source.size, BANK_WINDOW, &result);
+  if (!ok)
+  {
+    log_flush();
+    fprintf(stderr, "%s:\n", path);
+    asm_print_diagnostics(&result, stderr);
+  }
+  else if (result.image.size > BANK_SIZE)
+  {
+    fprintf(stderr, "Error: %s does not fit a bank (%zu bytes, max %d)\n", path, result.image.size,
+            BANK_SIZE);
+    ok = false;
+  }
+  else
+  {
+    *bank = result.image;
+    result.image = (RomImage){};
+  }
+  asm_result_free(&result);
+  asm_source_close(&source);
+  return ok;
+}
+
+// Write the ROM image, or the object if one is given, to path or stdout;
+// a non-NULL container writes the image and its banks as a ROM container
+static int write_output(const char *path, const RomImage *image, const ObjectFile *object,
+                        const ContainerOutput *container)
+{
+  bool toStdout = strcmp(path, "-") == 0;
+  int fd = toStdout ? STDOUT_FILENO : open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    perror("Error opening output file");
+    return 1;
+  }
+
+  int status = 0;
+  bool written;
+  if (object)
+  {
+    written = object_write(object, fd);
+  }
+  else if (container)
+  {
+    RomSectionImage sections[BANK_COUNT];
+    sections[0] = (RomSectionImage){image, PROGRAM_ROM, 0};
+    for (int i = 0; i < container->bankCount; i++)
     {
-      perror("Error assembling line: ");
-      perror(asmLineBuffer);
+      sections[i + 1] = (RomSectionImage){&container->banks[i], BANK_WINDOW, (uint8_t)(i + 1)};
+    }
+    written = rom_container_write(sections, container->bankCount + 1, container->entry,
+                                  container->compress, fd);
+  }
+  else
+  {
+    written = rom_image_write(image, fd);
+  }
+  if (!written)
+  {
+    perror("Error writing output file");
+    status = 1;
+  }
+  if (!toStdout)
+  {
+    close(fd);
+  }
+  return status;
+}
+
+static bool ends_with(const char *path, const char *suffix)
+{
+  size_t length = strlen(path);
+  size_t suffixLength = strlen(suffix);
+  return length > suffixLength && strcmp(path + length - suffixLength, suffix) == 0;
+}
+
+// Load one link input: objects are read as-is, .asm modules are assembled
+static bool load_object(const char *path, ObjectFile *object)
+{
+  AsmSource source;
+  if (!asm_source_open(path, &source))
+  {
+    perror(path);
+    return false;
+  }
+
+  bool ok;
+  if (ends_with(path, ".asm"))
+  {
+    AsmResult result = {};
+    ok = assemble_object(source.data, source.size, object, &result);
+    if (!ok)
+    {
+      log_flush();
+      fprintf(stderr, "%s:\n", path);
+      asm_print_diagnostics(&result, stderr);
+    }
+    asm_result_free(&result);
+  }
+  else
+  {
+    ok = object_read((const uint8_t *)source.data, source.size, object);
+    if (!ok)
+    {
+      fprintf(stderr, "Error: %s is not a valid object file\n", path);
+    }
+  }
+  asm_source_close(&source);
+  return ok;
+}
+
+// Link objects into a ROM, dropping sections nothing reaches
+static int link_main(const char *romPath, char **inputs, int count)
+{
+  if (count == 0)
+  {
+    fprintf(stderr, "Error: --link needs at least one input\n");
+    return 1;
+  }
+
+  ObjectFile *objects = (ObjectFile *)calloc(count, sizeof(ObjectFile));
+  if (objects == NULL)
+  {
+    return 1;
+  }
+  int status = 0;
+  for (int i = 0; i < count && status == 0; i++)
+  {
+    status = load_object(inputs[i], &objects[i]) ? 0 : 1;
+  }
+
+  AsmResult result = {};
+  LinkStats stats;
+  if (status == 0 && !link_objects(objects, inputs, count, PROGRAM_ROM, &result, &stats))
+  {
+    asm_print_diagnostics(&result, stderr);
+    status = 1;
+  }
+  if (status == 0)
+  {
+    fprintf(stderr, "Linked %zu sections (%zu bytes), dropped %zu unreferenced (%zu bytes)\n",
+            stats.keptSections, stats.keptBytes, stats.droppedSections, stats.droppedBytes);
+    status = write_output(romPath, &result.image, NULL, NULL);
+  }
+
+  asm_result_free(&result);
+  for (int i = 0; i < count; i++)
+  {
+    object_free(&objects[i]);
+  }
+  free(objects);
+  return status;
+}
+
+static void print_opt_stats(const AsmOptStats *stats)
+{
+  log_flush();
+  if (stats->skippedLine > 0)
+  {
+    fprintf(stderr, "Optimizer skipped: branch offset on line %u does not land on an instruction\n",
+            stats->skippedLine);
+    return;
+  }
+  fprintf(stderr, "Optimizer: no-ops %zu (%zu bytes), folded %zu (%zu bytes), "
+                  "threaded %zu (%zu bytes), shortened %zu (%zu bytes)\n",
+          stats->removed, stats->removedBytes, stats->folded, stats->foldedBytes, stats->threaded,
+          stats->threadedBytes, stats->shortened, stats->shortenedBytes);
+  if (stats->movedBlocks > 0 || stats->invertedBranches > 0)
+  {
+    fprintf(stderr, "Layout: moved %zu blocks, inverted %zu branches\n", stats->movedBlocks,
+            stats->invertedBranches);
+  }
+}
+
+// asm_main [--watch] [-O] [-p profile.txt] [-x] [-e entry] [-z] [-b bank.asm]...
+//          [input.asm|-] [output.bin|-]
+// asm_main -c [input.asm|-] [output.o|-]
+// asm_main --link output.bin input.o|input.asm...
+// "-" reads stdin / writes stdout, so the assembler works as a filter;
+// --watch keeps running and reassembles incrementally on every save;
+// -c emits a relocatable object for --link, which only keeps sections
+// reachable from the first input's first section; -O runs the peephole
+// optimizer (include/optimizer.h) on a flat build and reports bytes saved;
+// -p (implies -O) lays out basic blocks from a VM profile (PROFILE_PATH);
+// -x writes a ROM container (include/rom_container.h) instead of a bare
+// image; -e (implies -x) sets its entry point, PROGRAM_ROM by default;
+// -z (implies -x) LZ-compresses the sections (include/lz.h); each -b
+// (implies -x) assembles a source at BANK_WINDOW as the next bank, from 1
+int asm_main(int argc, char *argv[])
+{
+  if (argc > 2 && strcmp(argv[1], "--link") == 0)
+  {
+    if (strcmp(argv[2], "-") == 0)
+    {
+      log_set_output(stderr);
+    }
+    return link_main(argv[2], argv + 3, argc - 3);
+  }
+
+  const char *asmPath = "roms/rom.asm";
+  const char *romPath = "roms/rom.bin";
+  bool watch = false;
+  bool object = false;
+  bool optimize = false;
+  const char *profilePath = NULL;
+  bool container = false;
+  static ContainerOutput output;
+  output.entry = PROGRAM_ROM;
+  const char *bankPaths[BANK_COUNT - 1];
+  int positional = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--watch") == 0)
+    {
+      watch = true;
+    }
+    else if (strcmp(argv[i], "-O") == 0)
+    {
+      optimize = true;
+    }
+    else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+    {
+      optimize = true;
+      profilePath = argv[++i];
+    }
+    else if (strcmp(argv[i], "-x") == 0)
+    {
+      container = true;
+    }
+    else if (strcmp(argv[i], "-z") == 0)
+    {
+      container = true;
+      output.compress = true;
+    }
+    else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+    {
+      if (output.bankCount == BANK_COUNT - 1)
+      {
+        fprintf(stderr, "Error: at most %d banks\n", BANK_COUNT - 1);
+        return 1;
+      }
+      container = true;
+      bankPaths[output.bankCount++] = argv[++i];
+    }
+    else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc)
+    {
+      char *end;
+      unsigned long address = strtoul(argv[++i], &end, 0);
+      if (*end != '\0' || address < PROGRAM_ROM || address >= RAM_SIZE)
+      {
+        fprintf(stderr, "Error: entry point %s is not an address in program ROM\n", argv[i]);
+        return 1;
+      }
+      container = true;
+      output.entry = (uint16_t)address;
+    }
+    else if (strcmp(argv[i], "-c") == 0)
+    {
+      object = true;
+      romPath = "roms/rom.o";
+    }
+    else if (positional++ == 0)
+    {
+      asmPath = argv[i];
+    }
+    else
+    {
+      romPath = argv[i];
+    }
+  }
+
+  if (container && (watch || object))
+  {
+    fprintf(stderr, "Error: -x, -e, -z and -b only apply to a flat build\n");
+    return 1;
+  }
+  if (watch)
+  {
+    return watch_main(asmPath, romPath);
+  }
+
+  if (strcmp(romPath, "-") == 0)
+  {
+    log_set_output(stderr);
+  }
+
+  AsmSource source;
+  if (!asm_source_open(asmPath, &source))
+  {
+    perror("Error opening .asm file");
+    return 1;
+  }
+
+  AsmResult result = {};
+  ObjectFile objectFile = {};
+  int status = 0;
+  AsmOptStats stats;
+  bool ok;
+  if (object)
+  {
+    ok = assemble_object(source.data, source.size, &objectFile, &result);
+  }
+  else if (optimize)
+  {
+    AsmSource profileSource = {};
+    AsmProfile profile = {};
+    if (profilePath != NULL && !asm_source_open(profilePath, &profileSource))
+    {
+      perror("Error opening profile");
+      asm_source_close(&source);
       return 1;
     }
+    if (profilePath != NULL && !asm_profile_parse(profileSource.data, profileSource.size, &profile))
+    {
+      fprintf(stderr, "Invalid profile %s\n", profilePath);
+      asm_profile_free(&profile);
+      asm_source_close(&profileSource);
+      asm_source_close(&source);
+      return 1;
+    }
+    ok = assemble_optimized(source.data, source.size, PROGRAM_ROM, profilePath ? &profile : NULL,
+                            &result, &stats);
+    if (ok)
+    {
+      print_opt_stats(&stats);
+    }
+    asm_profile_free(&profile);
+    asm_source_close(&profileSource);
+  }
+  else
+  {
+    ok = assemble(source.data, source.size, PROGRAM_ROM, &result);
+  }
+  if (!ok)
+  {
+    log_flush();
+    asm_print_diagnostics(&result, stderr);
+    status = 1;
+  }
 
-    BytePack pack = pack_bytes(instruction, result.value);
-    write_to_file(romFile, pack);
+  for (int i = 0; i < output.bankCount && status == 0; i++)
+  {
+    status = assemble_bank(bankPaths[i], &output.banks[i]) ? 0 : 1;
+  }
 
-    line++;
-    program_counter += instruction->length / 8;
+  // The output is only replaced once the whole source assembled cleanly
+  if (status == 0)
+  {
+    status = write_output(romPath, &result.image, object ? &objectFile : NULL,
+                          container ? &output : NULL);
   }
 
-  fclose(asmFile);
-  fclose(romFile);
+  for (int i = 0; i < output.bankCount; i++)
+  {
+    rom_image_free(&output.banks[i]);
+  }
+  object_free(&objectFile);
+  asm_result_free(&result);
+  asm_source_close(&source);
 
-  return 0;
+  return status;
 }
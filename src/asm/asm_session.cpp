@@ -0,0 +1,286 @@
+#include "config.h"
+#include "asm_session.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// FNV-1a step for the symbol-table version
+static uint64_t version_mix(uint64_t hash, const void *data, size_t length) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+void asm_session_init(AsmSession *session, uint32_t origin) {
+  memset(session, 0, sizeof(*session));
+  session->origin = origin;
+}
+
+static AsmCacheEntry *cache_lookup(AsmSession *session, const char *text, size_t length) {
+  AsmCacheEntry *entry = NULL;
+  HASH_FIND(hh, session->cache, text, length, entry);
+  if (entry != NULL) {
+    return entry;
+  }
+
+  entry = (AsmCacheEntry *)calloc(1, sizeof(AsmCacheEntry));
+  char *copy = (char *)malloc(length + 1);
+  if (entry == NULL || copy == NULL) {
+    free(entry);
+    free(copy);
+    return NULL;
+  }
+  memcpy(copy, text, length);
+  copy[length] = '\0';
+  entry->text = copy;
+  entry->length = length;
+  assemble_line(copy, &entry->parsed);
+  HASH_ADD_KEYPTR(hh, session->cache, entry->text, entry->length, entry);
+  session->encodedLines++;
+  return entry;
+}
+
+static void mark_dirty(AsmSession *session, size_t start, size_t end) {
+  if (session->dirtyStart >= session->dirtyEnd) {
+    session->dirtyStart = start;
+    session->dirtyEnd = end;
+    return;
+  }
+  if (start < session->dirtyStart) session->dirtyStart = start;
+  if (end > session->dirtyEnd) session->dirtyEnd = end;
+}
+
+bool asm_session_build(AsmSession *session, const char *source, size_t length) {
+  AsmResult *result = &session->result;
+  result->diagnosticCount = 0;
+  result->ok = true;
+  session->generation++;
+  session->encodedLines = 0;
+  session->patchedLines = 0;
+  session->dirtyStart = session->dirtyEnd = 0;
+
+  uint64_t previousVersion = session->symbolVersion;
+  size_t previousCount = session->lineCount;
+  uint32_t pc = session->origin;
+  size_t count = 0;
+  size_t definitionLines = 0;
+  bool definitionsStable = session->lineCount > 0;
+  bool allReused = true;
+
+  // Pass 1: map every line to a cache entry and lay out addresses
+  const char *next = source;
+  const char *end = source + length;
+  while (next < end) {
+    const char *lineStart = next;
+    const char *lineEnd = (const char *)memchr(next, '\n', end - next);
+    if (lineEnd == NULL) {
+      lineEnd = end;
+    }
+    next = lineEnd + 1;
+    uint32_t line = (uint32_t)count + 1;
+
+    if (count == session->scratchCapacity) {
+      size_t capacity = session->scratchCapacity ? session->scratchCapacity * 2 : 1024;
+      AsmSessionLine *grown =
+          (AsmSessionLine *)realloc(session->scratch, capacity * sizeof(AsmSessionLine));
+      if (grown == NULL) {
+        asm_error(result, line, "Out of memory");
+        break;
+      }
+      session->scratch = grown;
+      session->scratchCapacity = capacity;
+    }
+
+    // Most lines are where they were last time, which is cheaper to check
+    // than hashing them
+    size_t lineLength = (size_t)(lineEnd - lineStart);
+    AsmCacheEntry *entry = NULL;
+    if (count < session->lineCount) {
+      AsmCacheEntry *previous = session->lines[count].entry;
+      if (previous->length == lineLength && memcmp(previous->text, lineStart, lineLength) == 0) {
+        entry = previous;
+      }
+    }
+    if (entry == NULL) {
+      entry = cache_lookup(session, lineStart, lineLength);
+      allReused = false;
+    }
+    if (entry == NULL) {
+      asm_error(result, line, "Out of memory");
+      break;
+    }
+    entry->generation = session->generation;
+    session->scratch[count].entry = entry;
+    session->scratch[count].address = pc;
+    count++;
+
+    const AsmLine *parsed = &entry->parsed;
+    if (parsed->labelCount > 0 || parsed->kind == ASM_LINE_EQU) {
+      definitionLines++;
+      definitionsStable = definitionsStable && count <= session->lineCount &&
+                          session->lines[count - 1].entry == entry &&
+                          session->lines[count - 1].address == pc;
+    }
+    if (parsed->hasError) {
+      asm_error(result, line, "%s", parsed->message);
+    }
+    if (parsed->kind == ASM_LINE_INSTRUCTION) {
+      pc += parsed->instruction->length / 8;
+    }
+  }
+
+  // Symbols only need redefining if a line carrying a label or .equ changed,
+  // moved, or went away
+  if (!definitionsStable || definitionLines != session->definitionLines) {
+    symbol_table_free(&session->symbols);
+    uint64_t version = 14695981039346656037ull;
+    for (size_t i = 0; i < count; i++) {
+      const AsmCacheEntry *entry = session->scratch[i].entry;
+      const AsmLine *parsed = &entry->parsed;
+      uint32_t address = session->scratch[i].address;
+      uint32_t line = (uint32_t)i + 1;
+
+      for (uint8_t l = 0; l < parsed->labelCount; l++) {
+        const char *name = entry->text + parsed->labelOffset[l];
+        if (!symbol_define(&session->symbols, name, parsed->labelLength[l], address, SYMBOL_LABEL, line)) {
+          asm_error(result, line, "Duplicate or invalid label '%.*s'", (int)parsed->labelLength[l], name);
+          continue;
+        }
+        version = version_mix(version, name, parsed->labelLength[l]);
+        version = version_mix(version, &address, sizeof(address));
+      }
+
+      if (parsed->kind == ASM_LINE_EQU) {
+        const char *name = entry->text + parsed->symbolOffset;
+        uint32_t value = 0;
+        if (!asm_equ_value(&session->symbols, entry->text + parsed->valueOffset, &value) ||
+            !symbol_define(&session->symbols, name, parsed->symbolLength, value, SYMBOL_CONSTANT, line)) {
+          asm_error(result, line, "Invalid .equ");
+          continue;
+        }
+        version = version_mix(version, name, parsed->symbolLength);
+        version = version_mix(version, &value, sizeof(value));
+      }
+    }
+    session->symbolVersion = version;
+  }
+  session->definitionLines = definitionLines;
+
+  size_t size = pc - session->origin;
+  RomImage *image = &result->image;
+  if (size > image->capacity) {
+    uint8_t *bytes = (uint8_t *)realloc(image->bytes, size);
+    if (bytes == NULL) {
+      asm_error(result, 0, "Out of memory");
+      size = 0;
+    } else {
+      image->bytes = bytes;
+      image->capacity = size;
+    }
+  }
+  image->size = size;
+  if (size != session->writtenSize) {
+    mark_dirty(session, size < session->writtenSize ? size : session->writtenSize, size);
+  }
+
+  // Pass 2: rewrite the bytes of lines whose encoding may have changed
+  bool symbolsMoved = session->symbolVersion != previousVersion;
+  for (size_t i = 0; i < count && size > 0; i++) {
+    const AsmSessionLine *current = &session->scratch[i];
+    const AsmLine *parsed = &current->entry->parsed;
+    if (parsed->kind != ASM_LINE_INSTRUCTION) {
+      continue;
+    }
+
+    bool same = i < session->lineCount &&
+                session->lines[i].entry == current->entry &&
+                session->lines[i].address == current->address &&
+                !(parsed->symbolLength > 0 && symbolsMoved);
+    if (same) {
+      continue;
+    }
+
+    uint32_t value = parsed->value;
+    uint32_t next_pc = current->address + parsed->instruction->length / 8;
+    if (parsed->symbolLength > 0) {
+      const char *name = current->entry->text + parsed->symbolOffset;
+      Symbol *symbol = symbol_find(&session->symbols, name, parsed->symbolLength);
+      if (symbol == NULL) {
+        asm_error(result, (uint32_t)i + 1, "Undefined symbol '%.*s'", (int)parsed->symbolLength, name);
+        continue;
+      }
+      value = asm_resolve_immediate(parsed->instruction, value, symbol, next_pc);
+    }
+
+    BytePack pack = pack_bytes(parsed->instruction, value);
+    size_t offset = current->address - session->origin;
+    memcpy(image->bytes + offset, pack.bytes, pack.count);
+    mark_dirty(session, offset, offset + pack.count);
+    session->patchedLines++;
+  }
+
+  // This build becomes the baseline; after a failure the next build starts
+  // over, since some lines were skipped and their bytes are stale
+  AsmSessionLine *previous = session->lines;
+  size_t previousCapacity = session->lineCapacity;
+  session->lines = session->scratch;
+  session->lineCapacity = session->scratchCapacity;
+  session->lineCount = result->ok ? count : 0;
+  session->scratch = previous;
+  session->scratchCapacity = previousCapacity;
+  if (!result->ok) {
+    session->symbolVersion = 0;
+  }
+
+  // Drop cache entries no line uses any more (none if every line matched
+  // the previous build in place)
+  if (!allReused || count != previousCount) {
+    AsmCacheEntry *entry, *tmp;
+    HASH_ITER(hh, session->cache, entry, tmp) {
+      if (entry->generation != session->generation) {
+        HASH_DEL(session->cache, entry);
+        free(entry->text);
+        free(entry);
+      }
+    }
+  }
+
+  return result->ok;
+}
+
+bool asm_session_write(AsmSession *session, int fd) {
+  const RomImage *image = &session->result.image;
+  if (image->size != session->writtenSize && ftruncate(fd, (off_t)image->size) != 0) {
+    return false;
+  }
+
+  size_t start = session->dirtyStart;
+  size_t end = session->dirtyEnd < image->size ? session->dirtyEnd : image->size;
+  while (start < end) {
+    ssize_t n = pwrite(fd, image->bytes + start, end - start, (off_t)start);
+    if (n <= 0) {
+      return false;
+    }
+    start += (size_t)n;
+  }
+
+  session->writtenSize = image->size;
+  session->dirtyStart = session->dirtyEnd = 0;
+  return true;
+}
+
+void asm_session_free(AsmSession *session) {
+  AsmCacheEntry *entry, *tmp;
+  HASH_ITER(hh, session->cache, entry, tmp) {
+    HASH_DEL(session->cache, entry);
+    free(entry->text);
+    free(entry);
+  }
+  free(session->lines);
+  free(session->scratch);
+  symbol_table_free(&session->symbols);
+  asm_result_free(&session->result);
+  memset(session, 0, sizeof(*session));
+}
@@ -0,0 +1,92 @@
+#include "asm_source.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read everything from fd into a heap buffer with a trailing NUL
+static bool read_all(int fd, AsmSource *source) {
+  size_t capacity = 1 << 16, size = 0;
+  char *data = (char *)malloc(capacity);
+
+  if (data == NULL) {
+    return false;
+  }
+
+  for (;;) {
+    if (capacity - size < 2) {
+      char *grown = (char *)realloc(data, capacity * 2);
+      if (grown == NULL) {
+        free(data);
+        return false;
+      }
+      data = grown;
+      capacity *= 2;
+    }
+
+    ssize_t n = read(fd, data + size, capacity - size - 1);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      free(data);
+      return false;
+    }
+    if (n == 0) {
+      break;
+    }
+    size += (size_t)n;
+  }
+
+  data[size] = '\0';
+  source->data = data;
+  source->size = size;
+  source->mapped = 0;
+  return true;
+}
+
+bool asm_source_open(const char *path, AsmSource *source) {
+  bool use_stdin = strcmp(path, "-") == 0;
+  int fd = use_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  bool ok;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+      (size_t)st.st_size % page != 0) {
+    // The rest of the last page reads as zeros, which terminates the text
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ok = map != MAP_FAILED;
+    if (ok) {
+      madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+      source->data = (const char *)map;
+      source->size = (size_t)st.st_size;
+      source->mapped = (size_t)st.st_size;
+    }
+  } else {
+    ok = read_all(fd, source);
+  }
+
+  if (!use_stdin) {
+    close(fd);
+  }
+  return ok;
+}
+
+void asm_source_close(AsmSource *source) {
+  if (source->mapped) {
+    munmap((void *)source->data, source->mapped);
+  } else {
+    free((void *)source->data);
+  }
+  source->data = NULL;
+  source->size = 0;
+  source->mapped = 0;
+}
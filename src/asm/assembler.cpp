@@ -0,0 +1,628 @@
+#include "config.h"
+#include "assembler.h"
+#include "asm.h"
+#include "encode.h"
+#include "symbols.h"
+#include "vm_fork.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+// Sources smaller than this are assembled on the calling thread
+#define ASM_PARALLEL_MIN_BYTES (256 * 1024)
+#define ASM_MAX_THREADS 16
+// Chunks per thread, so uneven chunks still balance across the pool
+#define ASM_CHUNKS_PER_THREAD 4
+
+// An immediate operand naming a symbol; patched once every symbol is known
+typedef struct {
+  size_t offset; // of the encoded instruction in the (chunk) image
+  Instruction *instruction;
+  const char *name; // span in the source, which outlives the fixups
+  uint16_t length;
+  uint32_t line;
+} Fixup;
+
+// A label or .equ, replayed in source order by the merge pass
+typedef struct {
+  const char *name;
+  uint16_t length;
+  uint8_t kind;         // SymbolKind
+  uint32_t offset;      // labels: offset of the next instruction in the chunk image
+  const char *valueStr; // .equ: the value text
+  uint32_t line;
+} Definition;
+
+// Lines [start, end) encoded independently of every other chunk
+typedef struct {
+  const char *start;
+  const char *end;
+  AsmResult result; // chunk image and diagnostics, lines relative to the chunk
+  Definition *definitions;
+  size_t definitionCount, definitionCapacity;
+  Fixup *fixups;
+  size_t fixupCount, fixupCapacity;
+  uint32_t lines;
+  char *tail; // NUL-terminated copy of an unterminated last line
+} AsmChunk;
+
+typedef struct {
+  AsmChunk *chunks;
+  size_t count;
+  size_t next; // next chunk to claim
+} AsmWork;
+
+static const char *skip_spaces(const char *cursor) {
+  while (*cursor == ' ' || *cursor == '\t') {
+    cursor++;
+  }
+  return cursor;
+}
+
+static size_t symbol_length(const char *cursor) {
+  if (!is_symbol_start(*cursor)) {
+    return 0;
+  }
+  size_t length = 1;
+  while (is_symbol_char(cursor[length])) {
+    length++;
+  }
+  return length;
+}
+
+static uint32_t symbol_immediate(const Instruction *instruction, const Symbol *symbol,
+                                 uint32_t next_pc) {
+  if (symbol->kind == SYMBOL_LABEL && encode_is_pc_relative(instruction)) {
+    return symbol->value - next_pc;
+  }
+  return symbol->value;
+}
+
+// Patch the immediate of an instruction already packed into the image
+static void patch_image(RomImage *image, const Fixup *fixup, uint32_t imm) {
+  uint8_t *bytes = image->bytes + fixup->offset;
+  uint8_t count = fixup->instruction->length / 8;
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    value |= (uint32_t)bytes[i] << (i * 8);
+  }
+
+  uint32_t patched = encode_patch_immediate(fixup->instruction, value, imm);
+  BytePack pack = pack_bytes(fixup->instruction, patched);
+  memcpy(bytes, pack.bytes, pack.count);
+}
+
+uint32_t asm_resolve_immediate(const Instruction *instruction, uint32_t value,
+                               const Symbol *symbol, uint32_t next_pc) {
+  return encode_patch_immediate(instruction, value, symbol_immediate(instruction, symbol, next_pc));
+}
+
+bool asm_equ_value(const SymbolTable *symbols, const char *cursor, uint32_t *value) {
+  size_t length = symbol_length(cursor);
+  if (length > 0) {
+    Symbol *symbol = symbol_find(symbols, cursor, length);
+    if (symbol == NULL) {
+      return false;
+    }
+    *value = symbol->value;
+    return true;
+  }
+
+  char *end = NULL;
+  *value = (uint32_t)strtol(cursor, &end, 0);
+  return end != cursor;
+}
+
+void asm_error(AsmResult *result, uint32_t line, const char *fmt, ...) {
+  result->ok = false;
+  if (result->diagnosticCount == result->diagnosticCapacity) {
+    size_t capacity = result->diagnosticCapacity ? result->diagnosticCapacity * 2 : 16;
+    AsmDiagnostic *diagnostics =
+        (AsmDiagnostic *)realloc(result->diagnostics, capacity * sizeof(AsmDiagnostic));
+    if (diagnostics == NULL) {
+      return;
+    }
+    result->diagnostics = diagnostics;
+    result->diagnosticCapacity = capacity;
+  }
+
+  AsmDiagnostic *diagnostic = &result->diagnostics[result->diagnosticCount++];
+  diagnostic->line = line;
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(diagnostic->message, sizeof(diagnostic->message), fmt, args);
+  va_end(args);
+}
+
+bool asm_grow(void **items, size_t *capacity, size_t count, size_t size, size_t initial) {
+  if (count < *capacity) {
+    return true;
+  }
+  size_t grown = *capacity ? *capacity * 2 : initial;
+  void *resized = realloc(*items, grown * size);
+  if (resized == NULL) {
+    return false;
+  }
+  *items = resized;
+  *capacity = grown;
+  return true;
+}
+
+static void add_definition(AsmChunk *chunk, const char *name, size_t length, SymbolKind kind,
+                           const char *valueStr, uint32_t line) {
+  if (!asm_grow((void **)&chunk->definitions, &chunk->definitionCapacity, chunk->definitionCount,
+                sizeof(Definition), 64)) {
+    asm_error(&chunk->result, line, "Out of memory");
+    return;
+  }
+  Definition *definition = &chunk->definitions[chunk->definitionCount++];
+  definition->name = name;
+  definition->length = (uint16_t)(length < 0xFFFF ? length : 0xFFFF);
+  definition->kind = kind;
+  definition->offset = (uint32_t)chunk->result.image.size;
+  definition->valueStr = valueStr;
+  definition->line = line;
+}
+
+static void line_error(AsmLine *parsed, const char *fmt, ...) {
+  parsed->hasError = true;
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(parsed->message, sizeof(parsed->message), fmt, args);
+  va_end(args);
+}
+
+void assemble_line(const char *lineStart, AsmLine *parsed)
+{
+  parsed->kind = ASM_LINE_EMPTY;
+  parsed->labelCount = 0;
+  parsed->instruction = NULL;
+  parsed->value = 0;
+  parsed->symbolOffset = 0;
+  parsed->symbolLength = 0;
+  parsed->valueOffset = 0;
+  parsed->hasError = false;
+
+  const char *cursor = skip_spaces(lineStart);
+
+  // Labels: "name:" (several may share a line)
+  size_t nameLength = symbol_length(cursor);
+  while (nameLength > 0 && cursor[nameLength] == ':')
+  {
+    if (parsed->labelCount == ASM_MAX_LINE_LABELS)
+    {
+      line_error(parsed, "Too many labels");
+    }
+    else
+    {
+      parsed->labelOffset[parsed->labelCount] = (uint32_t)(cursor - lineStart);
+      parsed->labelLength[parsed->labelCount] = (uint16_t)(nameLength < 0xFFFF ? nameLength : 0xFFFF);
+      parsed->labelCount++;
+    }
+    cursor = skip_spaces(cursor + nameLength + 1);
+    nameLength = symbol_length(cursor);
+  }
+
+  if (*cursor == '\0' || *cursor == '\n' || *cursor == '\r' || *cursor == ';')
+  {
+    return;
+  }
+
+  // Sections: ".section name" starts a unit the linker can drop; flat
+  // assembly lays sections out in source order and ignores the directive
+  if (strncasecmp(cursor, ".section", 8) == 0 && (cursor[8] == ' ' || cursor[8] == '\t'))
+  {
+    const char *name = skip_spaces(cursor + 8);
+    nameLength = symbol_length(name);
+    if (nameLength == 0 || nameLength >= SYMBOL_NAME_MAX)
+    {
+      line_error(parsed, "Invalid .section");
+      return;
+    }
+    parsed->kind = ASM_LINE_SECTION;
+    parsed->symbolOffset = (uint32_t)(name - lineStart);
+    parsed->symbolLength = (uint16_t)nameLength;
+    return;
+  }
+
+  // Constants: ".equ NAME, value"
+  if (strncasecmp(cursor, ".equ", 4) == 0 && (cursor[4] == ' ' || cursor[4] == '\t'))
+  {
+    const char *name = skip_spaces(cursor + 4);
+    nameLength = symbol_length(name);
+    const char *valueStr = skip_spaces(name + nameLength);
+    if (*valueStr == ',')
+    {
+      valueStr = skip_spaces(valueStr + 1);
+    }
+
+    if (nameLength == 0)
+    {
+      line_error(parsed, "Invalid .equ");
+      return;
+    }
+    parsed->kind = ASM_LINE_EQU;
+    parsed->symbolOffset = (uint32_t)(name - lineStart);
+    parsed->symbolLength = (uint16_t)(nameLength < 0xFFFF ? nameLength : 0xFFFF);
+    parsed->valueOffset = (uint32_t)(valueStr - lineStart);
+    return;
+  }
+
+  TokenizedLine tokens;
+  if (!tokenize_line(cursor, &tokens))
+  {
+    line_error(parsed, "Invalid operand '%.*s'",
+               (int)strcspn(tokens.error, " \t,;\r\n"), tokens.error);
+    return;
+  }
+
+  if (tokens.mnemonic.length == 0)
+  {
+    return;
+  }
+  Instruction *instruction = get_instruction_by_name(tokens.mnemonic.start, tokens.mnemonic.length);
+  if (instruction->opcode_funct3 == 0x00)
+  {
+    line_error(parsed, "Unknown mnemonic '%.*s'", (int)tokens.mnemonic.length, tokens.mnemonic.start);
+    return;
+  }
+
+  // Symbolic operands encode as 0 and are patched once symbols are known
+  for (uint8_t i = 0; i < tokens.count; i++)
+  {
+    Token *operand = &tokens.operands[i];
+    if (operand->kind != TOKEN_SYMBOL)
+    {
+      continue;
+    }
+
+    if (operand->length < SYMBOL_NAME_MAX)
+    {
+      parsed->symbolOffset = (uint32_t)(operand->start - lineStart);
+      parsed->symbolLength = operand->length;
+    }
+    else
+    {
+      line_error(parsed, "Symbol too long");
+    }
+    operand->kind = TOKEN_IMMEDIATE;
+  }
+
+  AssembledOperation operation = handle_opcode(instruction, &tokens);
+  if (!operation.hasValue)
+  {
+    line_error(parsed, "Cannot encode '%.*s'", (int)strcspn(lineStart, "\r\n"), lineStart);
+    parsed->symbolLength = 0;
+    return;
+  }
+
+  parsed->kind = ASM_LINE_INSTRUCTION;
+  parsed->instruction = instruction;
+  parsed->value = operation.value;
+}
+
+// Pass 1 for one chunk: encode every instruction with symbolic immediates
+// left as 0, and record definitions and fixups for the merge pass
+static void assemble_chunk(AsmChunk *chunk)
+{
+  AsmResult *result = &chunk->result;
+  result->ok = true;
+
+  AsmLine parsed;
+  uint32_t line = 0;
+  const char *next = chunk->start;
+
+  while (next < chunk->end)
+  {
+    const char *lineStart = next;
+    const char *lineEnd = (const char *)memchr(next, '\n', chunk->end - next);
+    if (lineEnd == NULL)
+    {
+      // The scanners stop at '\n' or NUL, so give the last line a terminator
+      lineEnd = chunk->end;
+      chunk->tail = (char *)malloc(lineEnd - lineStart + 1);
+      if (chunk->tail == NULL)
+      {
+        asm_error(result, line + 1, "Out of memory");
+        break;
+      }
+      memcpy(chunk->tail, lineStart, lineEnd - lineStart);
+      chunk->tail[lineEnd - lineStart] = '\0';
+      lineEnd = chunk->tail + (lineEnd - lineStart);
+      lineStart = chunk->tail;
+    }
+    next += lineEnd - lineStart + 1;
+
+    line++;
+    log_write(LOG_DEBUG, "----------------\n%s", log_text(lineStart, lineEnd - lineStart));
+
+    assemble_line(lineStart, &parsed);
+
+    for (uint8_t i = 0; i < parsed.labelCount; i++)
+    {
+      add_definition(chunk, lineStart + parsed.labelOffset[i], parsed.labelLength[i],
+                     SYMBOL_LABEL, NULL, line);
+    }
+    if (parsed.hasError)
+    {
+      asm_error(result, line, "%s", parsed.message);
+    }
+
+    if (parsed.kind == ASM_LINE_EQU)
+    {
+      add_definition(chunk, lineStart + parsed.symbolOffset, parsed.symbolLength,
+                     SYMBOL_CONSTANT, lineStart + parsed.valueOffset, line);
+      continue;
+    }
+    if (parsed.kind != ASM_LINE_INSTRUCTION)
+    {
+      continue;
+    }
+
+    size_t offset = result->image.size;
+    if (!rom_image_append(&result->image, pack_bytes(parsed.instruction, parsed.value)))
+    {
+      asm_error(result, line, "Out of memory");
+      break;
+    }
+
+    if (parsed.symbolLength > 0)
+    {
+      if (!asm_grow((void **)&chunk->fixups, &chunk->fixupCapacity, chunk->fixupCount,
+                    sizeof(Fixup), 64))
+      {
+        asm_error(result, line, "Out of memory");
+        break;
+      }
+      Fixup *fixup = &chunk->fixups[chunk->fixupCount++];
+      fixup->offset = offset;
+      fixup->instruction = parsed.instruction;
+      fixup->name = lineStart + parsed.symbolOffset;
+      fixup->length = parsed.symbolLength;
+      fixup->line = line;
+    }
+  }
+
+  chunk->lines = line;
+}
+
+static void *assemble_worker(void *arg)
+{
+  AsmWork *work = (AsmWork *)arg;
+  for (;;)
+  {
+    size_t index = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED);
+    if (index >= work->count)
+    {
+      break;
+    }
+    assemble_chunk(&work->chunks[index]);
+  }
+  return NULL;
+}
+
+// Split at line boundaries into roughly equal chunks; returns the count
+static size_t split_chunks(const char *source, size_t length, AsmChunk *chunks, size_t wanted)
+{
+  const char *end = source + length;
+  const char *cursor = source;
+  size_t count = 0;
+  while (cursor < end && count < wanted)
+  {
+    const char *chunkEnd = end;
+    if (count + 1 < wanted)
+    {
+      size_t target = (size_t)(end - cursor) / (wanted - count);
+      const char *newline = (const char *)memchr(cursor + target, '\n', end - (cursor + target));
+      chunkEnd = newline ? newline + 1 : end;
+    }
+    memset(&chunks[count], 0, sizeof(AsmChunk));
+    chunks[count].start = cursor;
+    chunks[count].end = chunkEnd;
+    count++;
+    cursor = chunkEnd;
+  }
+  return count;
+}
+
+// Merge pass: concatenate chunk images, define symbols in source order at
+// their final addresses, then patch every fixup
+static void merge_chunks(AsmChunk *chunks, size_t count, uint32_t origin, AsmResult *result)
+{
+  SymbolTable symbols = {NULL};
+  size_t total = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    total += chunks[i].result.image.size;
+  }
+  if (total > result->image.capacity)
+  {
+    uint8_t *bytes = (uint8_t *)realloc(result->image.bytes, total);
+    if (bytes == NULL)
+    {
+      asm_error(result, 0, "Out of memory");
+      return;
+    }
+    result->image.bytes = bytes;
+    result->image.capacity = total;
+  }
+
+  uint32_t lineBase = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    AsmChunk *chunk = &chunks[i];
+    size_t base = result->image.size;
+
+    for (size_t d = 0; d < chunk->result.diagnosticCount; d++)
+    {
+      const AsmDiagnostic *diagnostic = &chunk->result.diagnostics[d];
+      asm_error(result, diagnostic->line + lineBase, "%s", diagnostic->message);
+    }
+
+    for (size_t d = 0; d < chunk->definitionCount; d++)
+    {
+      const Definition *definition = &chunk->definitions[d];
+      uint32_t line = definition->line + lineBase;
+      if (definition->kind == SYMBOL_LABEL)
+      {
+        if (!symbol_define(&symbols, definition->name, definition->length,
+                           origin + (uint32_t)base + definition->offset, SYMBOL_LABEL, line))
+        {
+          asm_error(result, line, "Duplicate or invalid label '%.*s'",
+                    (int)definition->length, definition->name);
+        }
+        continue;
+      }
+
+      uint32_t value = 0;
+      if (!asm_equ_value(&symbols, definition->valueStr, &value) ||
+          !symbol_define(&symbols, definition->name, definition->length, value,
+                         SYMBOL_CONSTANT, line))
+      {
+        asm_error(result, line, "Invalid .equ");
+      }
+    }
+
+    memcpy(result->image.bytes + base, chunk->result.image.bytes, chunk->result.image.size);
+    result->image.size += chunk->result.image.size;
+
+    for (size_t f = 0; f < chunk->fixupCount; f++)
+    {
+      chunk->fixups[f].offset += base;
+      chunk->fixups[f].line += lineBase;
+    }
+    lineBase += chunk->lines;
+  }
+
+  for (size_t i = 0; i < count && result->ok; i++)
+  {
+    for (size_t f = 0; f < chunks[i].fixupCount && result->ok; f++)
+    {
+      Fixup *fixup = &chunks[i].fixups[f];
+      Symbol *symbol = symbol_find(&symbols, fixup->name, fixup->length);
+      if (symbol == NULL)
+      {
+        asm_error(result, fixup->line, "Undefined symbol '%.*s'", (int)fixup->length, fixup->name);
+        break;
+      }
+
+      uint32_t next_pc = origin + (uint32_t)fixup->offset + fixup->instruction->length / 8;
+      patch_image(&result->image, fixup, symbol_immediate(fixup->instruction, symbol, next_pc));
+    }
+  }
+
+  symbol_table_free(&symbols);
+}
+
+bool assemble_threaded(const char *source, size_t length, uint32_t origin, int threads,
+                       AsmResult *result)
+{
+  result->image.size = 0;
+  result->diagnosticCount = 0;
+  result->ok = true;
+
+  if (threads <= 0)
+  {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = length < ASM_PARALLEL_MIN_BYTES || cpus < 1 ? 1 : (int)cpus;
+  }
+  if (threads > ASM_MAX_THREADS)
+  {
+    threads = ASM_MAX_THREADS;
+  }
+
+  AsmChunk single;
+  AsmChunk *chunks = &single;
+  size_t wanted = threads > 1 ? (size_t)threads * ASM_CHUNKS_PER_THREAD : 1;
+  if (wanted > 1)
+  {
+    chunks = (AsmChunk *)malloc(wanted * sizeof(AsmChunk));
+    if (chunks == NULL)
+    {
+      chunks = &single;
+      wanted = 1;
+      threads = 1;
+    }
+  }
+  size_t count = split_chunks(source, length, chunks, wanted);
+
+  AsmWork work = {chunks, count, 0};
+  pthread_t workers[ASM_MAX_THREADS];
+  int started = 0;
+  for (int i = 1; i < threads && (size_t)i < count; i++)
+  {
+    if (pthread_create(&workers[started], NULL, assemble_worker, &work) == 0)
+    {
+      started++;
+    }
+  }
+  assemble_worker(&work); // the calling thread is part of the pool
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(workers[i], NULL);
+  }
+
+  merge_chunks(chunks, count, origin, result);
+
+  for (size_t i = 0; i < count; i++)
+  {
+    asm_result_free(&chunks[i].result);
+    free(chunks[i].definitions);
+    free(chunks[i].fixups);
+    free(chunks[i].tail);
+  }
+  if (chunks != &single)
+  {
+    free(chunks);
+  }
+
+  return result->ok;
+}
+
+bool assemble(const char *source, size_t length, uint32_t origin, AsmResult *result)
+{
+  return assemble_threaded(source, length, origin, 0, result);
+}
+
+bool assemble_into_vm(BasicVm *vm, const char *source, size_t length, AsmResult *result)
+{
+  if (!assemble(source, length, PROGRAM_ROM, result))
+  {
+    return false;
+  }
+  if (result->image.size > PROGRAM_SIZE)
+  {
+    asm_error(result, 0, "Program too large (%zu bytes, max %d)", result->image.size, PROGRAM_SIZE);
+    return false;
+  }
+
+  memcpy(vm->memory + PROGRAM_ROM, result->image.bytes, result->image.size);
+  vm_dirty_memory(vm, PROGRAM_ROM, (uint32_t)result->image.size);
+  vm->rom_size = (uint32_t)result->image.size;
+  return true;
+}
+
+void asm_result_free(AsmResult *result)
+{
+  rom_image_free(&result->image);
+  free(result->diagnostics);
+  result->diagnostics = NULL;
+  result->diagnosticCount = 0;
+  result->diagnosticCapacity = 0;
+}
+
+void asm_print_diagnostics(const AsmResult *result, FILE *out)
+{
+  for (size_t i = 0; i < result->diagnosticCount; i++)
+  {
+    const AsmDiagnostic *diagnostic = &result->diagnostics[i];
+    if (diagnostic->line > 0)
+    {
+      fprintf(out, "Error: %s on line %u\n", diagnostic->message, diagnostic->line);
+    }
+    else
+    {
+      fprintf(out, "Error: %s\n", diagnostic->message);
+    }
+  }
+}
@@ -1,87 +1,32 @@
 #include "instructions.h"
+#include "mnemonic_hash.h"
+#include <string.h>
 
 // Instruction data
-Instruction instructions[] = {
-    {"NULL", 0x0, 0x0, 0x0, 0x0, 0x0},
+Instruction instructions[] = {INSTRUCTION_LIST(INSTRUCTION_ROW)};
 
-    // Arithmetic
-    {"ADD", 0x01, 0x00, 0x08, 0x00, 24},
-    {"SUB", 0x01, 0x00, 0x08, 0x01, 24},
-    {"MUL", 0x01, 0x00, 0x08, 0x02, 24},
-    {"DIV", 0x01, 0x00, 0x08, 0x03, 24},
-
-    // Immediates
-    {"ADDI", 0x02, 0x00, 0x10, 0, 32},
-    {"SUBI", 0x02, 0x01, 0x11, 0, 32},
-    {"MULI", 0x02, 0x02, 0x12, 0, 32},
-    {"DIVI", 0x02, 0x03, 0x13, 0, 32},
-
-    // Upper Immediates
-    {"LUI", 0x03, 0x00, 0x18, 0x00, 32},
-    {"AUIPC", 0x03, 0x00, 0x18, 0x01, 32},
-
-    // Stores
-    {"SB", 0x04, 0x00, 0x20, 0, 32},
-    {"SH", 0x04, 0x01, 0x21, 0, 32},
-    {"SW", 0x04, 0x02, 0x22, 0, 32},
-
-    // Branches
-    {"BEQ", 0x05, 0x00, 0x28, 0, 32},
-    {"BNE", 0x05, 0x01, 0x29, 0, 32},
-    {"BLT", 0x05, 0x02, 0x2A, 0, 32},
-    {"BGT", 0x05, 0x03, 0x2B, 0, 32},
-    {"BLE", 0x05, 0x04, 0x2C, 0, 32},
-    {"BGE", 0x05, 0x05, 0x2D, 0, 32},
-
-    // Jump + Link
-    {"JAL", 0x06, 0x01, 0x31, 0, 32},
-    {"JALR", 0x06, 0x02, 0x32, 0, 32},
-
-    // loads
-    {"LW", 0x07, 0x00, 0x38, 0, 32},
-    {"LH", 0x07, 0x01, 0x39, 0, 32},
-    {"LB", 0x07, 0x02, 0x3A, 0, 32},
-
-    // Bitwise Operations
-    {"AND", 0x08, 0x0, 0x40, 0x0, 24},
-    {"OR", 0x08, 0x0, 0x40, 0x1, 24},
-    {"XOR", 0x08, 0x0, 0x40, 0x2, 24},
-
-    // Bitwise Immediates Operations
-    {"ANDI", 0x09, 0x0, 0x49, 0, 32},
-    {"ORI", 0x09, 0x1, 0x4A, 0, 32},
-    {"XORI", 0x09, 0x2, 0x4B, 0, 32},
-
-    // Shifts
-    {"SLL", 0xA, 0x0, 0x50, 0, 24},
-    {"SRL", 0xA, 0x0, 0x50, 0x1, 24},
-
-    // Immediate Shifts
-    {"SLLI", 0xA, 0x1, 0x51, 0x0, 32},
-    {"SRLI", 0xA, 0x1, 0x51, 0x1, 32},
+Instruction *get_instruction_by_alias(char *instructionStr) {
+  int index = mnemonic_lookup(instructionStr, strlen(instructionStr));
+  return index >= 0 ? &instructions[index] : &instructions[0];
+}
 
-    // Display
-    {"CHAR", 0x0B, 0x0, 0x58, 0x0, 24},
+Instruction *get_instruction_by_name(const char *name, size_t length) {
+  int index = mnemonic_lookup(name, length);
+  return index >= 0 ? &instructions[index] : &instructions[0];
+}
 
-    // Byte Instructions
-    {"HALT", 0x1F, 0x7, 0xFF, 0, 8},
-    {"CLS", 0x1F, 0x7, 0x5F, 0x0, 8},
-};
+Instruction *get_instruction_by_asm(const char *asmLine) {
+  while (*asmLine == ' ' || *asmLine == '\t') {
+    asmLine++;
+  }
 
-Instruction *get_instruction_by_alias(char *instructionStr) {
-  size_t count = sizeof(instructions) / sizeof(instructions[0]);
-  for (size_t i = 0; i < count; i++) {
-    if (strcasecmp(instructionStr, instructions[i].name) == 0) {
-      return &instructions[i];
-    }
+  size_t length = 0;
+  while (asmLine[length] != '\0' && asmLine[length] != ' ' && asmLine[length] != '\t' &&
+         asmLine[length] != '\n' && asmLine[length] != '\r') {
+    length++;
   }
-  return &instructions[0];
-}
 
-Instruction *get_instruction_by_asm(const char *asmLine) {
-  char instructionStr[10];
-  sscanf(asmLine, " %s", instructionStr);
-  return get_instruction_by_alias(instructionStr);
+  return get_instruction_by_name(asmLine, length);
 }
 
 Instruction *get_instruction_by_opcode_funct3(uint8_t opcode, uint8_t funct3) {
@@ -0,0 +1,245 @@
+#include "config.h"
+#include "linker.h"
+#include "uthash.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LINK_DROPPED 0xFFFFFFFFu
+
+// The first definition of every name across all objects
+typedef struct {
+  char name[SYMBOL_NAME_MAX];
+  size_t object;
+  size_t symbol;
+  UT_hash_handle hh;
+} LinkSymbol;
+
+typedef struct {
+  const ObjectFile *objects;
+  const char *const *names;
+  size_t count;
+  LinkSymbol *globals;
+  size_t *firstSection;   // flat section index of each object's first section
+  uint32_t *address;      // per flat section, LINK_DROPPED until kept
+  size_t *worklist;
+  size_t worklistCount;
+  AsmResult *result;
+} Linker;
+
+static bool define_globals(Linker *linker) {
+  for (size_t o = 0; o < linker->count; o++) {
+    const ObjectFile *object = &linker->objects[o];
+    for (size_t s = 0; s < object->symbolCount; s++) {
+      const ObjectSymbol *symbol = &object->symbols[s];
+      if (symbol->section == OBJECT_UNDEFINED) {
+        continue;
+      }
+
+      LinkSymbol *known = NULL;
+      HASH_FIND_STR(linker->globals, symbol->name, known);
+      if (known != NULL) {
+        const ObjectSymbol *first = &linker->objects[known->object].symbols[known->symbol];
+        if (symbol->section != OBJECT_ABSOLUTE || first->section != OBJECT_ABSOLUTE ||
+            symbol->value != first->value) {
+          asm_error(linker->result, 0, "Duplicate symbol '%s' in %s (first in %s)", symbol->name,
+                    linker->names[o], linker->names[known->object]);
+        }
+        continue;
+      }
+
+      LinkSymbol *entry = (LinkSymbol *)malloc(sizeof(LinkSymbol));
+      if (entry == NULL) {
+        asm_error(linker->result, 0, "Out of memory");
+        return false;
+      }
+      memcpy(entry->name, symbol->name, sizeof(entry->name));
+      entry->object = o;
+      entry->symbol = s;
+      HASH_ADD_STR(linker->globals, name, entry);
+    }
+  }
+  return linker->result->ok;
+}
+
+// Find the definition a relocation in object o refers to
+static bool resolve(const Linker *linker, size_t o, uint32_t s, size_t *object, size_t *symbol) {
+  const ObjectSymbol *used = &linker->objects[o].symbols[s];
+  if (used->section != OBJECT_UNDEFINED) {
+    *object = o;
+    *symbol = s;
+    return true;
+  }
+  LinkSymbol *definition = NULL;
+  HASH_FIND_STR(linker->globals, used->name, definition);
+  if (definition == NULL) {
+    return false;
+  }
+  *object = definition->object;
+  *symbol = definition->symbol;
+  return true;
+}
+
+static void keep_section(Linker *linker, size_t o, size_t section) {
+  size_t flat = linker->firstSection[o] + section;
+  if (linker->address[flat] == LINK_DROPPED) {
+    linker->address[flat] = 0;
+    linker->worklist[linker->worklistCount++] = flat;
+  }
+}
+
+// Keep every section reachable from the entry section
+static void mark_sections(Linker *linker) {
+  if (linker->count == 0 || linker->objects[0].sectionCount == 0) {
+    return;
+  }
+  keep_section(linker, 0, 0);
+
+  while (linker->worklistCount > 0) {
+    size_t flat = linker->worklist[--linker->worklistCount];
+    size_t o = 0;
+    while (o + 1 < linker->count && linker->firstSection[o + 1] <= flat) {
+      o++;
+    }
+    const ObjectFile *object = &linker->objects[o];
+    const ObjectSection *section = &object->sections[flat - linker->firstSection[o]];
+
+    for (size_t r = 0; r < section->relocationCount; r++) {
+      const ObjectRelocation *relocation = &object->relocations[section->firstRelocation + r];
+      size_t target, symbol;
+      if (!resolve(linker, o, relocation->symbol, &target, &symbol)) {
+        asm_error(linker->result, 0, "Undefined symbol '%s' in %s",
+                  object->symbols[relocation->symbol].name, linker->names[o]);
+        continue;
+      }
+      uint16_t targetSection = linker->objects[target].symbols[symbol].section;
+      if (targetSection < OBJECT_ABSOLUTE) {
+        keep_section(linker, target, targetSection);
+      }
+    }
+  }
+}
+
+static bool patch_relocations(Linker *linker, size_t o, size_t s, uint32_t origin) {
+  const ObjectFile *object = &linker->objects[o];
+  const ObjectSection *section = &object->sections[s];
+  uint32_t base = linker->address[linker->firstSection[o] + s];
+  RomImage *image = &linker->result->image;
+
+  for (size_t r = 0; r < section->relocationCount; r++) {
+    const ObjectRelocation *relocation = &object->relocations[section->firstRelocation + r];
+    uint8_t *bytes = image->bytes + (base - origin) + relocation->offset;
+    Instruction *instruction = get_instruction_by_opcodefunct3(bytes[0]);
+    uint8_t count = instruction ? instruction->length / 8 : 0;
+    if (count == 0 || relocation->offset + count > section->size) {
+      asm_error(linker->result, 0, "Bad relocation in section '%s' of %s", section->name,
+                linker->names[o]);
+      return false;
+    }
+
+    size_t target, index;
+    resolve(linker, o, relocation->symbol, &target, &index);
+    const ObjectSymbol *definition = &linker->objects[target].symbols[index];
+    Symbol symbol;
+    symbol.kind = (SymbolKind)definition->kind;
+    symbol.value = definition->value;
+    if (definition->section < OBJECT_ABSOLUTE) {
+      symbol.value += linker->address[linker->firstSection[target] + definition->section];
+    }
+
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < count; i++) {
+      value |= (uint32_t)bytes[i] << (i * 8);
+    }
+    uint32_t next_pc = base + relocation->offset + count;
+    BytePack pack = pack_bytes(instruction, asm_resolve_immediate(instruction, value, &symbol, next_pc));
+    memcpy(bytes, pack.bytes, pack.count);
+  }
+  return true;
+}
+
+bool link_objects(const ObjectFile *objects, const char *const *names, size_t count,
+                  uint32_t origin, AsmResult *result, LinkStats *stats) {
+  result->diagnosticCount = 0;
+  result->ok = true;
+  result->image.size = 0;
+  memset(stats, 0, sizeof(*stats));
+
+  Linker linker = {};
+  linker.objects = objects;
+  linker.names = names;
+  linker.count = count;
+  linker.result = result;
+
+  size_t sections = 0;
+  linker.firstSection = (size_t *)malloc((count + 1) * sizeof(size_t));
+  for (size_t o = 0; linker.firstSection != NULL && o < count; o++) {
+    linker.firstSection[o] = sections;
+    sections += objects[o].sectionCount;
+  }
+  linker.address = (uint32_t *)malloc((sections + 1) * sizeof(uint32_t));
+  linker.worklist = (size_t *)malloc((sections + 1) * sizeof(size_t));
+  if (linker.firstSection == NULL || linker.address == NULL || linker.worklist == NULL) {
+    asm_error(result, 0, "Out of memory");
+  } else {
+    memset(linker.address, 0xFF, sections * sizeof(uint32_t));
+  }
+
+  if (result->ok && define_globals(&linker)) {
+    mark_sections(&linker);
+  }
+
+  // Lay kept sections out in input order
+  uint32_t pc = origin;
+  for (size_t o = 0; result->ok && o < count; o++) {
+    for (size_t s = 0; s < objects[o].sectionCount; s++) {
+      uint32_t *address = &linker.address[linker.firstSection[o] + s];
+      if (*address == LINK_DROPPED) {
+        stats->droppedSections++;
+        stats->droppedBytes += objects[o].sections[s].size;
+        continue;
+      }
+      *address = pc;
+      pc += objects[o].sections[s].size;
+      stats->keptSections++;
+    }
+  }
+  stats->keptBytes = pc - origin;
+  if (result->ok && stats->keptBytes > PROGRAM_SIZE) {
+    asm_error(result, 0, "Program too large (%zu bytes, max %d)", stats->keptBytes, PROGRAM_SIZE);
+  }
+  if (result->ok && stats->keptBytes > result->image.capacity) {
+    uint8_t *bytes = (uint8_t *)realloc(result->image.bytes, stats->keptBytes);
+    if (bytes == NULL) {
+      asm_error(result, 0, "Out of memory");
+    } else {
+      result->image.bytes = bytes;
+      result->image.capacity = stats->keptBytes;
+    }
+  }
+
+  for (size_t o = 0; result->ok && o < count; o++) {
+    for (size_t s = 0; s < objects[o].sectionCount && result->ok; s++) {
+      uint32_t address = linker.address[linker.firstSection[o] + s];
+      if (address == LINK_DROPPED) {
+        continue;
+      }
+      const ObjectSection *section = &objects[o].sections[s];
+      memcpy(result->image.bytes + (address - origin), objects[o].code.bytes + section->offset,
+             section->size);
+      patch_relocations(&linker, o, s, origin);
+    }
+  }
+  if (result->ok) {
+    result->image.size = stats->keptBytes;
+  }
+
+  LinkSymbol *entry, *tmp;
+  HASH_ITER(hh, linker.globals, entry, tmp) {
+    HASH_DEL(linker.globals, entry);
+    free(entry);
+  }
+  free(linker.firstSection);
+  free(linker.address);
+  free(linker.worklist);
+  return result->ok;
+}
@@ -0,0 +1,375 @@
+#include "config.h"
+#include "object.h"
+#include <stdlib.h>
+#include <string.h>
+
+static bool add_section(ObjectFile *object, const char *name, size_t length) {
+  if (object->sectionCount >= OBJECT_ABSOLUTE ||
+      !asm_grow((void **)&object->sections, &object->sectionCapacity, object->sectionCount,
+                sizeof(ObjectSection), 8)) {
+    return false;
+  }
+  ObjectSection *section = &object->sections[object->sectionCount++];
+  memset(section, 0, sizeof(*section));
+  memcpy(section->name, name, length);
+  section->offset = (uint32_t)object->code.size;
+  section->firstRelocation = object->relocationCount;
+  return true;
+}
+
+static bool add_symbol(ObjectFile *object, const char *name, size_t length, uint8_t kind,
+                       uint16_t section, uint32_t value) {
+  if (!asm_grow((void **)&object->symbols, &object->symbolCapacity, object->symbolCount,
+                sizeof(ObjectSymbol), 64)) {
+    return false;
+  }
+  ObjectSymbol *symbol = &object->symbols[object->symbolCount++];
+  memset(symbol->name, 0, sizeof(symbol->name));
+  memcpy(symbol->name, name, length);
+  symbol->kind = kind;
+  symbol->section = section;
+  symbol->value = value;
+  return true;
+}
+
+// Names map to their index in object->symbols. A name used before its
+// definition gets an undefined entry, which the definition then fills in.
+static bool define_symbol(ObjectFile *object, SymbolTable *names, const char *name, size_t length,
+                          uint8_t kind, uint16_t section, uint32_t value, uint32_t line) {
+  Symbol *known = symbol_find(names, name, length);
+  if (known != NULL) {
+    ObjectSymbol *symbol = &object->symbols[known->value];
+    if (symbol->section != OBJECT_UNDEFINED) {
+      return false;
+    }
+    symbol->kind = kind;
+    symbol->section = section;
+    symbol->value = value;
+    return true;
+  }
+  return symbol_define(names, name, length, (uint32_t)object->symbolCount, (SymbolKind)kind, line) &&
+         add_symbol(object, name, length, kind, section, value);
+}
+
+// Code before the first .section goes to the default section
+static bool current_section(ObjectFile *object) {
+  return object->sectionCount > 0 ||
+         add_section(object, OBJECT_DEFAULT_SECTION, strlen(OBJECT_DEFAULT_SECTION));
+}
+
+bool assemble_object(const char *source, size_t length, ObjectFile *object, AsmResult *result) {
+  result->diagnosticCount = 0;
+  result->ok = true;
+
+  // Constants are kept apart so .equ can only build on constants
+  SymbolTable names = {NULL};
+  SymbolTable constants = {NULL};
+  AsmLine parsed;
+  uint32_t line = 0;
+  const char *next = source;
+  const char *end = source + length;
+  char *tail = NULL;
+
+  while (next < end) {
+    const char *lineStart = next;
+    const char *lineEnd = (const char *)memchr(next, '\n', end - next);
+    if (lineEnd == NULL) {
+      lineEnd = end;
+      tail = (char *)malloc(lineEnd - lineStart + 1);
+      if (tail == NULL) {
+        asm_error(result, line + 1, "Out of memory");
+        break;
+      }
+      memcpy(tail, lineStart, lineEnd - lineStart);
+      tail[lineEnd - lineStart] = '\0';
+      lineStart = tail;
+    }
+    next += (lineEnd - next) + 1;
+    line++;
+
+    assemble_line(lineStart, &parsed);
+    if (parsed.hasError) {
+      asm_error(result, line, "%s", parsed.message);
+      continue;
+    }
+
+    if (parsed.kind == ASM_LINE_SECTION) {
+      // Sections stay contiguous in the code, so one cannot be reopened
+      const char *name = lineStart + parsed.symbolOffset;
+      bool duplicate = false;
+      for (size_t i = 0; i < object->sectionCount && !duplicate; i++) {
+        duplicate = strlen(object->sections[i].name) == parsed.symbolLength &&
+                    memcmp(object->sections[i].name, name, parsed.symbolLength) == 0;
+      }
+      if (duplicate) {
+        asm_error(result, line, "Duplicate section '%.*s'", (int)parsed.symbolLength, name);
+      } else if (!add_section(object, name, parsed.symbolLength)) {
+        asm_error(result, line, "Out of memory");
+        break;
+      }
+    }
+
+    for (uint8_t i = 0; i < parsed.labelCount; i++) {
+      const char *name = lineStart + parsed.labelOffset[i];
+      if (!current_section(object)) {
+        asm_error(result, line, "Out of memory");
+        break;
+      }
+      uint16_t section = (uint16_t)(object->sectionCount - 1);
+      uint32_t offset = (uint32_t)(object->code.size - object->sections[section].offset);
+      if (!define_symbol(object, &names, name, parsed.labelLength[i], SYMBOL_LABEL, section,
+                         offset, line)) {
+        asm_error(result, line, "Duplicate or invalid label '%.*s'", (int)parsed.labelLength[i], name);
+      }
+    }
+
+    if (parsed.kind == ASM_LINE_EQU) {
+      const char *name = lineStart + parsed.symbolOffset;
+      uint32_t value = 0;
+      if (!asm_equ_value(&constants, lineStart + parsed.valueOffset, &value) ||
+          !define_symbol(object, &names, name, parsed.symbolLength, SYMBOL_CONSTANT,
+                         OBJECT_ABSOLUTE, value, line) ||
+          !symbol_define(&constants, name, parsed.symbolLength, value, SYMBOL_CONSTANT, line)) {
+        asm_error(result, line, "Invalid .equ");
+      }
+    }
+
+    if (parsed.kind != ASM_LINE_INSTRUCTION) {
+      continue;
+    }
+    if (!current_section(object)) {
+      asm_error(result, line, "Out of memory");
+      break;
+    }
+    ObjectSection *section = &object->sections[object->sectionCount - 1];
+    uint32_t offset = (uint32_t)(object->code.size - section->offset);
+    if (!rom_image_append(&object->code, pack_bytes(parsed.instruction, parsed.value))) {
+      asm_error(result, line, "Out of memory");
+      break;
+    }
+    section->size = (uint32_t)(object->code.size - section->offset);
+
+    if (parsed.symbolLength == 0) {
+      continue;
+    }
+    const char *name = lineStart + parsed.symbolOffset;
+    Symbol *symbol = symbol_find(&names, name, parsed.symbolLength);
+    if (symbol == NULL) {
+      if (!define_symbol(object, &names, name, parsed.symbolLength, SYMBOL_LABEL, OBJECT_UNDEFINED,
+                         0, line)) {
+        asm_error(result, line, "Out of memory");
+        break;
+      }
+      symbol = symbol_find(&names, name, parsed.symbolLength);
+    }
+    if (!asm_grow((void **)&object->relocations, &object->relocationCapacity,
+                  object->relocationCount, sizeof(ObjectRelocation), 64)) {
+      asm_error(result, line, "Out of memory");
+      break;
+    }
+    ObjectRelocation *relocation = &object->relocations[object->relocationCount++];
+    relocation->section = (uint16_t)(object->sectionCount - 1);
+    relocation->offset = offset;
+    relocation->symbol = symbol->value;
+    section->relocationCount++;
+  }
+
+  free(tail);
+  symbol_table_free(&names);
+  symbol_table_free(&constants);
+  return result->ok;
+}
+
+static void put_u16(uint8_t *out, uint16_t value) {
+  out[0] = value & 0xFF;
+  out[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    out[i] = (value >> (i * 8)) & 0xFF;
+  }
+}
+
+bool object_write(const ObjectFile *object, int fd) {
+  // Tables are small next to the code, so build the whole file and write once
+  RomImage file = {NULL, 0, 0};
+  size_t tables = 19 + object->sectionCount * (1 + SYMBOL_NAME_MAX + 4) +
+                  object->symbolCount * (1 + SYMBOL_NAME_MAX + 7) + object->relocationCount * 10;
+  file.bytes = (uint8_t *)malloc(tables + object->code.size);
+  if (file.bytes == NULL) {
+    return false;
+  }
+  uint8_t *out = file.bytes;
+
+  memcpy(out, OBJECT_MAGIC, 4);
+  out[4] = OBJECT_VERSION;
+  put_u16(out + 5, (uint16_t)object->sectionCount);
+  put_u32(out + 7, (uint32_t)object->symbolCount);
+  put_u32(out + 11, (uint32_t)object->relocationCount);
+  put_u32(out + 15, (uint32_t)object->code.size);
+  out += 19;
+
+  for (size_t i = 0; i < object->sectionCount; i++) {
+    const ObjectSection *section = &object->sections[i];
+    size_t length = strlen(section->name);
+    *out++ = (uint8_t)length;
+    memcpy(out, section->name, length);
+    out += length;
+    put_u32(out, section->size);
+    out += 4;
+  }
+  for (size_t i = 0; i < object->symbolCount; i++) {
+    const ObjectSymbol *symbol = &object->symbols[i];
+    size_t length = strlen(symbol->name);
+    *out++ = (uint8_t)length;
+    memcpy(out, symbol->name, length);
+    out += length;
+    *out++ = symbol->kind;
+    put_u16(out, symbol->section);
+    put_u32(out + 2, symbol->value);
+    out += 6;
+  }
+  for (size_t i = 0; i < object->relocationCount; i++) {
+    const ObjectRelocation *relocation = &object->relocations[i];
+    put_u16(out, relocation->section);
+    put_u32(out + 2, relocation->offset);
+    put_u32(out + 6, relocation->symbol);
+    out += 10;
+  }
+  memcpy(out, object->code.bytes, object->code.size);
+  file.size = (size_t)(out - file.bytes) + object->code.size;
+
+  bool ok = rom_image_write(&file, fd);
+  free(file.bytes);
+  return ok;
+}
+
+// Bounds-checked cursor over an object file image
+typedef struct {
+  const uint8_t *cursor;
+  const uint8_t *end;
+  bool ok;
+} ObjectReader;
+
+static const uint8_t *take(ObjectReader *reader, size_t count) {
+  if (!reader->ok || (size_t)(reader->end - reader->cursor) < count) {
+    reader->ok = false;
+    return NULL;
+  }
+  const uint8_t *bytes = reader->cursor;
+  reader->cursor += count;
+  return bytes;
+}
+
+static uint8_t take_u8(ObjectReader *reader) {
+  const uint8_t *bytes = take(reader, 1);
+  return bytes ? bytes[0] : 0;
+}
+
+static uint16_t take_u16(ObjectReader *reader) {
+  const uint8_t *bytes = take(reader, 2);
+  return bytes ? (uint16_t)(bytes[0] | bytes[1] << 8) : 0;
+}
+
+static uint32_t take_u32(ObjectReader *reader) {
+  const uint8_t *bytes = take(reader, 4);
+  if (bytes == NULL) {
+    return 0;
+  }
+  return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 |
+         (uint32_t)bytes[3] << 24;
+}
+
+static void take_name(ObjectReader *reader, char name[SYMBOL_NAME_MAX]) {
+  uint8_t length = take_u8(reader);
+  const uint8_t *bytes = take(reader, length);
+  if (length >= SYMBOL_NAME_MAX || bytes == NULL) {
+    reader->ok = false;
+    return;
+  }
+  memcpy(name, bytes, length);
+  name[length] = '\0';
+}
+
+bool object_read(const uint8_t *data, size_t size, ObjectFile *object) {
+  ObjectReader reader = {data, data + size, true};
+  const uint8_t *magic = take(&reader, 4);
+  if (magic == NULL || memcmp(magic, OBJECT_MAGIC, 4) != 0 || take_u8(&reader) != OBJECT_VERSION) {
+    return false;
+  }
+  size_t sectionCount = take_u16(&reader);
+  size_t symbolCount = take_u32(&reader);
+  size_t relocationCount = take_u32(&reader);
+  size_t codeSize = take_u32(&reader);
+  // Every record takes at least a few bytes, which bounds the allocations
+  if (!reader.ok || symbolCount > size || relocationCount > size || codeSize > size) {
+    return false;
+  }
+
+  object->sections = (ObjectSection *)calloc(sectionCount ? sectionCount : 1, sizeof(ObjectSection));
+  object->symbols = (ObjectSymbol *)calloc(symbolCount ? symbolCount : 1, sizeof(ObjectSymbol));
+  object->relocations =
+      (ObjectRelocation *)calloc(relocationCount ? relocationCount : 1, sizeof(ObjectRelocation));
+  object->code.bytes = (uint8_t *)malloc(codeSize ? codeSize : 1);
+  if (object->sections == NULL || object->symbols == NULL || object->relocations == NULL ||
+      object->code.bytes == NULL) {
+    object_free(object);
+    return false;
+  }
+  object->sectionCapacity = object->sectionCount = sectionCount;
+  object->symbolCapacity = object->symbolCount = symbolCount;
+  object->relocationCapacity = object->relocationCount = relocationCount;
+  object->code.capacity = object->code.size = codeSize;
+
+  uint32_t offset = 0;
+  for (size_t i = 0; i < sectionCount; i++) {
+    ObjectSection *section = &object->sections[i];
+    take_name(&reader, section->name);
+    section->offset = offset;
+    section->size = take_u32(&reader);
+    offset += section->size;
+    reader.ok = reader.ok && section->size <= codeSize && offset <= codeSize;
+  }
+  for (size_t i = 0; i < symbolCount; i++) {
+    ObjectSymbol *symbol = &object->symbols[i];
+    take_name(&reader, symbol->name);
+    symbol->kind = take_u8(&reader);
+    symbol->section = take_u16(&reader);
+    symbol->value = take_u32(&reader);
+    reader.ok = reader.ok && (symbol->kind == SYMBOL_LABEL || symbol->kind == SYMBOL_CONSTANT) &&
+                (symbol->section >= OBJECT_ABSOLUTE || symbol->section < sectionCount);
+  }
+  for (size_t i = 0; i < relocationCount; i++) {
+    ObjectRelocation *relocation = &object->relocations[i];
+    relocation->section = take_u16(&reader);
+    relocation->offset = take_u32(&reader);
+    relocation->symbol = take_u32(&reader);
+    reader.ok = reader.ok && relocation->section < sectionCount &&
+                relocation->symbol < symbolCount &&
+                (i == 0 || relocation->section >= object->relocations[i - 1].section) &&
+                relocation->offset < object->sections[relocation->section].size;
+    if (reader.ok) {
+      ObjectSection *section = &object->sections[relocation->section];
+      if (section->relocationCount == 0) {
+        section->firstRelocation = i;
+      }
+      section->relocationCount++;
+    }
+  }
+  const uint8_t *code = take(&reader, codeSize);
+  if (!reader.ok || offset != codeSize) {
+    object_free(object);
+    return false;
+  }
+  memcpy(object->code.bytes, code, codeSize);
+  return true;
+}
+
+void object_free(ObjectFile *object) {
+  free(object->sections);
+  free(object->symbols);
+  free(object->relocations);
+  rom_image_free(&object->code);
+  memset(object, 0, sizeof(*object));
+}
@@ -0,0 +1,979 @@
+#include "config.h"
+#include "optimizer.h"
+#include "symbols.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define OPT_NO_TARGET 0xFFFFFFFFu
+// Jump chains longer than this are left alone (and cycles stop here)
+#define OPT_MAX_THREAD_HOPS 16
+
+typedef struct {
+  Instruction *instruction; // NULL once removed
+  uint32_t value;
+  const char *symbol;       // symbolic immediate not resolved to a target
+  uint16_t symbolLength;
+  uint32_t target;          // PC-relative target as an item index
+  bool literal;             // target came from a numeric offset
+  uint16_t offset;          // that offset
+  uint32_t address;         // in the source layout
+  uint32_t line;
+} OptItem;
+
+// A label or .equ, replayed in source order once the layout is final
+typedef struct {
+  const char *name;
+  uint16_t length;
+  uint8_t kind;             // SymbolKind
+  uint32_t item;            // labels: the item that follows
+  const char *valueStr;
+  uint32_t line;
+} OptDefinition;
+
+typedef struct {
+  OptItem *items;
+  size_t count, capacity;
+  OptDefinition *definitions;
+  size_t definitionCount, definitionCapacity;
+  bool *targeted;           // per item index, count + 1 entries
+  char *tail;
+} OptProgram;
+
+enum {
+  OPT_NOT_IDENTITY,
+  OPT_MOVE,                 // rd = rs1
+  OPT_CLEAR                 // rd = 0
+};
+
+static bool is_pc_relative(const Instruction *instruction) {
+  return instruction->opcode == 0x05 ||
+         (instruction->opcode == 0x06 && instruction->funct3 == 0x01);
+}
+
+// Unconditional jumps with no other effect: branches that compare a register
+// with itself for equality. JAL always writes rd, and r0 is no exception.
+static bool is_plain_jump(const OptItem *item) {
+  const Instruction *instruction = item->instruction;
+  if (instruction == NULL) {
+    return false;
+  }
+  if (instruction->opcode == 0x05) {
+    bool inclusive = instruction->funct3 == 0x00 || instruction->funct3 == 0x04 ||
+                     instruction->funct3 == 0x05; // BEQ, BLE, BGE
+    return inclusive && ((item->value >> 8) & 0xF) == ((item->value >> 12) & 0xF);
+  }
+  return false;
+}
+
+// Instructions after which execution never falls through
+static bool ends_flow(const OptItem *item) {
+  return is_plain_jump(item) ||
+         (item->instruction->opcode == 0x06 && item->instruction->funct3 == 0x02) ||
+         item->instruction->opcode_funct3 == 0xFF;
+}
+
+static bool is_shift_immediate(const Instruction *instruction) {
+  return instruction->opcode == 0x0A && instruction->funct3 == 0x01;
+}
+
+// ALU immediates: ADDI..DIVI, ANDI..XORI and the immediate shifts
+static bool is_alu_immediate(const Instruction *instruction) {
+  return instruction->opcode == 0x02 || instruction->opcode == 0x09 ||
+         is_shift_immediate(instruction);
+}
+
+static uint8_t item_rd(const OptItem *item) {
+  return is_shift_immediate(item->instruction) ? (item->value >> 12) & 0xF : (item->value >> 8) & 0xF;
+}
+
+static uint8_t item_rs1(const OptItem *item) {
+  return is_shift_immediate(item->instruction) ? (item->value >> 24) & 0xF : (item->value >> 12) & 0xF;
+}
+
+// The VM only uses the low byte of ALU immediates
+static uint8_t item_imm8(const OptItem *item) {
+  return (item->value >> 16) & 0xFF;
+}
+
+static int alu_identity(const OptItem *item) {
+  if (item->symbolLength > 0 || !is_alu_immediate(item->instruction)) {
+    return OPT_NOT_IDENTITY;
+  }
+  uint8_t imm = item_imm8(item);
+  if (is_shift_immediate(item->instruction)) {
+    return imm == 0 ? OPT_MOVE : OPT_NOT_IDENTITY;
+  }
+  switch (isa_op(item->instruction)) {
+  case ISA_ADDI:
+  case ISA_SUBI:
+  case ISA_ORI:
+  case ISA_XORI:
+    return imm == 0 ? OPT_MOVE : OPT_NOT_IDENTITY;
+  case ISA_MULI:
+    return imm == 1 ? OPT_MOVE : imm == 0 ? OPT_CLEAR : OPT_NOT_IDENTITY;
+  case ISA_DIVI:
+    return imm == 1 ? OPT_MOVE : OPT_NOT_IDENTITY;
+  case ISA_ANDI:
+    return imm == 0xFF ? OPT_MOVE : imm == 0 ? OPT_CLEAR : OPT_NOT_IDENTITY;
+  default:
+    return OPT_NOT_IDENTITY;
+  }
+}
+
+static size_t item_bytes(const OptItem *item) {
+  return item->instruction ? item->instruction->length / 8 : 0;
+}
+
+static size_t first_live(const OptProgram *program, size_t index) {
+  while (index < program->count && program->items[index].instruction == NULL) {
+    index++;
+  }
+  return index;
+}
+
+static void remove_item(OptProgram *program, size_t index, size_t *counter, size_t *bytes) {
+  (*counter)++;
+  *bytes += item_bytes(&program->items[index]);
+  program->items[index].instruction = NULL;
+}
+
+// Labels and branch targets: code must not be merged across these
+static void mark_targets(OptProgram *program) {
+  memset(program->targeted, 0, (program->count + 1) * sizeof(bool));
+  for (size_t i = 0; i < program->definitionCount; i++) {
+    if (program->definitions[i].kind == SYMBOL_LABEL) {
+      program->targeted[program->definitions[i].item] = true;
+    }
+  }
+  for (size_t i = 0; i < program->count; i++) {
+    if (program->items[i].instruction != NULL && program->items[i].target != OPT_NO_TARGET) {
+      program->targeted[program->items[i].target] = true;
+    }
+  }
+}
+
+// Like mark_targets(), but a label only counts if something still names it
+static void mark_used_targets(OptProgram *program) {
+  memset(program->targeted, 0, (program->count + 1) * sizeof(bool));
+  SymbolTable used = {NULL};
+  for (size_t i = 0; i < program->count; i++) {
+    const OptItem *item = &program->items[i];
+    if (item->instruction == NULL) {
+      continue;
+    }
+    if (item->target != OPT_NO_TARGET) {
+      program->targeted[item->target] = true;
+    }
+    if (item->symbolLength > 0 && symbol_find(&used, item->symbol, item->symbolLength) == NULL) {
+      symbol_define(&used, item->symbol, item->symbolLength, 0, SYMBOL_LABEL, item->line);
+    }
+  }
+  for (size_t i = 0; i < program->definitionCount; i++) {
+    const OptDefinition *definition = &program->definitions[i];
+    if (definition->kind == SYMBOL_CONSTANT && is_symbol_start(*definition->valueStr)) {
+      size_t length = 1;
+      while (is_symbol_char(definition->valueStr[length])) {
+        length++;
+      }
+      if (symbol_find(&used, definition->valueStr, length) == NULL) {
+        symbol_define(&used, definition->valueStr, length, 0, SYMBOL_LABEL, definition->line);
+      }
+    }
+  }
+  for (size_t i = 0; i < program->definitionCount; i++) {
+    const OptDefinition *definition = &program->definitions[i];
+    if (definition->kind == SYMBOL_LABEL && symbol_find(&used, definition->name, definition->length)) {
+      program->targeted[definition->item] = true;
+    }
+  }
+  symbol_table_free(&used);
+}
+
+static bool targeted_between(const OptProgram *program, size_t after, size_t through) {
+  for (size_t i = after + 1; i <= through; i++) {
+    if (program->targeted[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool remove_noops(OptProgram *program, AsmOptStats *stats) {
+  bool changed = false;
+  for (size_t i = 0; i < program->count; i++) {
+    OptItem *item = &program->items[i];
+    if (item->instruction == NULL) {
+      continue;
+    }
+    bool noop = alu_identity(item) == OPT_MOVE && item_rd(item) == item_rs1(item);
+    if (item->target != OPT_NO_TARGET && (item->instruction->opcode == 0x05 || is_plain_jump(item))) {
+      noop = noop || first_live(program, item->target) == first_live(program, i + 1);
+    }
+    if (noop) {
+      remove_item(program, i, &stats->removed, &stats->removedBytes);
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Fold class of an immediate op (0 if none); ADDI and SUBI share one
+static int fold_class(const Instruction *instruction) {
+  IsaOp op = isa_op(instruction);
+  switch (op) {
+  case ISA_ADDI:
+  case ISA_SUBI:
+    return ISA_ADDI;
+  case ISA_MULI:
+  case ISA_ANDI:
+  case ISA_ORI:
+  case ISA_XORI:
+    return op;
+  default:
+    return 0;
+  }
+}
+
+static uint8_t fold_immediates(const OptItem *first, const OptItem *second) {
+  uint8_t a = item_imm8(first), b = item_imm8(second);
+  switch (isa_op(first->instruction)) {
+  case ISA_ADDI:
+  case ISA_SUBI: {
+    int delta = (first->instruction->funct3 ? -a : a) + (second->instruction->funct3 ? -b : b);
+    return (uint8_t)delta;
+  }
+  case ISA_MULI:
+    return (uint8_t)(a * b);
+  case ISA_ANDI:
+    return a & b;
+  case ISA_ORI:
+    return a | b;
+  default:
+    return a ^ b;
+  }
+}
+
+static bool fold_pairs(OptProgram *program, AsmOptStats *stats) {
+  Instruction *addi = get_instruction_by_name("ADDI", 4);
+  bool changed = false;
+  for (size_t i = 0; i < program->count; i++) {
+    OptItem *first = &program->items[i];
+    if (first->instruction == NULL || first->symbolLength > 0 || fold_class(first->instruction) == 0) {
+      continue;
+    }
+    size_t j = first_live(program, i + 1);
+    if (j >= program->count || targeted_between(program, i, j)) {
+      continue;
+    }
+    OptItem *second = &program->items[j];
+    if (second->symbolLength > 0 || fold_class(second->instruction) != fold_class(first->instruction) ||
+        item_rd(second) != item_rd(first) || item_rs1(second) != item_rd(first)) {
+      continue;
+    }
+
+    uint8_t imm = fold_immediates(first, second);
+    if (fold_class(first->instruction) == ISA_ADDI) {
+      first->instruction = addi;
+    }
+    // The first byte is rebuilt from the fields, as the encoders do
+    first->value = (first->value & 0xFF00) | (first->instruction->funct3 & 0x7) |
+                   (first->instruction->opcode & 0x1F) << 3 | ((uint32_t)imm << 16);
+    remove_item(program, j, &stats->folded, &stats->foldedBytes);
+    changed = true;
+  }
+  return changed;
+}
+
+static bool thread_jumps(OptProgram *program, AsmOptStats *stats) {
+  bool changed = false;
+  for (size_t i = 0; i < program->count; i++) {
+    OptItem *item = &program->items[i];
+    if (item->instruction == NULL || item->target == OPT_NO_TARGET) {
+      continue;
+    }
+    for (int hop = 0; hop < OPT_MAX_THREAD_HOPS; hop++) {
+      size_t landing = first_live(program, item->target);
+      if (landing >= program->count || landing == i) {
+        break;
+      }
+      const OptItem *jump = &program->items[landing];
+      if (!is_plain_jump(jump) || jump->target == OPT_NO_TARGET ||
+          first_live(program, jump->target) == landing) {
+        break;
+      }
+      item->target = jump->target;
+      stats->threaded++;
+      changed = true;
+    }
+  }
+
+  // A plain jump nothing falls into or targets any more is dead
+  mark_used_targets(program);
+  size_t previous = program->count;
+  for (size_t i = 0; i < program->count; i++) {
+    OptItem *item = &program->items[i];
+    if (item->instruction == NULL) {
+      continue;
+    }
+    if (previous < program->count && is_plain_jump(item) && ends_flow(&program->items[previous]) &&
+        !targeted_between(program, previous, i)) {
+      stats->threadedBytes += item_bytes(item);
+      item->instruction = NULL;
+      changed = true;
+      continue;
+    }
+    previous = i;
+  }
+  return changed;
+}
+
+static bool shorten(OptProgram *program, AsmOptStats *stats) {
+  Instruction *orInstruction = get_instruction_by_name("OR", 2);
+  Instruction *xorInstruction = get_instruction_by_name("XOR", 3);
+  bool changed = false;
+  for (size_t i = 0; i < program->count; i++) {
+    OptItem *item = &program->items[i];
+    if (item->instruction == NULL || item->instruction->length != 32) {
+      continue;
+    }
+    int identity = alu_identity(item);
+    if (identity == OPT_NOT_IDENTITY) {
+      continue;
+    }
+
+    uint8_t rd = item_rd(item);
+    uint8_t rs = identity == OPT_MOVE ? item_rs1(item) : rd;
+    Instruction *replacement = identity == OPT_MOVE ? orInstruction : xorInstruction;
+    item->instruction = replacement;
+    item->value = (replacement->funct3 & 0x7) | (replacement->opcode & 0x1F) << 3 |
+                  (replacement->funct4 & 0xF) << 8 | (uint32_t)rd << 12 | (uint32_t)rs << 16 |
+                  (uint32_t)rs << 20;
+    stats->shortened++;
+    stats->shortenedBytes += 1;
+    changed = true;
+  }
+  return changed;
+}
+
+// Drop removed items for good, so item indices are positions again
+static void compact_items(OptProgram *program, uint32_t *index) {
+  size_t live = 0;
+  for (size_t i = 0; i < program->count; i++) {
+    index[i] = (uint32_t)live;
+    if (program->items[i].instruction != NULL) {
+      program->items[live++] = program->items[i];
+    }
+  }
+  index[program->count] = (uint32_t)live;
+  for (size_t i = 0; i < live; i++) {
+    if (program->items[i].target != OPT_NO_TARGET) {
+      program->items[i].target = index[program->items[i].target];
+    }
+  }
+  for (size_t i = 0; i < program->definitionCount; i++) {
+    program->definitions[i].item = index[program->definitions[i].item];
+  }
+  program->count = live;
+}
+
+enum {
+  OPT_EXIT_FALL,            // falls into the next block (calls return there too)
+  OPT_EXIT_BRANCH,          // conditional branch, falls through otherwise
+  OPT_EXIT_JUMP,            // plain jump to another block
+  OPT_EXIT_STOP             // JALR, HALT or a jump out of the program
+};
+
+typedef struct {
+  uint32_t start, end;      // items [start, end)
+  uint32_t count;           // hottest profiled instruction
+  uint32_t next, prev;      // neighbours in the new layout, or OPT_NO_TARGET
+  uint32_t taken;           // block a branch or jump goes to, or OPT_NO_TARGET
+  uint8_t exit;
+  bool inverted;
+} OptBlock;
+
+typedef struct {
+  OptBlock *blocks;
+  size_t count;
+  uint32_t *blockOf;        // per item index, count + 1 entries
+} OptLayout;
+
+static bool ends_block(const OptItem *item) {
+  return item->instruction->opcode == 0x05 || ends_flow(item);
+}
+
+static uint32_t chain_head(const OptLayout *layout, uint32_t block) {
+  while (layout->blocks[block].prev != OPT_NO_TARGET) {
+    block = layout->blocks[block].prev;
+  }
+  return block;
+}
+
+static bool can_link(const OptLayout *layout, uint32_t from, uint32_t to) {
+  return to < layout->count && to != 0 && layout->blocks[from].next == OPT_NO_TARGET &&
+         layout->blocks[to].prev == OPT_NO_TARGET && chain_head(layout, from) != to;
+}
+
+// A block nothing falls into may be placed after any block that jumps to it
+static bool can_claim(const OptLayout *layout, uint32_t from, uint32_t to) {
+  if (!can_link(layout, from, to)) {
+    return false;
+  }
+  const OptBlock *before = &layout->blocks[to - 1];
+  return before->exit == OPT_EXIT_JUMP || before->exit == OPT_EXIT_STOP || before->inverted;
+}
+
+static void link_blocks(OptLayout *layout, uint32_t from, uint32_t to) {
+  layout->blocks[from].next = to;
+  layout->blocks[to].prev = from;
+}
+
+static void profile_block(OptLayout *layout, uint32_t item, uint32_t count) {
+  OptBlock *block = &layout->blocks[layout->blockOf[item]];
+  if (count > block->count) {
+    block->count = count;
+  }
+}
+
+static void apply_profile(const OptProgram *program, OptLayout *layout, const AsmProfile *profile) {
+  SymbolTable labels = {NULL};
+  for (size_t i = 0; i < program->definitionCount; i++) {
+    const OptDefinition *definition = &program->definitions[i];
+    if (definition->kind == SYMBOL_LABEL && definition->item < program->count) {
+      symbol_define(&labels, definition->name, definition->length, definition->item, SYMBOL_LABEL,
+                    definition->line);
+    }
+  }
+  for (size_t i = 0; i < profile->count; i++) {
+    const AsmProfileEntry *entry = &profile->entries[i];
+    if (entry->label != NULL) {
+      Symbol *label = symbol_find(&labels, entry->label, entry->labelLength);
+      if (label != NULL) {
+        profile_block(layout, label->value, entry->count);
+      }
+      continue;
+    }
+    size_t low = 0, high = program->count;
+    while (low < high) {
+      size_t mid = (low + high) / 2;
+      if (program->items[mid].address < entry->address) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    if (low < program->count && program->items[low].address == entry->address) {
+      profile_block(layout, (uint32_t)low, entry->count);
+    }
+  }
+  symbol_table_free(&labels);
+}
+
+// Hottest first, source order among equals
+static int compare_heat(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static uint64_t heat_key(uint32_t count, uint32_t block) {
+  return (uint64_t)count << 32 | (0xFFFFFFFFu - block);
+}
+
+// Chain the blocks: fallthroughs stay put, a branch whose taken side is
+// hotter than its fallthrough is inverted to fall into it, and a plain
+// jump pulls its target in behind itself. Returns false if the blocks
+// cannot be ordered that way.
+static bool chain_blocks(OptLayout *layout, const uint64_t *order) {
+  uint32_t n = (uint32_t)layout->count;
+  for (uint32_t b = 0; b + 1 < n; b++) {
+    if (layout->blocks[b].exit == OPT_EXIT_FALL) {
+      link_blocks(layout, b, b + 1);
+    }
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t b = 0xFFFFFFFFu - (uint32_t)order[i];
+    OptBlock *block = &layout->blocks[b];
+    if (block->exit != OPT_EXIT_BRANCH || b + 1 == n) {
+      continue;
+    }
+    uint32_t taken = block->taken;
+    bool hotter = taken != OPT_NO_TARGET && taken < n &&
+                  layout->blocks[taken].count > layout->blocks[b + 1].count;
+    if (hotter && can_claim(layout, b, taken)) {
+      block->inverted = true;
+      link_blocks(layout, b, taken);
+    } else if (can_link(layout, b, b + 1)) {
+      link_blocks(layout, b, b + 1);
+    } else if (taken != OPT_NO_TARGET && can_claim(layout, b, taken)) {
+      block->inverted = true;
+      link_blocks(layout, b, taken);
+    } else {
+      return false;
+    }
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t b = 0xFFFFFFFFu - (uint32_t)order[i];
+    const OptBlock *block = &layout->blocks[b];
+    if (block->exit == OPT_EXIT_JUMP && block->count > 0 && can_claim(layout, b, block->taken)) {
+      link_blocks(layout, b, block->taken);
+    }
+  }
+  return true;
+}
+
+static void invert_branch(OptProgram *program, const OptLayout *layout, uint32_t b) {
+  // BEQ<->BNE, BLT<->BGE, BGT<->BLE
+  static const char *const inverse[] = {"BNE", "BEQ", "BGE", "BLE", "BGT", "BLT"};
+  const OptBlock *block = &layout->blocks[b];
+  OptItem *item = &program->items[block->end - 1];
+  Instruction *instruction = get_instruction_by_name(inverse[item->instruction->funct3], 3);
+  item->instruction = instruction;
+  item->value = (item->value & ~0xFFu) | (instruction->funct3 & 0x7) | (instruction->opcode & 0x1F) << 3;
+  item->target = layout->blocks[b + 1].start;
+  item->literal = false;
+}
+
+// Emit the chains (entry first, then by heat; a chain that runs off the
+// end of the program goes last) and renumber items, targets and labels.
+// Returns false when out of memory.
+static bool place_chains(OptProgram *program, OptLayout *layout, const uint64_t *order,
+                         AsmOptStats *stats) {
+  uint32_t n = (uint32_t)layout->count;
+  uint32_t endChain = layout->blocks[n - 1].exit == OPT_EXIT_STOP ||
+                              layout->blocks[n - 1].exit == OPT_EXIT_JUMP
+                          ? OPT_NO_TARGET
+                          : chain_head(layout, n - 1);
+  uint32_t *sequence = (uint32_t *)malloc(n * sizeof(uint32_t));
+  uint32_t *index = (uint32_t *)malloc((program->count + 1) * sizeof(uint32_t));
+  OptItem *items = (OptItem *)malloc(program->count * sizeof(OptItem));
+  if (sequence == NULL || index == NULL || items == NULL) {
+    free(sequence);
+    free(index);
+    free(items);
+    return false;
+  }
+
+  uint32_t placed = 0;
+  for (uint32_t b = 0; b != OPT_NO_TARGET; b = layout->blocks[b].next) {
+    sequence[placed++] = b;
+  }
+  // The entry chain also has to come last: keep the source order
+  bool ok = endChain != 0 || placed == n;
+  for (uint32_t i = 0; ok && i < n; i++) {
+    uint32_t head = 0xFFFFFFFFu - (uint32_t)order[i];
+    if (layout->blocks[head].prev != OPT_NO_TARGET || head == 0 || head == endChain) {
+      continue;
+    }
+    for (uint32_t b = head; b != OPT_NO_TARGET; b = layout->blocks[b].next) {
+      sequence[placed++] = b;
+    }
+  }
+  for (uint32_t b = endChain; ok && endChain != 0 && b != OPT_NO_TARGET; b = layout->blocks[b].next) {
+    sequence[placed++] = b;
+  }
+
+  if (ok) {
+    for (uint32_t b = 0; b < n; b++) {
+      if (layout->blocks[b].inverted) {
+        invert_branch(program, layout, b);
+        stats->invertedBranches++;
+      }
+    }
+    size_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+      const OptBlock *block = &layout->blocks[sequence[i]];
+      stats->movedBlocks += sequence[i] != i;
+      for (uint32_t item = block->start; item < block->end; item++) {
+        index[item] = (uint32_t)count;
+        items[count++] = program->items[item];
+      }
+    }
+    index[program->count] = (uint32_t)program->count;
+    for (size_t i = 0; i < program->count; i++) {
+      program->items[i] = items[i];
+      if (program->items[i].target != OPT_NO_TARGET) {
+        program->items[i].target = index[program->items[i].target];
+      }
+    }
+    for (size_t i = 0; i < program->definitionCount; i++) {
+      program->definitions[i].item = index[program->definitions[i].item];
+    }
+  }
+  free(sequence);
+  free(index);
+  free(items);
+  return true;
+}
+
+// Profile-guided block layout; removed items are compacted away first.
+// Returns false when out of memory.
+static bool layout_blocks(OptProgram *program, const AsmProfile *profile, AsmOptStats *stats) {
+  uint32_t *index = (uint32_t *)malloc((program->count + 1) * sizeof(uint32_t));
+  if (index == NULL) {
+    return false;
+  }
+  compact_items(program, index);
+  free(index);
+  if (program->count == 0) {
+    return true;
+  }
+  mark_targets(program);
+
+  OptLayout layout = {};
+  layout.blocks = (OptBlock *)malloc(program->count * sizeof(OptBlock));
+  layout.blockOf = (uint32_t *)malloc((program->count + 1) * sizeof(uint32_t));
+  uint64_t *order = (uint64_t *)malloc(program->count * sizeof(uint64_t));
+  bool ok = layout.blocks != NULL && layout.blockOf != NULL && order != NULL;
+  for (size_t i = 0; ok && i < program->count; i++) {
+    if (i == 0 || program->targeted[i] || ends_block(&program->items[i - 1])) {
+      OptBlock *block = &layout.blocks[layout.count++];
+      memset(block, 0, sizeof(*block));
+      block->start = (uint32_t)i;
+      block->next = block->prev = OPT_NO_TARGET;
+    }
+    layout.blockOf[i] = (uint32_t)layout.count - 1;
+    layout.blocks[layout.count - 1].end = (uint32_t)i + 1;
+  }
+
+  bool profiled = false;
+  if (ok) {
+    layout.blockOf[program->count] = (uint32_t)layout.count;
+    for (size_t b = 0; b < layout.count; b++) {
+      OptBlock *block = &layout.blocks[b];
+      const OptItem *last = &program->items[block->end - 1];
+      block->taken = last->target == OPT_NO_TARGET ? OPT_NO_TARGET : layout.blockOf[last->target];
+      if (is_plain_jump(last)) {
+        block->exit = block->taken == OPT_NO_TARGET || block->taken == layout.count ? OPT_EXIT_STOP
+                                                                                     : OPT_EXIT_JUMP;
+      } else if (last->instruction->opcode == 0x05) {
+        block->exit = OPT_EXIT_BRANCH;
+      } else {
+        block->exit = ends_flow(last) ? OPT_EXIT_STOP : OPT_EXIT_FALL;
+      }
+    }
+    apply_profile(program, &layout, profile);
+    for (size_t b = 0; b < layout.count; b++) {
+      order[b] = heat_key(layout.blocks[b].count, (uint32_t)b);
+      profiled = profiled || layout.blocks[b].count > 0;
+    }
+    qsort(order, layout.count, sizeof(uint64_t), compare_heat);
+  }
+
+  if (ok && profiled && chain_blocks(&layout, order)) {
+    ok = place_chains(program, &layout, order, stats);
+  }
+  free(layout.blocks);
+  free(layout.blockOf);
+  free(order);
+  return ok;
+}
+
+// Turn every PC-relative operand into an item index. Returns the line of a
+// literal offset that lands between instructions, or 0.
+static uint32_t resolve_targets(OptProgram *program, const SymbolTable *labels, uint32_t origin,
+                                uint32_t end) {
+  for (size_t i = 0; i < program->count; i++) {
+    OptItem *item = &program->items[i];
+    if (!is_pc_relative(item->instruction)) {
+      continue;
+    }
+    if (item->symbolLength > 0) {
+      Symbol *label = symbol_find(labels, item->symbol, item->symbolLength);
+      if (label != NULL) {
+        item->target = label->value;
+        item->symbol = NULL;
+        item->symbolLength = 0;
+      }
+      continue;
+    }
+
+    // The VM adds the low 16 bits of the immediate, signed, to next_pc
+    uint16_t offset = item->instruction->opcode == 0x05
+                          ? (uint16_t)(item->value >> 16)
+                          : (uint16_t)(((item->value >> 12) & 0xFFF) | ((item->value >> 24) & 0xF) << 12);
+    uint32_t address = (uint16_t)(item->address + item_bytes(item) + (int16_t)offset);
+    item->literal = true;
+    item->offset = offset;
+    if (address == end) {
+      item->target = (uint32_t)program->count;
+      continue;
+    }
+    size_t low = 0, high = program->count;
+    while (low < high) {
+      size_t mid = (low + high) / 2;
+      if (program->items[mid].address < address) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    if (address < origin || low == program->count || program->items[low].address != address) {
+      return item->line;
+    }
+    item->target = (uint32_t)low;
+  }
+  return 0;
+}
+
+static bool add_definition(OptProgram *program, const char *name, size_t length, SymbolKind kind,
+                           const char *valueStr, uint32_t line) {
+  if (!asm_grow((void **)&program->definitions, &program->definitionCapacity,
+                program->definitionCount, sizeof(OptDefinition), 64)) {
+    return false;
+  }
+  OptDefinition *definition = &program->definitions[program->definitionCount++];
+  definition->name = name;
+  definition->length = (uint16_t)(length < 0xFFFF ? length : 0xFFFF);
+  definition->kind = kind;
+  definition->item = (uint32_t)program->count;
+  definition->valueStr = valueStr;
+  definition->line = line;
+  return true;
+}
+
+static void parse_program(OptProgram *program, const char *source, size_t length, uint32_t origin,
+                          AsmResult *result) {
+  AsmLine parsed;
+  uint32_t line = 0;
+  uint32_t pc = origin;
+  const char *next = source;
+  const char *end = source + length;
+
+  while (next < end) {
+    const char *lineStart = next;
+    const char *lineEnd = (const char *)memchr(next, '\n', end - next);
+    if (lineEnd == NULL) {
+      lineEnd = end;
+      program->tail = (char *)malloc(lineEnd - lineStart + 1);
+      if (program->tail == NULL) {
+        asm_error(result, line + 1, "Out of memory");
+        return;
+      }
+      memcpy(program->tail, lineStart, lineEnd - lineStart);
+      program->tail[lineEnd - lineStart] = '\0';
+      lineStart = program->tail;
+    }
+    next += (lineEnd - next) + 1;
+    line++;
+
+    assemble_line(lineStart, &parsed);
+    for (uint8_t i = 0; i < parsed.labelCount; i++) {
+      if (!add_definition(program, lineStart + parsed.labelOffset[i], parsed.labelLength[i],
+                          SYMBOL_LABEL, NULL, line)) {
+        asm_error(result, line, "Out of memory");
+        return;
+      }
+    }
+    if (parsed.hasError) {
+      asm_error(result, line, "%s", parsed.message);
+    }
+    if (parsed.kind == ASM_LINE_EQU &&
+        !add_definition(program, lineStart + parsed.symbolOffset, parsed.symbolLength,
+                        SYMBOL_CONSTANT, lineStart + parsed.valueOffset, line)) {
+      asm_error(result, line, "Out of memory");
+      return;
+    }
+    if (parsed.kind != ASM_LINE_INSTRUCTION) {
+      continue;
+    }
+
+    if (!asm_grow((void **)&program->items, &program->capacity, program->count, sizeof(OptItem), 256)) {
+      asm_error(result, line, "Out of memory");
+      return;
+    }
+    OptItem *item = &program->items[program->count++];
+    item->instruction = parsed.instruction;
+    item->value = parsed.value;
+    item->symbol = parsed.symbolLength ? lineStart + parsed.symbolOffset : NULL;
+    item->symbolLength = parsed.symbolLength;
+    item->target = OPT_NO_TARGET;
+    item->literal = false;
+    item->offset = 0;
+    item->address = pc;
+    item->line = line;
+    pc += parsed.instruction->length / 8;
+  }
+}
+
+// Assign addresses, define symbols in source order and encode
+static void emit_program(OptProgram *program, uint32_t origin, AsmResult *result) {
+  uint32_t *address = (uint32_t *)malloc((program->count + 1) * sizeof(uint32_t));
+  if (address == NULL) {
+    asm_error(result, 0, "Out of memory");
+    return;
+  }
+  uint32_t pc = origin;
+  for (size_t i = 0; i < program->count; i++) {
+    address[i] = pc;
+    pc += (uint32_t)item_bytes(&program->items[i]);
+  }
+  address[program->count] = pc;
+
+  SymbolTable symbols = {NULL};
+  for (size_t i = 0; i < program->definitionCount; i++) {
+    const OptDefinition *definition = &program->definitions[i];
+    if (definition->kind == SYMBOL_LABEL) {
+      if (!symbol_define(&symbols, definition->name, definition->length, address[definition->item],
+                         SYMBOL_LABEL, definition->line)) {
+        asm_error(result, definition->line, "Duplicate or invalid label '%.*s'",
+                  (int)definition->length, definition->name);
+      }
+      continue;
+    }
+    uint32_t value = 0;
+    if (!asm_equ_value(&symbols, definition->valueStr, &value) ||
+        !symbol_define(&symbols, definition->name, definition->length, value, SYMBOL_CONSTANT,
+                       definition->line)) {
+      asm_error(result, definition->line, "Invalid .equ");
+    }
+  }
+
+  for (size_t i = 0; i < program->count && result->ok; i++) {
+    const OptItem *item = &program->items[i];
+    if (item->instruction == NULL) {
+      continue;
+    }
+    uint32_t value = item->value;
+    uint32_t next_pc = address[i] + item->instruction->length / 8;
+    if (item->target != OPT_NO_TARGET) {
+      Symbol target;
+      target.kind = SYMBOL_LABEL;
+      target.value = address[item->target];
+      // Literal offsets that still hold keep their original encoding
+      if (!item->literal || (uint16_t)(target.value - next_pc) != item->offset) {
+        value = asm_resolve_immediate(item->instruction, value, &target, next_pc);
+      }
+    } else if (item->symbolLength > 0) {
+      Symbol *symbol = symbol_find(&symbols, item->symbol, item->symbolLength);
+      if (symbol == NULL) {
+        asm_error(result, item->line, "Undefined symbol '%.*s'", (int)item->symbolLength, item->symbol);
+        break;
+      }
+      value = asm_resolve_immediate(item->instruction, value, symbol, next_pc);
+    }
+    if (!rom_image_append(&result->image, pack_bytes(item->instruction, value))) {
+      asm_error(result, item->line, "Out of memory");
+    }
+  }
+
+  symbol_table_free(&symbols);
+  free(address);
+}
+
+bool asm_profile_parse(const char *text, size_t length, AsmProfile *profile) {
+  const char *next = text;
+  const char *end = text + length;
+  while (next < end) {
+    const char *lineEnd = (const char *)memchr(next, '\n', end - next);
+    if (lineEnd == NULL) {
+      lineEnd = end;
+    }
+    const char *p = next;
+    next = lineEnd + 1;
+    while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) {
+      p++;
+    }
+    if (p == lineEnd || *p == ';' || *p == '#') {
+      continue;
+    }
+
+    AsmProfileEntry entry = {};
+    char *stop = NULL;
+    if (is_symbol_start(*p)) {
+      entry.label = p;
+      while (p < lineEnd && is_symbol_char(*p)) {
+        p++;
+      }
+      entry.labelLength = (uint16_t)(p - entry.label);
+    } else {
+      entry.address = (uint32_t)strtoul(p, &stop, 0);
+      if (stop == p) {
+        return false;
+      }
+      p = stop;
+    }
+    while (p < lineEnd && (*p == ' ' || *p == '\t')) {
+      p++;
+    }
+    // strtoul would skip the newline into the next entry
+    if (p == lineEnd || *p < '0' || *p > '9') {
+      return false;
+    }
+    entry.count = (uint32_t)strtoul(p, &stop, 0);
+
+    if (!asm_grow((void **)&profile->entries, &profile->capacity, profile->count,
+                  sizeof(AsmProfileEntry), 256)) {
+      return false;
+    }
+    profile->entries[profile->count++] = entry;
+  }
+  return true;
+}
+
+void asm_profile_free(AsmProfile *profile) {
+  free(profile->entries);
+  profile->entries = NULL;
+  profile->count = profile->capacity = 0;
+}
+
+bool assemble_optimized(const char *source, size_t length, uint32_t origin,
+                        const AsmProfile *profile, AsmResult *result, AsmOptStats *stats) {
+  result->image.size = 0;
+  result->diagnosticCount = 0;
+  result->ok = true;
+  memset(stats, 0, sizeof(*stats));
+
+  OptProgram program = {};
+  parse_program(&program, source, length, origin, result);
+
+  // Label targets are item indices; a duplicate is reported when emitting
+  SymbolTable labels = {NULL};
+  for (size_t i = 0; result->ok && i < program.definitionCount; i++) {
+    const OptDefinition *definition = &program.definitions[i];
+    if (definition->kind == SYMBOL_LABEL) {
+      symbol_define(&labels, definition->name, definition->length, definition->item, SYMBOL_LABEL,
+                    definition->line);
+    }
+  }
+
+  if (result->ok) {
+    uint32_t end = program.count ? program.items[program.count - 1].address +
+                                       (uint32_t)item_bytes(&program.items[program.count - 1])
+                                 : origin;
+    stats->skippedLine = resolve_targets(&program, &labels, origin, end);
+    program.targeted = (bool *)calloc(program.count + 1, sizeof(bool));
+    if (program.targeted == NULL) {
+      asm_error(result, 0, "Out of memory");
+    }
+  }
+
+  if (result->ok && stats->skippedLine == 0) {
+    bool changed = true;
+    while (changed) {
+      mark_targets(&program);
+      changed = remove_noops(&program, stats);
+      changed = fold_pairs(&program, stats) || changed;
+      changed = thread_jumps(&program, stats) || changed;
+    }
+    if (profile != NULL) {
+      // Jumps that now land on the next block go away
+      if (layout_blocks(&program, profile, stats)) {
+        remove_noops(&program, stats);
+      } else {
+        asm_error(result, 0, "Out of memory");
+      }
+    }
+    shorten(&program, stats);
+  }
+
+  if (result->ok) {
+    emit_program(&program, origin, result);
+  }
+
+  symbol_table_free(&labels);
+  free(program.items);
+  free(program.definitions);
+  free(program.targeted);
+  free(program.tail);
+  return result->ok;
+}
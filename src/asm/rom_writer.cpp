@@ -1,5 +1,12 @@
 #include "config.h"
 #include "rom_writer.h"
+#include "rom_container.h"
+#include "cfg.h"
+#include "lz.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 BytePack pack_bytes(Instruction* instruction, uint32_t result) {
     BytePack pack = {0};
@@ -12,13 +19,112 @@ BytePack pack_bytes(Instruction* instruction, uint32_t result) {
     return pack;
 }
 
-void write_to_file(FILE* romFile, BytePack pack){
+bool rom_image_append(RomImage* image, BytePack pack){
+    if (image->size + pack.count > image->capacity) {
+        size_t capacity = image->capacity ? image->capacity * 2 : 4096;
+        uint8_t* bytes = (uint8_t*)realloc(image->bytes, capacity);
+        if (bytes == NULL) {
+            return false;
+        }
+        image->bytes = bytes;
+        image->capacity = capacity;
+    }
+
 #ifdef DEBUG
     for(int i = 0; i < pack.count; i++){
-        printf("Packing byte %d: ", i);
-        print_binary8(pack.bytes[i]);
+        log_write(LOG_TRACE, "Packing byte %d: Dec: %u\nHex: 0x%02X\nBin: %s", i,
+                  pack.bytes[i], pack.bytes[i], log_binary(pack.bytes[i], 8));
     }
 #endif
 
-    fwrite(pack.bytes,1,pack.count,romFile);
+    memcpy(image->bytes + image->size, pack.bytes, pack.count);
+    image->size += pack.count;
+    return true;
+}
+
+static bool write_all(int fd, const uint8_t* bytes, size_t size){
+    size_t written = 0;
+    while (written < size) {
+        ssize_t n = write(fd, bytes + written, size - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        written += (size_t)n;
+    }
+    return true;
+}
+
+bool rom_image_write(const RomImage* image, int fd){
+    return write_all(fd, image->bytes, image->size);
+}
+
+static void put_u16(uint8_t* out, uint16_t value){
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+static void put_u32(uint8_t* out, uint32_t value){
+    put_u16(out, value & 0xFFFF);
+    put_u16(out + 2, value >> 16);
+}
+
+bool rom_container_write(const RomSectionImage* sections, size_t count, uint16_t entry, bool compress, int fd){
+    size_t tableEnd = ROM_HEADER_SIZE + count * ROM_SECTION_SIZE;
+    size_t capacity = tableEnd;
+    for (size_t i = 0; i < count; i++) {
+        capacity += compress ? lz_compress_bound(sections[i].image->size) : sections[i].image->size;
+    }
+    uint8_t* data = (uint8_t*)calloc(capacity, 1);
+    if (data == NULL) {
+        return false;
+    }
+
+    memcpy(data, ROM_MAGIC, 4);
+    data[4] = ROM_VERSION;
+    put_u16(data + 6, (uint16_t)count);
+    put_u16(data + 8, entry);
+
+    size_t size = tableEnd;
+    for (size_t i = 0; i < count; i++) {
+        const RomImage* image = sections[i].image;
+        uint16_t flags = sections[i].bank ? ROM_SECTION_BANKED | (uint16_t)(sections[i].bank << 8) : 0;
+
+        // Compressed only when it saves space, so a section never grows
+        uint8_t* payload = data + size;
+        size_t fileSize = compress ? lz_compress(image->bytes, image->size, payload) : image->size;
+        if (compress && fileSize < image->size) {
+            flags |= ROM_SECTION_LZ;
+        } else {
+            fileSize = image->size;
+            if (image->size > 0) {
+                memcpy(payload, image->bytes, image->size);
+            }
+        }
+
+        uint8_t* section = data + ROM_HEADER_SIZE + i * ROM_SECTION_SIZE;
+        put_u16(section, sections[i].address);
+        put_u16(section + 2, flags);
+        put_u32(section + 4, (uint32_t)image->size);
+        put_u32(section + 8, (uint32_t)size);
+        put_u32(section + 12, (uint32_t)fileSize);
+        size += fileSize;
+    }
+
+    uint64_t checksum = cfg_image_hash(data + ROM_HEADER_SIZE, size - ROM_HEADER_SIZE);
+    put_u32(data + 16, (uint32_t)checksum);
+    put_u32(data + 20, (uint32_t)(checksum >> 32));
+
+    bool ok = write_all(fd, data, size);
+    free(data);
+    return ok;
+}
+
+void rom_image_free(RomImage* image){
+    free(image->bytes);
+    image->bytes = NULL;
+    image->size = 0;
+    image->capacity = 0;
 }
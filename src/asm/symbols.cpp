@@ -0,0 +1,61 @@
+#include "symbols.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool symbol_define(SymbolTable *table, const char *name, size_t length,
+                   uint32_t value, SymbolKind kind, uint32_t line) {
+  if (length == 0 || length >= SYMBOL_NAME_MAX) {
+    return false;
+  }
+  if (symbol_find(table, name, length) != NULL) {
+    return false;
+  }
+
+  Symbol *symbol = (Symbol *)calloc(1, sizeof(Symbol));
+  if (symbol == NULL) {
+    return false;
+  }
+
+  memcpy(symbol->name, name, length);
+  symbol->name[length] = '\0';
+  symbol->value = value;
+  symbol->kind = kind;
+  symbol->line = line;
+  HASH_ADD(hh, table->head, name[0], length, symbol);
+  return true;
+}
+
+Symbol *symbol_find(const SymbolTable *table, const char *name, size_t length) {
+  Symbol *symbol = NULL;
+  HASH_FIND(hh, table->head, name, length, symbol);
+  return symbol;
+}
+
+void symbol_table_free(SymbolTable *table) {
+  Symbol *symbol, *tmp;
+  HASH_ITER(hh, table->head, symbol, tmp) {
+    HASH_DEL(table->head, symbol);
+    free(symbol);
+  }
+}
+
+bool is_symbol_start(char c) {
+  return isalpha((unsigned char)c) || c == '_' || c == '.';
+}
+
+bool is_symbol_char(char c) {
+  return isalnum((unsigned char)c) || c == '_' || c == '.';
+}
+
+bool is_register_name(const char *name, size_t length) {
+  if (length < 2 || length > 3 || (name[0] != 'r' && name[0] != 'R')) {
+    return false;
+  }
+  for (size_t i = 1; i < length; i++) {
+    if (!isdigit((unsigned char)name[i])) {
+      return false;
+    }
+  }
+  return true;
+}
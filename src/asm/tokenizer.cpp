@@ -0,0 +1,159 @@
+#include "tokenizer.h"
+#include "symbols.h"
+
+static bool is_blank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+static bool is_line_end(char c) {
+  return c == '\0' || c == '\n' || c == '\r' || c == ';';
+}
+
+static int digit_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return 99;
+}
+
+// Numbers wrap like strtoul did ("-4" is 0xFFFFFFFC) but must fit in 32 bits
+static bool lex_number(const char *cursor, Token *token) {
+  const char *p = cursor;
+  bool negative = false;
+  if (*p == '-' || *p == '+') {
+    negative = *p == '-';
+    p++;
+  }
+
+  int base = 10;
+  if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+    base = 16;
+    p += 2;
+  } else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+    base = 2;
+    p += 2;
+  } else if (p[0] == '0') {
+    base = 8;
+  }
+
+  const char *digits = p;
+  uint64_t value = 0;
+  while (is_symbol_char(*p)) {
+    int digit = digit_value(*p);
+    if (digit >= base) {
+      return false;
+    }
+    value = value * base + digit;
+    if (value > 0xFFFFFFFFu) {
+      return false;
+    }
+    p++;
+  }
+  if (p == digits) {
+    return false;
+  }
+
+  token->kind = TOKEN_IMMEDIATE;
+  token->value = negative ? (uint32_t)(0u - (uint32_t)value) : (uint32_t)value;
+  token->length = (uint16_t)(p - cursor);
+  return true;
+}
+
+static bool lex_operand(const char *cursor, Token *token) {
+  token->start = cursor;
+  token->value = 0;
+
+  if (is_symbol_start(*cursor)) {
+    size_t length = 1;
+    while (is_symbol_char(cursor[length])) {
+      length++;
+    }
+    token->length = (uint16_t)length;
+
+    if (is_register_name(cursor, length)) {
+      uint32_t reg = cursor[1] - '0';
+      if (length == 3) {
+        reg = reg * 10 + (cursor[2] - '0');
+      }
+      if (reg > 15) {
+        return false;
+      }
+      token->kind = TOKEN_REGISTER;
+      token->value = reg;
+    } else {
+      token->kind = TOKEN_SYMBOL;
+    }
+    return true;
+  }
+
+  if ((*cursor >= '0' && *cursor <= '9') || *cursor == '-' || *cursor == '+') {
+    return lex_number(cursor, token);
+  }
+  return false;
+}
+
+bool tokenize_line(const char *line, TokenizedLine *out) {
+  const char *cursor = line;
+  out->count = 0;
+  out->error = NULL;
+
+  while (is_blank(*cursor)) {
+    cursor++;
+  }
+
+  out->mnemonic.start = cursor;
+  out->mnemonic.kind = TOKEN_SYMBOL;
+  out->mnemonic.value = 0;
+  while (!is_line_end(*cursor) && !is_blank(*cursor)) {
+    cursor++;
+  }
+  out->mnemonic.length = (uint16_t)(cursor - out->mnemonic.start);
+
+  while (is_blank(*cursor)) {
+    cursor++;
+  }
+  if (out->mnemonic.length == 0 || is_line_end(*cursor)) {
+    return true;
+  }
+
+  // Operands: operand (',' operand)*
+  for (;;) {
+    if (out->count == ASM_MAX_OPERANDS ||
+        !lex_operand(cursor, &out->operands[out->count])) {
+      out->error = cursor;
+      return false;
+    }
+    cursor += out->operands[out->count].length;
+    out->count++;
+
+    while (is_blank(*cursor)) {
+      cursor++;
+    }
+    if (is_line_end(*cursor)) {
+      return true;
+    }
+    if (*cursor != ',') {
+      out->error = cursor;
+      return false;
+    }
+    cursor++;
+    while (is_blank(*cursor)) {
+      cursor++;
+    }
+  }
+}
+
+bool tokens_match(const TokenizedLine *line, const char *pattern) {
+  uint8_t i = 0;
+  for (; pattern[i] != '\0'; i++) {
+    if (i >= line->count) {
+      return false;
+    }
+    uint8_t kind = line->operands[i].kind;
+    if ((pattern[i] == 'r' && kind != TOKEN_REGISTER) ||
+        (pattern[i] == 'i' && kind != TOKEN_IMMEDIATE)) {
+      return false;
+    }
+  }
+  return i == line->count;
+}
@@ -0,0 +1,417 @@
+#include "config.h"
+#include "bench_main.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+// Synthetic workloads, each assembled into PROGRAM_ROM and run to HALT.
+// One complete run of a workload counts as one frame; the median of the
+// runs is reported. The regression gate compares each workload's cost
+// relative to a native calibration loop timed just before it, which
+// cancels clock speed and machine-wide load, and only against a baseline
+// written on the same host (CPU, core count and compiler); any other
+// baseline is skipped with a warning, so each machine records its own
+// with --write-baseline.
+typedef struct
+{
+    const char *name;
+    const char *path;
+} BenchWorkload;
+
+static const BenchWorkload workloads[] = {
+    {"alu_loop", "roms/bench/alu_loop.asm"},
+    {"branch_heavy", "roms/bench/branch_heavy.asm"},
+    {"load_store", "roms/bench/load_store.asm"},
+    {"char_screen", "roms/bench/char_screen.asm"},
+    {"call_heavy", "roms/bench/call_heavy.asm"},
+};
+
+#define WORKLOAD_COUNT (sizeof(workloads) / sizeof(workloads[0]))
+
+// Dispatch engine under test; only the switch interpreter exists today
+#define BENCH_ENGINE "switch"
+
+#define BENCH_MAX_STEPS 50000000
+
+#define BENCH_CALIBRATION_ITERATIONS 5000000
+#define BENCH_CALIBRATION_RUNS 5
+#define BENCH_HOST_SIZE 256
+
+typedef struct
+{
+    const char *name;
+    uint64_t instructions; // per run
+    int runs;
+    double seconds;        // median run
+    double instructions_per_sec;
+    double ns_per_instruction;
+    double frames_per_sec;
+    double calibration_ns; // per calibration loop iteration
+    double relative;       // ns_per_instruction / calibration_ns, what the gate compares
+} BenchResult;
+
+static BasicVm bench_vm;
+static uint8_t bench_image[PROGRAM_SIZE];
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double left = *(const double *)a, right = *(const double *)b;
+    return left < right ? -1 : left > right;
+}
+
+static double median(double *values, int count)
+{
+    qsort(values, count, sizeof(double), compare_doubles);
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+// CPU model, core count and compiler: baselines only hold on the host that wrote them
+static void bench_host(char *host, size_t size)
+{
+    char cpu[128] = "unknown cpu";
+    FILE *fp = fopen("/proc/cpuinfo", "r");
+    if (fp)
+    {
+        char line[256];
+        while (fgets(line, sizeof(line), fp))
+        {
+            const char *colon = strchr(line, ':');
+            if (strncmp(line, "model name", 10) == 0 && colon)
+            {
+                snprintf(cpu, sizeof(cpu), "%.*s", (int)strcspn(colon + 2, "\n"), colon + 2);
+                break;
+            }
+        }
+        fclose(fp);
+    }
+
+    struct utsname uts;
+    snprintf(host, size, "%s, %s, %ld cpus, %s", cpu, uname(&uts) == 0 ? uts.machine : "unknown",
+             sysconf(_SC_NPROCESSORS_ONLN), __VERSION__);
+    for (char *c = host; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            *c = '\'';
+        }
+    }
+}
+
+// Median ns per iteration of a dependent multiply-add chain, a fixed amount
+// of native work to measure the workloads against
+static double bench_calibrate()
+{
+    double times[BENCH_CALIBRATION_RUNS];
+    for (int run = 0; run < BENCH_CALIBRATION_RUNS; run++)
+    {
+        uint32_t x = 1;
+        double start = now_seconds();
+        for (int i = 0; i < BENCH_CALIBRATION_ITERATIONS; i++)
+        {
+            x = x * 1664525u + 1013904223u;
+            __asm__ volatile("" : "+r"(x)); // keep the chain from being folded
+        }
+        times[run] = (now_seconds() - start) * 1e9 / BENCH_CALIBRATION_ITERATIONS;
+    }
+    return median(times, BENCH_CALIBRATION_RUNS);
+}
+
+// Assemble a workload into bench_image with the same library as asm_main
+static long bench_assemble(const char *path)
+{
+    AsmSource source;
+    if (!asm_source_open(path, &source))
+    {
+        fprintf(stderr, "Error opening workload %s\n", path);
+        return -1;
+    }
+
+    AsmResult result = {};
+    long size = -1;
+    if (!assemble(source.data, source.size, PROGRAM_ROM, &result))
+    {
+        fprintf(stderr, "Error assembling %s:\n", path);
+        asm_print_diagnostics(&result, stderr);
+    }
+    else if (result.image.size > PROGRAM_SIZE)
+    {
+        fprintf(stderr, "Error: workload %s exceeds program ROM\n", path);
+    }
+    else
+    {
+        memcpy(bench_image, result.image.bytes, result.image.size);
+        size = (long)result.image.size;
+    }
+
+    asm_result_free(&result);
+    asm_source_close(&source);
+    return size;
+}
+
+// Run the loaded image to HALT, returning the number of executed instructions
+static uint64_t bench_execute(BasicVm *vm)
+{
+    uint64_t steps = 0;
+    while (steps < BENCH_MAX_STEPS)
+    {
+        DecodedInstruction dec = vm_step(vm);
+        steps++;
+        if (dec.isHalt)
+        {
+            break;
+        }
+        if (dec.opcode == 0)
+        {
+            fprintf(stderr, "VM error at PC=0x%04X\n", vm->program_counter);
+            return 0;
+        }
+    }
+    return steps;
+}
+
+static bool bench_workload(const BenchWorkload *workload, int runs, BenchResult *result)
+{
+    long size = bench_assemble(workload->path);
+    if (size < 0)
+    {
+        return false;
+    }
+
+    memset(result, 0, sizeof(*result));
+    result->name = workload->name;
+    result->runs = runs;
+    result->calibration_ns = bench_calibrate();
+
+    double *times = (double *)malloc(runs * sizeof(double));
+    if (!times)
+    {
+        return false;
+    }
+
+    for (int run = 0; run < runs; run++)
+    {
+        vm_release(&bench_vm);
+        vm_init(&bench_vm);
+        memcpy(bench_vm.memory + PROGRAM_ROM, bench_image, size);
+
+        double start = now_seconds();
+        uint64_t steps = bench_execute(&bench_vm);
+        double elapsed = now_seconds() - start;
+
+        if (steps == 0)
+        {
+            free(times);
+            return false;
+        }
+        times[run] = elapsed;
+        result->instructions = steps;
+    }
+
+    result->seconds = median(times, runs);
+    free(times);
+    result->instructions_per_sec = result->instructions / result->seconds;
+    result->ns_per_instruction = result->seconds * 1e9 / result->instructions;
+    result->frames_per_sec = 1.0 / result->seconds;
+    result->relative = result->ns_per_instruction / result->calibration_ns;
+    return true;
+}
+
+static void bench_write_json(FILE *out, const char *host, const BenchResult *results, int count)
+{
+    fprintf(out, "{\n  \"engine\": \"%s\",\n  \"host\": \"%s\",\n  \"workloads\": [\n", BENCH_ENGINE, host);
+    for (int i = 0; i < count; i++)
+    {
+        const BenchResult *r = &results[i];
+        fprintf(out,
+                "    {\"name\": \"%s\", \"instructions\": %llu, \"runs\": %d, "
+                "\"instructions_per_sec\": %.0f, \"ns_per_instruction\": %.3f, "
+                "\"frames_per_sec\": %.2f, \"calibration_ns\": %.3f, \"relative\": %.3f}%s\n",
+                r->name, (unsigned long long)r->instructions, r->runs,
+                r->instructions_per_sec, r->ns_per_instruction, r->frames_per_sec,
+                r->calibration_ns, r->relative, i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+static char *read_text_file(const char *path)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+    {
+        return NULL;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char *text = (char *)malloc(size + 1);
+    if (text)
+    {
+        size_t bytes_read = fread(text, 1, size, fp);
+        text[bytes_read] = '\0';
+    }
+    fclose(fp);
+    return text;
+}
+
+// Find "relative" for a workload in a JSON file written by bench_write_json
+static bool baseline_lookup(const char *json, const char *name, double *relative)
+{
+    char key[64];
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+
+    const char *entry = strstr(json, key);
+    if (!entry)
+    {
+        return false;
+    }
+
+    const char *field = strstr(entry, "\"relative\":");
+    const char *end = strchr(entry, '}');
+    if (!field || (end && field > end))
+    {
+        return false;
+    }
+
+    *relative = strtod(field + strlen("\"relative\":"), NULL);
+    return true;
+}
+
+// Whether the baseline was written on this host
+static bool baseline_host_matches(const char *json, const char *host)
+{
+    const char *field = strstr(json, "\"host\": \"");
+    if (!field)
+    {
+        return false;
+    }
+    field += strlen("\"host\": \"");
+    size_t length = strlen(host);
+    return strncmp(field, host, length) == 0 && field[length] == '"';
+}
+
+// Returns the number of workloads whose relative cost is above baseline * (1 + tolerance)
+static int bench_check_baseline(const char *path, const char *host, const BenchResult *results, int count,
+                                double tolerance)
+{
+    char *json = read_text_file(path);
+    if (!json)
+    {
+        fprintf(stderr, "No baseline at %s, skipping regression gate\n", path);
+        return 0;
+    }
+    if (!baseline_host_matches(json, host))
+    {
+        fprintf(stderr,
+                "Warning: %s was written on another host, skipping regression gate\n"
+                "  (record one for this host with --write-baseline %s)\n",
+                path, path);
+        free(json);
+        return 0;
+    }
+
+    int regressions = 0;
+    for (int i = 0; i < count; i++)
+    {
+        double baseline = 0;
+        if (!baseline_lookup(json, results[i].name, &baseline) || baseline <= 0)
+        {
+            fprintf(stderr, "%-14s no baseline entry\n", results[i].name);
+            continue;
+        }
+
+        double change = (results[i].relative - baseline) / baseline;
+        bool regressed = change > tolerance;
+        fprintf(stderr, "%-14s %8.3f ns/instr, %7.3fx calibration (baseline %7.3fx, %+6.1f%%)%s\n",
+                results[i].name, results[i].ns_per_instruction, results[i].relative, baseline,
+                change * 100.0, regressed ? "  REGRESSION" : "");
+        if (regressed)
+        {
+            regressions++;
+        }
+    }
+
+    free(json);
+    return regressions;
+}
+
+int bench_main(int argc, char *argv[])
+{
+    const char *baseline_path = "roms/bench/baseline.json";
+    const char *write_path = NULL;
+    double tolerance = 0.20;
+    int runs = 10;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+        {
+            baseline_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--write-baseline") == 0 && i + 1 < argc)
+        {
+            write_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc)
+        {
+            tolerance = atof(argv[++i]) / 100.0;
+        }
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+        {
+            runs = atoi(argv[++i]);
+        }
+        else
+        {
+            fprintf(stderr, "Usage: %s [--baseline file] [--write-baseline file] [--tolerance percent] [--runs n]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (runs < 1)
+    {
+        runs = 1;
+    }
+
+    char host[BENCH_HOST_SIZE];
+    bench_host(host, sizeof(host));
+
+    BenchResult results[WORKLOAD_COUNT];
+    int count = 0;
+    for (size_t i = 0; i < WORKLOAD_COUNT; i++)
+    {
+        if (!bench_workload(&workloads[i], runs, &results[count]))
+        {
+            fprintf(stderr, "Workload %s failed\n", workloads[i].name);
+            return 1;
+        }
+        count++;
+    }
+
+    bench_write_json(stdout, host, results, count);
+
+    if (write_path)
+    {
+        FILE *out = fopen(write_path, "w");
+        if (!out)
+        {
+            perror("Error opening baseline for writing");
+            return 1;
+        }
+        bench_write_json(out, host, results, count);
+        fclose(out);
+        return 0;
+    }
+
+    return bench_check_baseline(baseline_path, host, results, count, tolerance) > 0 ? 1 : 0;
+}
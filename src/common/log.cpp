@@ -0,0 +1,289 @@
+#include "config.h"
+#include "log.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Records per producer thread (power of two)
+#define LOG_QUEUE_SIZE 1024
+
+// Single-producer/single-consumer ring owned by one logging thread. Queues
+// are never freed, since the writer walks the list without a lock; when a
+// thread exits its queue goes back to the pool for the next new thread, so
+// there are only ever as many as threads that logged at the same time.
+typedef struct LogQueue {
+    LogRecord records[LOG_QUEUE_SIZE];
+    uint64_t head;      // written by the owning thread
+    uint64_t tail;      // written by the writer thread after output is flushed
+    uint64_t dropped;
+    int owned;          // 1 while a thread logs into it
+    struct LogQueue *next;
+} LogQueue;
+
+#if defined(VERBOSE)
+int log_level = LOG_TRACE;
+#elif defined(QUIET)
+int log_level = LOG_WARN;
+#else
+int log_level = LOG_DEBUG;
+#endif
+
+static const char *level_names[] = {"error", "warn", "info", "debug", "trace"};
+
+static thread_local LogQueue *thread_queue = NULL;
+static LogQueue *queues = NULL;
+static pthread_once_t queue_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t queue_key;
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static pthread_t writer;
+static int writer_running = 0;
+static FILE *log_out = NULL; // NULL means stdout
+
+void log_set_level(LogLevel level) {
+    log_level = level;
+}
+
+static FILE *log_stream() {
+    FILE *out = __atomic_load_n(&log_out, __ATOMIC_ACQUIRE);
+    return out ? out : stdout;
+}
+
+void log_set_output(FILE *out) {
+    log_flush();
+    __atomic_store_n(&log_out, out, __ATOMIC_RELEASE);
+}
+
+static void log_put_binary(FILE *out, uint32_t value, int bits) {
+    for (int i = bits - 1; i >= 0; i--) {
+        fputc('0' + ((value >> i) & 1), out);
+        if (i == 0) {
+            break;
+        }
+        if (bits > 8 && i % 8 == 0) {
+            fputs(" | ", out);
+        } else if (i % 4 == 0) {
+            fputc(' ', out);
+        }
+    }
+}
+
+// printf-style formatting from captured arguments. Length modifiers in the
+// format are ignored; the captured type decides how the value is printed.
+static void log_format(const LogRecord *record, FILE *out) {
+    if (record->level != LOG_DEBUG && record->level != LOG_TRACE) {
+        fprintf(out, "[%s] ", level_names[record->level]);
+    }
+
+    int argi = 0;
+    for (const char *p = record->fmt; *p;) {
+        if (*p != '%') {
+            fputc(*p++, out);
+            continue;
+        }
+        if (p[1] == '%') {
+            fputc('%', out);
+            p += 2;
+            continue;
+        }
+
+        char spec[32];
+        size_t n = 0;
+        spec[n++] = *p++;
+        while (*p && strchr("-+ #0123456789.", *p) && n < sizeof(spec) - 4) {
+            spec[n++] = *p++;
+        }
+        while (*p && strchr("hlLqjzt", *p)) {
+            p++;
+        }
+        char conv = *p;
+        if (!conv || argi >= record->argc) {
+            break;
+        }
+        p++;
+
+        const LogArg *arg = &record->args[argi++];
+        switch (arg->type) {
+            case LOG_ARG_INT:
+            case LOG_ARG_UINT:
+                if (conv == 'c') {
+                    fputc((int)arg->i, out);
+                    break;
+                }
+                if (!strchr("diouxX", conv)) {
+                    conv = arg->type == LOG_ARG_INT ? 'd' : 'u';
+                }
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = conv;
+                spec[n] = '\0';
+                if (arg->type == LOG_ARG_INT) {
+                    fprintf(out, spec, (long long)arg->i);
+                } else {
+                    fprintf(out, spec, (unsigned long long)arg->u);
+                }
+                break;
+            case LOG_ARG_DOUBLE:
+                spec[n++] = strchr("fFeEgGaA", conv) ? conv : 'f';
+                spec[n] = '\0';
+                fprintf(out, spec, arg->d);
+                break;
+            case LOG_ARG_STR:
+                spec[n++] = 's';
+                spec[n] = '\0';
+                fprintf(out, spec, arg->s ? arg->s : "(null)");
+                break;
+            case LOG_ARG_TEXT:
+                spec[n++] = 's';
+                spec[n] = '\0';
+                fprintf(out, spec, record->text);
+                break;
+            case LOG_ARG_BINARY:
+                log_put_binary(out, (uint32_t)arg->u, arg->bits);
+                break;
+        }
+    }
+
+    fputc('\n', out);
+}
+
+static void *log_writer_thread(void *arg) {
+    (void)arg;
+    struct timespec idle = {0, 1000000};
+
+    for (;;) {
+        bool wrote = false;
+        for (LogQueue *queue = __atomic_load_n(&queues, __ATOMIC_ACQUIRE); queue; queue = queue->next) {
+            uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+            uint64_t tail = queue->tail;
+            if (head == tail) {
+                continue;
+            }
+            FILE *out = log_stream();
+            for (; tail != head; tail++) {
+                log_format(&queue->records[tail & (LOG_QUEUE_SIZE - 1)], out);
+            }
+            fflush(out);
+            __atomic_store_n(&queue->tail, tail, __ATOMIC_RELEASE);
+            wrote = true;
+        }
+
+        if (!wrote) {
+            if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+                break;
+            }
+            nanosleep(&idle, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void log_start_writer() {
+    writer_running = 1;
+    if (pthread_create(&writer, NULL, log_writer_thread, NULL) != 0) {
+        writer_running = 0;
+        return;
+    }
+    atexit(log_shutdown);
+}
+
+// Runs as a logging thread exits; records still queued are written as usual
+static void log_release_queue(void *arg) {
+    LogQueue *queue = (LogQueue *)arg;
+    thread_queue = NULL;
+    __atomic_store_n(&queue->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void log_create_queue_key() {
+    pthread_key_create(&queue_key, log_release_queue);
+}
+
+static LogQueue *log_thread_queue() {
+    if (thread_queue) {
+        return thread_queue;
+    }
+    pthread_once(&queue_key_once, log_create_queue_key);
+
+    // Reuse the queue of a thread that has exited
+    LogQueue *queue = __atomic_load_n(&queues, __ATOMIC_ACQUIRE);
+    for (; queue; queue = queue->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&queue->owned, &expected, 1, false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (!queue) {
+        queue = (LogQueue *)calloc(1, sizeof(LogQueue));
+        if (!queue) {
+            return NULL;
+        }
+        queue->owned = 1;
+
+        // Lock-free push onto the list the writer walks
+        queue->next = __atomic_load_n(&queues, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&queues, &queue->next, queue, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+        }
+    }
+    pthread_setspecific(queue_key, queue);
+    thread_queue = queue;
+    return queue;
+}
+
+void log_submit(const LogRecord *record) {
+    pthread_once(&writer_once, log_start_writer);
+
+    LogQueue *queue = log_thread_queue();
+    if (!queue || !__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        // No writer available: format synchronously so nothing is lost
+        log_format(record, log_stream());
+        return;
+    }
+
+    uint64_t head = queue->head;
+    while (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) >= LOG_QUEUE_SIZE) {
+        if (record->level > LOG_WARN) {
+            queue->dropped++;
+            return;
+        }
+        sched_yield(); // errors and warnings are never dropped
+    }
+
+    queue->records[head & (LOG_QUEUE_SIZE - 1)] = *record;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void log_flush() {
+    if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        fflush(log_stream());
+        return;
+    }
+
+    for (LogQueue *queue = __atomic_load_n(&queues, __ATOMIC_ACQUIRE); queue; queue = queue->next) {
+        while (__atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+            sched_yield();
+        }
+    }
+}
+
+void log_shutdown() {
+    if (!__atomic_load_n(&writer_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    log_flush();
+    __atomic_store_n(&writer_running, 0, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+
+    uint64_t dropped = 0;
+    for (LogQueue *queue = queues; queue; queue = queue->next) {
+        dropped += queue->dropped;
+    }
+    if (dropped) {
+        fprintf(log_stream(), "[warn] %llu log records dropped (queue full)\n", (unsigned long long)dropped);
+    }
+    fflush(log_stream());
+}
@@ -0,0 +1,129 @@
+#include "lz.h"
+#include <string.h>
+
+// Positions of recent 4-byte strings, by hash
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 0xFFFF
+
+static uint32_t hash4(const uint8_t *p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// The part of a length above 15 in a nibble, as 255-bytes and a remainder
+static uint8_t *put_length(uint8_t *out, size_t length) {
+    for (length -= 15; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+static uint8_t *put_sequence(uint8_t *out, const uint8_t *literals, size_t literalCount,
+                             size_t matchLength, size_t offset) {
+    uint8_t *token = out++;
+    size_t matchCode = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+    *token = (uint8_t)(((literalCount < 15 ? literalCount : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+    if (literalCount >= 15) {
+        out = put_length(out, literalCount);
+    }
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+    if (matchLength == 0) {
+        return out;
+    }
+
+    out[0] = offset & 0xFF;
+    out[1] = offset >> 8;
+    out += 2;
+    if (matchCode >= 15) {
+        out = put_length(out, matchCode);
+    }
+    return out;
+}
+
+size_t lz_compress_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+size_t lz_compress(const uint8_t *in, size_t size, uint8_t *out) {
+    int32_t table[1 << LZ_HASH_BITS];
+    memset(table, 0xFF, sizeof(table));
+
+    uint8_t *start = out;
+    size_t anchor = 0; // first literal not yet written
+    size_t pos = 0;
+    while (size >= LZ_MIN_MATCH && pos <= size - LZ_MIN_MATCH) {
+        uint32_t h = hash4(in + pos);
+        int32_t candidate = table[h];
+        table[h] = (int32_t)pos;
+        if (candidate < 0 || pos - candidate > LZ_MAX_OFFSET ||
+            memcmp(in + candidate, in + pos, LZ_MIN_MATCH) != 0) {
+            pos++;
+            continue;
+        }
+
+        size_t length = LZ_MIN_MATCH;
+        while (pos + length < size && in[candidate + length] == in[pos + length]) {
+            length++;
+        }
+        out = put_sequence(out, in + anchor, pos - anchor, length, pos - candidate);
+        pos += length;
+        anchor = pos;
+    }
+    out = put_sequence(out, in + anchor, size - anchor, 0, 0);
+    return (size_t)(out - start);
+}
+
+// Add the extension bytes of a nibble that was 15; false if they run off the end
+static bool get_length(const uint8_t **in, const uint8_t *end, size_t *length) {
+    uint8_t byte;
+    do {
+        if (*in == end) {
+            return false;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool lz_decompress(const uint8_t *in, size_t inSize, uint8_t *out, size_t outSize) {
+    const uint8_t *end = in + inSize;
+    size_t pos = 0;
+    while (in < end) {
+        uint8_t token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !get_length(&in, end, &literals)) {
+            return false;
+        }
+        if (literals > (size_t)(end - in) || literals > outSize - pos) {
+            return false;
+        }
+        memcpy(out + pos, in, literals);
+        in += literals;
+        pos += literals;
+        if (in == end) {
+            break; // the last sequence has no match
+        }
+
+        if (end - in < 2) {
+            return false;
+        }
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t length = token & 0x0F;
+        if (length == 15 && !get_length(&in, end, &length)) {
+            return false;
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > pos || length > outSize - pos) {
+            return false;
+        }
+        // Byte by byte: a match closer than its length repeats its own output
+        for (size_t i = 0; i < length; i++, pos++) {
+            out[pos] = out[pos - offset];
+        }
+    }
+    return pos == outSize;
+}
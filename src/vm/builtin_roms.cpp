@@ -0,0 +1,71 @@
+#include "builtin_roms.h"
+#include "asm_constexpr.h"
+#include <string.h>
+
+// Register and branch sanity check: halts with r10 = 0x2A if every check
+// passed, otherwise with r10 = 0xEE and the failing check number in r11
+static constexpr auto selftest_rom = ASM_CONSTEXPR(R"(
+        ADDI r1, r0, 7
+        ADDI r2, r0, 5
+        ADDI r11, r0, 1
+        ADD r3, r1, r2
+        ADDI r4, r0, 12
+        BNE r3, r4, fail
+        ADDI r11, r0, 2
+        SUB r3, r1, r2
+        ADDI r4, r0, 2
+        BNE r3, r4, fail
+        ADDI r11, r0, 3
+        MUL r3, r1, r2
+        ADDI r4, r0, 35
+        BNE r3, r4, fail
+        ADDI r11, r0, 4
+        XOR r3, r1, r2
+        ANDI r3, r3, 0x0F
+        ORI r3, r3, 0x10
+        ADDI r4, r0, 0x12
+        BNE r3, r4, fail
+        ADDI r11, r0, 5          ; counted loop
+        ADDI r5, r0, 10
+        ADDI r6, r0, 0
+loop:   ADDI r6, r6, 3
+        SUBI r5, r5, 1
+        BNE r5, r0, loop
+        ADDI r4, r0, 30
+        BNE r6, r4, fail
+        ADDI r11, r0, 6          ; signed compare: -1 < 1
+        ADDI r7, r0, -1
+        ADDI r8, r0, 1
+        BGE r7, r8, fail
+        BGT r8, r7, pass
+        BEQ r0, r0, fail
+pass:   ADDI r10, r0, 0x2A
+        HALT
+fail:   ADDI r10, r0, 0xEE
+        HALT
+)");
+
+// Spin forever: a placeholder boot ROM for frontends that need one
+static constexpr auto idle_rom = ASM_CONSTEXPR(R"(
+idle:   BEQ r0, r0, idle
+)");
+
+static_assert(idle_rom.size() == 4 && idle_rom[0] == 0x28 && idle_rom[2] == 0xFC,
+              "constexpr assembler disagrees with the instruction table");
+
+const BuiltinRom builtin_roms[] = {
+    {"selftest", "ALU and branch self test (r10 = 0x2A on success)", selftest_rom.data(),
+     selftest_rom.size()},
+    {"idle", "jump to self", idle_rom.data(), idle_rom.size()},
+};
+
+const size_t builtin_rom_count = sizeof(builtin_roms) / sizeof(builtin_roms[0]);
+
+const BuiltinRom *builtin_rom_find(const char *name) {
+  for (size_t i = 0; i < builtin_rom_count; i++) {
+    if (strcmp(builtin_roms[i].name, name) == 0) {
+      return &builtin_roms[i];
+    }
+  }
+  return NULL;
+}
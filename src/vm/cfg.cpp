@@ -0,0 +1,409 @@
+#include "cfg.h"
+#include "disassembler.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CFG_HEADER_SIZE 23
+#define CFG_BLOCK_SIZE  12
+
+// Per-byte recovery state
+#define STATE_SEEN     0x01 // an instruction starts here on a reachable path
+#define STATE_LEADER   0x02
+#define STATE_QUEUED   0x04
+#define STATE_COVERED  0x08 // inside a reachable block
+
+uint64_t cfg_image_hash(const uint8_t *bytes, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+// Where execution can go after a block-ending instruction
+static uint8_t successors_of(const DisasmLine *line, uint16_t successors[2], uint8_t *flags) {
+    uint16_t next = (uint16_t)(line->address + line->length);
+    uint16_t target;
+    if (!disasm_target(line, &target)) {
+        if (line->dec.op == ISA_JALR) {
+            *flags |= CFG_INDIRECT;
+        }
+        return 0;
+    }
+    if (line->dec.op == ISA_JAL) {
+        successors[0] = target;
+        if (line->dec.rd == 0) {
+            return 1;
+        }
+        *flags |= CFG_CALL;
+        successors[1] = next;
+        return 2;
+    }
+
+    // A branch comparing a register with itself always or never goes
+    if (line->dec.rs1 == line->dec.rs2) {
+        bool inclusive = line->dec.op == ISA_BEQ || line->dec.op == ISA_BLE || line->dec.op == ISA_BGE;
+        successors[0] = inclusive ? target : next;
+        return 1;
+    }
+    successors[0] = target;
+    successors[1] = next;
+    return 2;
+}
+
+// One block from bytes[pos], ending after a block end, before a leader or at limit
+static CfgBlock build_block(const uint8_t *bytes, size_t size, uint16_t origin, size_t pos, size_t limit,
+                            const uint8_t *state, uint8_t flags) {
+    CfgBlock block = {0};
+    block.start = (uint16_t)(origin + pos);
+    block.flags = flags;
+
+    DisasmLine line;
+    while (pos < limit && disasm_decode(bytes, size, origin, pos, &line)) {
+        block.instructions++;
+        block.size += line.length;
+        pos += line.length;
+        if (disasm_ends_block(&line)) {
+            block.successorCount = successors_of(&line, block.successors, &block.flags);
+            return block;
+        }
+        if (state[pos] & STATE_LEADER) {
+            break;
+        }
+    }
+
+    // Falls through into the next block
+    block.successors[0] = (uint16_t)(origin + pos);
+    block.successorCount = 1;
+    return block;
+}
+
+static bool add_block(CfgMap *map, size_t *capacity, const CfgBlock *block) {
+    if (map->count == *capacity) {
+        size_t grown = *capacity ? *capacity * 2 : 64;
+        CfgBlock *blocks = (CfgBlock *)realloc(map->blocks, grown * sizeof(CfgBlock));
+        if (!blocks) {
+            return false;
+        }
+        map->blocks = blocks;
+        *capacity = grown;
+    }
+    map->blocks[map->count++] = *block;
+    return true;
+}
+
+static int compare_blocks(const void *a, const void *b) {
+    return (int)((const CfgBlock *)a)->start - (int)((const CfgBlock *)b)->start;
+}
+
+// Index of the block starting exactly at address, or -1
+static long block_index(const CfgMap *map, uint16_t address) {
+    const CfgBlock *block = cfg_find(map, address);
+    return block && block->start == address ? (long)(block - map->blocks) : -1;
+}
+
+// Follow the code from the entry, marking instruction starts and leaders
+static bool discover(const uint8_t *bytes, size_t size, uint16_t origin, uint8_t *state) {
+    uint32_t *work = (uint32_t *)malloc((size + 1) * sizeof(uint32_t));
+    if (!work) {
+        return false;
+    }
+    size_t top = 0;
+    work[top++] = 0;
+    state[0] |= STATE_LEADER | STATE_QUEUED;
+
+    while (top > 0) {
+        size_t pos = work[--top];
+        DisasmLine line;
+        while (pos < size) {
+            if (state[pos] & STATE_SEEN) {
+                // Ran into code already walked: start a block here so blocks stay disjoint
+                state[pos] |= STATE_LEADER;
+                break;
+            }
+            if (!disasm_decode(bytes, size, origin, pos, &line)) {
+                break;
+            }
+            state[pos] |= STATE_SEEN;
+            if (disasm_ends_block(&line)) {
+                uint16_t successors[2];
+                uint8_t flags = 0;
+                uint8_t count = successors_of(&line, successors, &flags);
+                for (uint8_t i = 0; i < count; i++) {
+                    size_t offset = (uint16_t)(successors[i] - origin);
+                    if (offset >= size) {
+                        continue;
+                    }
+                    state[offset] |= STATE_LEADER;
+                    if (!(state[offset] & STATE_QUEUED)) {
+                        state[offset] |= STATE_QUEUED;
+                        work[top++] = (uint32_t)offset;
+                    }
+                }
+                break;
+            }
+            pos += line.length;
+        }
+    }
+
+    free(work);
+    return true;
+}
+
+static bool find_loops(CfgMap *map) {
+    long entry = block_index(map, map->origin);
+    if (entry < 0) {
+        return true;
+    }
+    uint8_t *color = (uint8_t *)calloc(map->count, 1); // 0 new, 1 on the walk, 2 done
+    uint8_t *next = (uint8_t *)calloc(map->count, 1);
+    size_t *stack = (size_t *)malloc(map->count * sizeof(size_t));
+    if (!color || !next || !stack) {
+        free(color);
+        free(next);
+        free(stack);
+        return false;
+    }
+
+    size_t top = 0;
+    stack[top++] = (size_t)entry;
+    color[entry] = 1;
+    while (top > 0) {
+        size_t b = stack[top - 1];
+        if (next[b] == map->blocks[b].successorCount) {
+            color[b] = 2;
+            top--;
+            continue;
+        }
+        long s = block_index(map, map->blocks[b].successors[next[b]++]);
+        if (color[s] == 0) {
+            color[s] = 1;
+            stack[top++] = (size_t)s;
+        } else if (color[s] == 1) {
+            map->blocks[s].flags |= CFG_LOOP_HEADER;
+        }
+    }
+
+    free(color);
+    free(next);
+    free(stack);
+    return true;
+}
+
+bool cfg_recover(const uint8_t *bytes, size_t size, uint16_t origin, CfgMap *map) {
+    memset(map, 0, sizeof(*map));
+    map->origin = origin;
+    map->imageSize = (uint32_t)size;
+    map->imageHash = cfg_image_hash(bytes, size);
+
+    uint8_t *state = (uint8_t *)calloc(size + 1, 1);
+    if (!state || !discover(bytes, size, origin, state)) {
+        free(state);
+        return false;
+    }
+
+    size_t capacity = 0;
+    bool ok = true;
+    for (size_t pos = 0; pos < size && ok; pos++) {
+        if ((state[pos] & (STATE_LEADER | STATE_SEEN)) != (STATE_LEADER | STATE_SEEN)) {
+            continue;
+        }
+        CfgBlock block = build_block(bytes, size, origin, pos, size, state,
+                                     CFG_REACHABLE | (pos == 0 ? CFG_ENTRY : 0));
+        for (size_t i = pos; i < pos + block.size; i++) {
+            state[i] |= STATE_COVERED;
+        }
+        ok = add_block(map, &capacity, &block);
+    }
+
+    // Sweep the gaps into unreachable blocks
+    for (size_t pos = 0; pos < size && ok;) {
+        if (state[pos] & STATE_COVERED) {
+            pos++;
+            continue;
+        }
+        size_t end = pos;
+        while (end < size && !(state[end] & STATE_COVERED)) {
+            end++;
+        }
+        while (pos < end && ok) {
+            CfgBlock block = build_block(bytes, size, origin, pos, end, state, 0);
+            if (block.instructions == 0) {
+                pos++;
+                continue;
+            }
+            ok = add_block(map, &capacity, &block);
+            pos += block.size;
+        }
+    }
+    free(state);
+
+    if (ok) {
+        qsort(map->blocks, map->count, sizeof(CfgBlock), compare_blocks);
+
+        // Keep only successors that are blocks
+        for (size_t i = 0; i < map->count; i++) {
+            CfgBlock *block = &map->blocks[i];
+            uint8_t kept = 0;
+            for (uint8_t s = 0; s < block->successorCount; s++) {
+                if (block_index(map, block->successors[s]) >= 0) {
+                    block->successors[kept++] = block->successors[s];
+                } else {
+                    block->flags |= CFG_EXIT;
+                }
+            }
+            block->successorCount = kept;
+        }
+        ok = find_loops(map);
+    }
+    if (!ok) {
+        cfg_free(map);
+    }
+    return ok;
+}
+
+const CfgBlock *cfg_find(const CfgMap *map, uint16_t pc) {
+    size_t low = 0, high = map->count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (map->blocks[mid].start <= pc) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low == 0) {
+        return NULL;
+    }
+    const CfgBlock *block = &map->blocks[low - 1];
+    return pc - block->start < block->size ? block : NULL;
+}
+
+bool cfg_matches(const CfgMap *map, const uint8_t *bytes, size_t size, uint16_t origin) {
+    return map->origin == origin && map->imageSize == size && map->imageHash == cfg_image_hash(bytes, size);
+}
+
+static void put_u16(uint8_t *out, uint16_t value) {
+    out[0] = value & 0xFF;
+    out[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *out, uint32_t value) {
+    put_u16(out, value & 0xFFFF);
+    put_u16(out + 2, value >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *in) {
+    return in[0] | (in[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    return get_u16(in) | ((uint32_t)get_u16(in + 2) << 16);
+}
+
+bool cfg_write(const CfgMap *map, const char *path) {
+    size_t size = CFG_HEADER_SIZE + map->count * CFG_BLOCK_SIZE;
+    uint8_t *data = (uint8_t *)malloc(size);
+    if (!data) {
+        return false;
+    }
+
+    memcpy(data, CFG_MAGIC, 4);
+    data[4] = CFG_VERSION;
+    put_u16(data + 5, map->origin);
+    put_u32(data + 7, map->imageSize);
+    put_u32(data + 11, (uint32_t)map->imageHash);
+    put_u32(data + 15, (uint32_t)(map->imageHash >> 32));
+    put_u32(data + 19, (uint32_t)map->count);
+    uint8_t *out = data + CFG_HEADER_SIZE;
+    for (size_t i = 0; i < map->count; i++, out += CFG_BLOCK_SIZE) {
+        const CfgBlock *block = &map->blocks[i];
+        put_u16(out, block->start);
+        put_u16(out + 2, block->size);
+        put_u16(out + 4, block->instructions);
+        out[6] = block->flags;
+        out[7] = block->successorCount;
+        put_u16(out + 8, block->successors[0]);
+        put_u16(out + 10, block->successors[1]);
+    }
+
+    FILE *fp = fopen(path, "wb");
+    bool ok = fp && fwrite(data, 1, size, fp) == size;
+    if (fp && fclose(fp) != 0) {
+        ok = false;
+    }
+    free(data);
+    return ok;
+}
+
+bool cfg_read(const char *path, CfgMap *map) {
+    memset(map, 0, sizeof(*map));
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+
+    uint8_t header[CFG_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) || memcmp(header, CFG_MAGIC, 4) != 0 ||
+        header[4] != CFG_VERSION) {
+        fclose(fp);
+        return false;
+    }
+    map->origin = get_u16(header + 5);
+    map->imageSize = get_u32(header + 7);
+    map->imageHash = get_u32(header + 11) | ((uint64_t)get_u32(header + 15) << 32);
+    size_t count = get_u32(header + 19);
+
+    // A map never has more blocks than the address space has bytes
+    uint8_t *data = count <= 0x10000 ? (uint8_t *)malloc(count * CFG_BLOCK_SIZE + 1) : NULL;
+    map->blocks = (CfgBlock *)malloc((count ? count : 1) * sizeof(CfgBlock));
+    bool ok = data && map->blocks && fread(data, 1, count * CFG_BLOCK_SIZE, fp) == count * CFG_BLOCK_SIZE;
+    fclose(fp);
+
+    for (size_t i = 0; ok && i < count; i++) {
+        const uint8_t *in = data + i * CFG_BLOCK_SIZE;
+        CfgBlock *block = &map->blocks[i];
+        block->start = get_u16(in);
+        block->size = get_u16(in + 2);
+        block->instructions = get_u16(in + 4);
+        block->flags = in[6];
+        block->successorCount = in[7];
+        block->successors[0] = get_u16(in + 8);
+        block->successors[1] = get_u16(in + 10);
+        ok = block->successorCount <= 2 && (i == 0 || block->start > map->blocks[i - 1].start);
+    }
+    free(data);
+    map->count = count;
+    if (!ok) {
+        cfg_free(map);
+    }
+    return ok;
+}
+
+void cfg_print(const CfgMap *map, FILE *out) {
+    size_t reachable = 0, loops = 0;
+    for (size_t i = 0; i < map->count; i++) {
+        reachable += (map->blocks[i].flags & CFG_REACHABLE) != 0;
+        loops += (map->blocks[i].flags & CFG_LOOP_HEADER) != 0;
+    }
+    fprintf(out, "; %zu blocks, %zu reachable, %zu loop headers (%u bytes at 0x%04X, hash %016llX)\n",
+            map->count, reachable, loops, map->imageSize, map->origin, (unsigned long long)map->imageHash);
+
+    for (size_t i = 0; i < map->count; i++) {
+        const CfgBlock *block = &map->blocks[i];
+        fprintf(out, "0x%04X-0x%04X %4u ins  %-11s", block->start, block->start + block->size - 1,
+                block->instructions, block->flags & CFG_REACHABLE ? "reachable" : "unreachable");
+        for (uint8_t s = 0; s < block->successorCount; s++) {
+            fprintf(out, " -> 0x%04X", block->successors[s]);
+        }
+        fprintf(out, "%s%s%s%s%s\n", block->flags & CFG_ENTRY ? "  entry" : "",
+                block->flags & CFG_LOOP_HEADER ? "  loop" : "", block->flags & CFG_CALL ? "  call" : "",
+                block->flags & CFG_INDIRECT ? "  indirect" : "", block->flags & CFG_EXIT ? "  exit" : "");
+    }
+}
+
+void cfg_free(CfgMap *map) {
+    free(map->blocks);
+    map->blocks = NULL;
+    map->count = 0;
+}
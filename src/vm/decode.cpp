@@ -1,256 +1,144 @@
 #include "decode.h"
-#include "config.h"
-#include <string.h>
-
-DecodedInstruction vm_decode(uint32_t instruction, Instruction instructionProperties) {
-    DecodedInstruction dec = {0};
-
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-
-    dec.instruction = &instructionProperties;
-    dec.opcode_funct3 = instructionProperties.opcode_funct3;
-
-    // 24 BIT INSTRUCTIONS (ARITHMETIC, LOGIC, SHIFTS)
-    // Note: SLLI/SRLI (opcode_funct3=0x51) are 32-bit, handled in switch below
-    if (dec.opcode_funct3 == 0x08 || dec.opcode_funct3 == 0x40 || dec.opcode_funct3 == 0x50) {
-        // 24-bit R-type instruction
-        return decode_bitwise_rtype(instruction, instructionProperties);
+#include <stdio.h>
+
+#define DECODE_NONE 0xFF
+
+// (first byte, funct4) -> row of instructions[], built from the ISA list
+// at compile time. Formats without a funct4 field claim all 16 slots of
+// their first byte, so two rows that encode alike collide here.
+typedef struct {
+    uint8_t index[256][16];
+    bool collided;
+} DecodeTable;
+
+static constexpr DecodeTable decode_build_table() {
+    DecodeTable table = {};
+    for (int byte0 = 0; byte0 < 256; byte0++) {
+        for (int funct4 = 0; funct4 < 16; funct4++) {
+            table.index[byte0][funct4] = DECODE_NONE;
+        }
     }
-
-    // 32-bit instruction - decode based on opcode
-    switch (dec.opcode) {
-        case 0x01:
-            return decode_arith_rtype(instruction, instructionProperties);
-        case 0x02:
-            return decode_arith_itype(instruction, instructionProperties);
-        case 0x03:
-            return decode_upper_imm(instruction, instructionProperties);
-        case 0x04:
-            return decode_store(instruction, instructionProperties);
-        case 0x05:
-            return decode_branch(instruction, instructionProperties);
-        case 0x06:
-            return decode_jump(instruction, instructionProperties);
-        case 0x07:
-            return decode_load(instruction, instructionProperties);
-        case 0x09:
-            return decode_logic_imm(instruction, instructionProperties);
-        case 0x0A:
-            return decode_shift_imm(instruction, instructionProperties);
-        case 0x0F:
-            return decode_halt(instruction, instructionProperties);
-        default:
-            // Default decode for unknown opcodes
-            dec.funct4 = 0;
-            dec.rd = (instruction >> 8) & 0xF;
-            dec.rs1 = (instruction >> 12) & 0xF;
-            dec.rs2 = (instruction >> 16) & 0xF;
-            dec.imm = (instruction >> 16) & 0xFFFF;
-            break;
+    for (size_t row = 0; row < ISA_COUNT; row++) {
+        const Instruction &ins = instruction_rows[row];
+        for (int funct4 = 0; funct4 < 16; funct4++) {
+            if (FORMAT_HAS_FUNCT4(ins.format) && funct4 != ins.funct4) {
+                continue;
+            }
+            uint8_t &slot = table.index[ins.opcode_funct3][funct4];
+            if (slot != DECODE_NONE) {
+                table.collided = true;
+            }
+            slot = (uint8_t)row;
+        }
     }
-
-    return dec;
+    return table;
 }
 
-// Arithmetic R-type (ADD, SUB, MUL, DIV)
-DecodedInstruction decode_arith_rtype(uint32_t instruction, Instruction ins) {
-    DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-
-    uint8_t byte1 = (instruction >> 8) & 0xFF;
-    uint8_t byte2 = (instruction >> 16) & 0xFF;
-
-    dec.funct4 = byte1 & 0xF;
-    dec.rd = byte1 >> 4;
-    dec.rs1 = byte2 & 0xF;
-    dec.rs2 = byte2 >> 4;
-    dec.imm = 0;
+static constexpr DecodeTable decode_table = decode_build_table();
+static_assert(!decode_table.collided, "two rows of INSTRUCTION_LIST have the same encoding");
+static_assert(ISA_COUNT < DECODE_NONE, "instruction ids must fit the decode table");
 
-    return dec;
+Instruction *decode_lookup(uint8_t byte0, uint8_t byte1) {
+    uint8_t row = decode_table.index[byte0][byte1 & 0xF];
+    return row == DECODE_NONE ? NULL : &instructions[row];
 }
 
-// Arithmetic immediates (ADDI, SUBI, MULI, DIVI)
-DecodedInstruction decode_arith_itype(uint32_t instruction, Instruction ins) {
-    DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-
-    dec.funct4 = 0;
-    dec.rd = (instruction >> 8) & 0xF;
-    dec.rs1 = (instruction >> 12) & 0xF;
-    dec.rs2 = 0;
-    dec.imm = (instruction >> 16) & 0xFFFF;
+// One straight-line decoder per InstructionFormat; fields a format
+// lacks stay zero
 
-    return dec;
+// funct4 rd | rs1 rs2 (ADD, AND, SLL, CHAR)
+static void decode_register(uint32_t word, DecodedInstruction *dec) {
+    dec->funct4 = (word >> 8) & 0xF;
+    dec->rd = (word >> 12) & 0xF;
+    dec->rs1 = (word >> 16) & 0xF;
+    dec->rs2 = (word >> 20) & 0xF;
 }
 
-// Upper immediates (LUI, AUIPC)
-DecodedInstruction decode_upper_imm(uint32_t instruction, Instruction ins) {
-    DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-
-    dec.funct4 = (instruction >> 8) & 0xF;
-    dec.rd = (instruction >> 12) & 0xF;
-    dec.rs1 = 0;
-    dec.rs2 = 0;
-    dec.imm = (instruction >> 16) & 0xFFFF;
-
-    return dec;
+// rd rs1 | imm16 (ADDI, ANDI, LW, JALR)
+static void decode_immediate(uint32_t word, DecodedInstruction *dec) {
+    dec->rd = (word >> 8) & 0xF;
+    dec->rs1 = (word >> 12) & 0xF;
+    dec->imm = (word >> 16) & 0xFFFF;
 }
 
-// Store (SB, SH, SW)
-DecodedInstruction decode_store(uint32_t instruction, Instruction ins) {
-    DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-
-    dec.funct4 = 0;
-    dec.rs1 = (instruction >> 8) & 0xF;
-    dec.rs2 = (instruction >> 12) & 0xF;
-    dec.rd = 0;
-    dec.imm = (instruction >> 16) & 0xFFFF;
-
-    return dec;
+// rs1 rs2 | imm16 (SB, BEQ)
+static void decode_store_branch(uint32_t word, DecodedInstruction *dec) {
+    dec->rs1 = (word >> 8) & 0xF;
+    dec->rs2 = (word >> 12) & 0xF;
+    dec->imm = (word >> 16) & 0xFFFF;
 }
 
-// Branch (BEQ, BNE, BLT, BGT, BLE, BGE)
-DecodedInstruction decode_branch(uint32_t instruction, Instruction ins) {
-    DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-
-    dec.funct4 = 0;
-    dec.rs1 = (instruction >> 8) & 0xF;
-    dec.rs2 = (instruction >> 12) & 0xF;
-    dec.rd = 0;
-    // Note: Immediate bytes are NOT swapped for little-endian (assembler bug)
-    dec.imm = ((instruction >> 16) & 0xFF) | (((instruction >> 24) & 0xFF) << 8);
-
-    return dec;
+// funct4 rd | imm16 (LUI, AUIPC)
+static void decode_upper(uint32_t word, DecodedInstruction *dec) {
+    dec->funct4 = (word >> 8) & 0xF;
+    dec->rd = (word >> 12) & 0xF;
+    dec->imm = (word >> 16) & 0xFFFF;
 }
 
-// Jumps (JAL, JALR)
-DecodedInstruction decode_jump(uint32_t instruction, Instruction ins) {
-    DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-
-    dec.funct4 = 0;
-    dec.rd = (instruction >> 8) & 0xF;
-
-    if (dec.funct3 == 0x02) { // JALR
-        dec.rs1 = (instruction >> 12) & 0xF;
-        dec.imm = (instruction >> 16) & 0xFFFF; // 16-bit
-    } else { // JAL
-        dec.rs1 = 0;
-        // imm is 20 bits: bits 12-23 (12 bits) + bits 24-31 (8 bits)
-        dec.imm = ((instruction >> 12) & 0xFFF) | (((instruction >> 24) & 0xFF) << 12);
-    }
-    dec.rs2 = 0;
-
-    return dec;
-}
-
-// Load (LW, LH, LB)
-DecodedInstruction decode_load(uint32_t instruction, Instruction ins) {
-    DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-
-    dec.funct4 = 0;
-    dec.rd = (instruction >> 8) & 0xF;
-    dec.rs1 = (instruction >> 12) & 0xF;
-    dec.rs2 = 0;
-    dec.imm = (instruction >> 16) & 0xFFFF;
-
-    return dec;
+// rd imm[11:0] | imm[19:12] (JAL)
+static void decode_jump(uint32_t word, DecodedInstruction *dec) {
+    dec->rd = (word >> 8) & 0xF;
+    dec->imm = ((word >> 12) & 0xFFF) | (((word >> 24) & 0xFF) << 12);
 }
 
-// Logic immediates (ANDI, ORI, XORI)
-DecodedInstruction decode_logic_imm(uint32_t instruction, Instruction ins) {
-    DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-
-    dec.funct4 = 0;
-    dec.rd = (instruction >> 8) & 0xF;
-    dec.rs1 = (instruction >> 12) & 0xF;
-    dec.rs2 = 0;
-    dec.imm = (instruction >> 16) & 0xFFFF;
-
-    return dec;
+// funct4 rd | imm8 | rs1 (SLLI, SRLI)
+static void decode_shift_immediate(uint32_t word, DecodedInstruction *dec) {
+    dec->funct4 = (word >> 8) & 0xF;
+    dec->rd = (word >> 12) & 0xF;
+    dec->imm = (word >> 16) & 0xFF;
+    dec->rs1 = (word >> 24) & 0xF;
 }
 
-// Shift immediates (SLLI, SRLI)
-DecodedInstruction decode_shift_imm(uint32_t instruction, Instruction ins) {
+DecodedInstruction vm_decode(uint32_t word, Instruction *ins) {
     DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-
-    dec.funct4 = (instruction >> 8) & 0xF;
-    dec.rd = (instruction >> 12) & 0xF;
-    dec.rs1 = (instruction >> 24) & 0xF;
-    dec.rs2 = 0;
-    dec.imm = (instruction >> 16) & 0xFF;
-
-    return dec;
-}
 
-// HALT
-DecodedInstruction decode_halt(uint32_t instruction, Instruction ins) {
-    DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-    dec.isHalt = true;
-    dec.funct4 = ins.funct4;
+    dec.op = (uint8_t)isa_op(ins);
+    dec.funct3 = word & 0x7;
+    dec.opcode = (word >> 3) & 0x1F;
+    dec.opcode_funct3 = ins->opcode_funct3;
+    dec.instruction = ins;
+    dec.isHalt = dec.op == ISA_HALT;
 
-    dec.rd = 0;
-    dec.rs1 = 0;
-    dec.rs2 = 0;
-    dec.imm = 0;
+    switch (ins->format) {
+        case FORMAT_REGISTER:
+            decode_register(word, &dec);
+            break;
+        case FORMAT_IMMEDIATE:
+            decode_immediate(word, &dec);
+            break;
+        case FORMAT_STORE_BRANCH:
+            decode_store_branch(word, &dec);
+            break;
+        case FORMAT_UPPER:
+            decode_upper(word, &dec);
+            break;
+        case FORMAT_JUMP:
+            decode_jump(word, &dec);
+            break;
+        case FORMAT_SHIFT_IMMEDIATE:
+            decode_shift_immediate(word, &dec);
+            break;
+        default: // FORMAT_BYTE and FORMAT_NONE have no operands
+            break;
+    }
 
     return dec;
 }
 
-// Bitwise R-type (AND, OR, XOR) - 24-bit format
-DecodedInstruction decode_bitwise_rtype(uint32_t instruction, Instruction ins) {
-    DecodedInstruction dec = {0};
-    dec.funct3 = instruction & 0x7;
-    dec.opcode = (instruction >> 3) & 0x1F;
-    dec.instruction = &ins;
-    dec.opcode_funct3 = ins.opcode_funct3;
-
-    uint8_t byte1 = (instruction >> 8) & 0xFF;
-    uint8_t byte2 = (instruction >> 16) & 0xFF;
-
-    dec.funct4 = byte1 & 0xF;
-    dec.rd = byte1 >> 4;
-    dec.rs1 = byte2 & 0xF;
-    dec.rs2 = byte2 >> 4;
-    dec.imm = 0;
-
-    return dec;
+int isa_disassemble(const DecodedInstruction *dec, char *out, size_t size) {
+    const char *name = dec->instruction ? dec->instruction->name : "???";
+    switch (dec->instruction ? dec->instruction->format : (uint8_t)FORMAT_NONE) {
+        case FORMAT_REGISTER:
+            return snprintf(out, size, "%s r%d, r%d, r%d", name, dec->rd, dec->rs1, dec->rs2);
+        case FORMAT_IMMEDIATE:
+        case FORMAT_SHIFT_IMMEDIATE:
+            return snprintf(out, size, "%s r%d, r%d, 0x%X", name, dec->rd, dec->rs1, dec->imm);
+        case FORMAT_STORE_BRANCH:
+            return snprintf(out, size, "%s r%d, r%d, 0x%X", name, dec->rs1, dec->rs2, dec->imm);
+        case FORMAT_UPPER:
+        case FORMAT_JUMP:
+            return snprintf(out, size, "%s r%d, 0x%X", name, dec->rd, dec->imm);
+        default:
+            return snprintf(out, size, "%s", name);
+    }
 }
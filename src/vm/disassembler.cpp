@@ -0,0 +1,255 @@
+#include "disassembler.h"
+#include "architecture.h"
+#include "rom_container.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Blocks the summary at the end of a listing ranks
+#define DISASM_TOP_BLOCKS 5
+
+uint32_t disasm_op_cycles(const DecodedInstruction *dec) {
+    switch (dec->op) {
+        case ISA_MUL:
+        case ISA_MULI:
+            return 3;
+        case ISA_DIV:
+        case ISA_DIVI:
+            return 25;
+        case ISA_SB:
+        case ISA_LB:
+            return 2;
+        case ISA_SH:
+        case ISA_LH:
+            return 3;
+        case ISA_SW:
+        case ISA_LW:
+            return 5;
+        case ISA_BEQ:
+        case ISA_BNE:
+        case ISA_BLT:
+        case ISA_BGT:
+        case ISA_BLE:
+        case ISA_BGE:
+        case ISA_JAL:
+        case ISA_JALR:
+        case ISA_BANK: // bounds check and a pointer swap
+            return 2;
+        case ISA_CHAR: // 8x8 pixel test and store
+            return 96;
+        case ISA_CLS: // memset of the display buffer at ~32 bytes a cycle
+            return DISPLAY_SIZE * 4 / 32;
+        case ISA_NULL:
+        case ISA_HALT:
+            return 0;
+        default: // register and immediate ALU ops, LUI, AUIPC
+            return 1;
+    }
+}
+
+bool disasm_target(const DisasmLine *line, uint16_t *target) {
+    if (!line->valid) {
+        return false;
+    }
+    switch (line->dec.op) {
+        case ISA_BEQ:
+        case ISA_BNE:
+        case ISA_BLT:
+        case ISA_BGT:
+        case ISA_BLE:
+        case ISA_BGE:
+        case ISA_JAL:
+            // Offsets are relative to the next instruction, as in vm_execute_instruction
+            *target = (uint16_t)(line->address + line->length + (int16_t)line->dec.imm);
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool disasm_ends_block(const DisasmLine *line) {
+    uint16_t target;
+    return line->valid && (disasm_target(line, &target) || line->dec.op == ISA_JALR || line->dec.isHalt);
+}
+
+bool disasm_decode(const uint8_t *bytes, size_t size, uint16_t origin, size_t pos, DisasmLine *line) {
+    memset(line, 0, sizeof(*line));
+    line->address = (uint16_t)(origin + pos);
+    line->length = 1;
+
+    Instruction *ins = decode_lookup(bytes[pos], pos + 1 < size ? bytes[pos + 1] : 0);
+    size_t length = ins ? ins->length / 8 : 0;
+    if (length == 0 || pos + length > size) {
+        return false;
+    }
+
+    uint32_t word = 0;
+    for (size_t i = 0; i < length; i++) {
+        word |= (uint32_t)bytes[pos + i] << (i * 8);
+    }
+    line->dec = vm_decode(word, ins);
+    line->length = (uint8_t)length;
+    line->valid = true;
+    return true;
+}
+
+size_t disassemble_image(const uint8_t *bytes, size_t size, uint16_t origin, DisasmLine **lines) {
+    DisasmLine *out = (DisasmLine *)malloc((size > 0 ? size : 1) * sizeof(DisasmLine));
+    *lines = out;
+    if (!out) {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (size_t pos = 0; pos < size; pos += out[count++].length) {
+        disasm_decode(bytes, size, origin, pos, &out[count]);
+    }
+    return count;
+}
+
+typedef struct {
+    uint16_t start;
+    size_t instructions;
+    size_t bytes;
+    uint64_t cycles;
+} DisasmBlock;
+
+static void print_block_end(const DisasmBlock *block, FILE *out) {
+    fprintf(out, ";       %zu instructions, %zu bytes, ~%llu cycles (%llu dispatch)\n\n",
+            block->instructions, block->bytes, (unsigned long long)block->cycles,
+            (unsigned long long)block->instructions * DISASM_DISPATCH_CYCLES);
+}
+
+static void rank_block(DisasmBlock top[DISASM_TOP_BLOCKS], const DisasmBlock *block) {
+    for (int i = 0; i < DISASM_TOP_BLOCKS; i++) {
+        if (block->cycles > top[i].cycles) {
+            memmove(&top[i + 1], &top[i], (DISASM_TOP_BLOCKS - 1 - i) * sizeof(DisasmBlock));
+            top[i] = *block;
+            return;
+        }
+    }
+}
+
+void disasm_listing(const uint8_t *bytes, size_t size, uint16_t origin, FILE *out) {
+    DisasmLine *lines;
+    size_t count = disassemble_image(bytes, size, origin, &lines);
+    if (!lines) {
+        fprintf(out, "Error: out of memory\n");
+        return;
+    }
+
+    // Leaders: the entry, every branch target inside the image and
+    // whatever follows a block end
+    uint8_t *leader = (uint8_t *)calloc(size + 1, 1);
+    if (!leader) {
+        free(lines);
+        fprintf(out, "Error: out of memory\n");
+        return;
+    }
+    leader[0] = 1;
+    for (size_t i = 0; i < count; i++) {
+        uint16_t target;
+        if (disasm_target(&lines[i], &target) && target >= origin && (size_t)(target - origin) < size) {
+            leader[target - origin] = 1;
+        }
+        if (disasm_ends_block(&lines[i])) {
+            leader[lines[i].address - origin + lines[i].length] = 1;
+        }
+    }
+
+    fprintf(out, "; %zu bytes at 0x%04X, cycles = %d dispatch + op\n\n", size, origin,
+            DISASM_DISPATCH_CYCLES);
+
+    DisasmBlock block = {0};
+    DisasmBlock total = {0};
+    DisasmBlock top[DISASM_TOP_BLOCKS + 1] = {};
+    size_t blocks = 0;
+    for (size_t i = 0; i < count; i++) {
+        const DisasmLine *line = &lines[i];
+        if (leader[line->address - origin]) {
+            if (block.instructions > 0) {
+                print_block_end(&block, out);
+                rank_block(top, &block);
+            }
+            memset(&block, 0, sizeof(block));
+            block.start = line->address;
+            blocks++;
+            fprintf(out, "; block 0x%04X%s\n", line->address, i == 0 ? " (entry)" : "");
+        }
+
+        char hex[16] = "";
+        for (int b = 0; b < line->length; b++) {
+            snprintf(hex + b * 3, sizeof(hex) - b * 3, "%02X ", bytes[line->address - origin + b]);
+        }
+
+        char text[64];
+        uint32_t cycles = 0;
+        if (line->valid) {
+            isa_disassemble(&line->dec, text, sizeof(text));
+            cycles = DISASM_DISPATCH_CYCLES + disasm_op_cycles(&line->dec);
+            block.instructions++;
+        } else {
+            snprintf(text, sizeof(text), ".byte 0x%02X", bytes[line->address - origin]);
+        }
+        block.bytes += line->length;
+        block.cycles += cycles;
+
+        fprintf(out, "0x%04X  %-12s %-24s %6u", line->address, hex, text, cycles);
+        uint16_t target;
+        if (disasm_target(line, &target)) {
+            fprintf(out, "  ; -> 0x%04X", target);
+        }
+        fprintf(out, "\n");
+
+        total.instructions += line->valid;
+        total.bytes += line->length;
+        total.cycles += cycles;
+    }
+    if (block.instructions > 0) {
+        print_block_end(&block, out);
+        rank_block(top, &block);
+    }
+
+    fprintf(out, "; %zu instructions in %zu blocks, %zu bytes, ~%llu cycles\n", total.instructions,
+            blocks, total.bytes, (unsigned long long)total.cycles);
+    for (int i = 0; i < DISASM_TOP_BLOCKS && top[i].cycles > 0; i++) {
+        fprintf(out, ";   block 0x%04X  ~%llu cycles, %zu instructions\n", top[i].start,
+                (unsigned long long)top[i].cycles, top[i].instructions);
+    }
+
+    free(leader);
+    free(lines);
+}
+
+uint8_t *disasm_read_rom(const char *path, size_t *size) {
+    RomFile rom;
+    if (!rom_open(path, &rom)) {
+        return NULL;
+    }
+
+    // Lay the sections out as the VM would, then keep the program ROM part
+    // (bank 0 only)
+    uint8_t *memory = (uint8_t *)calloc(RAM_SIZE, 1);
+    uint32_t rom_size;
+    if (memory && !rom_load(&rom, memory, NULL, &rom_size)) {
+        printf("Error: ROM file has a corrupt compressed section: %s\n", path);
+        free(memory);
+        memory = NULL;
+    }
+    if (memory) {
+        memmove(memory, memory + PROGRAM_ROM, rom_size);
+        *size = rom_size;
+    }
+    rom_close(&rom);
+    return memory;
+}
+
+bool disasm_file(const char *path, FILE *out) {
+    size_t size;
+    uint8_t *data = disasm_read_rom(path, &size);
+    if (!data) {
+        return false;
+    }
+    disasm_listing(data, size, PROGRAM_ROM, out);
+    free(data);
+    return true;
+}
@@ -1,13 +1,16 @@
 #include "display.h"
 #include "architecture.h"
+#include "vm_fork.h"
 #include <string.h>
 
 void display_init(BasicVm *vm) {
     memset(vm->display_buffer, 0, sizeof(vm->display_buffer));
+    vm_dirty_display(vm, 0, DISPLAY_SIZE);
 }
 
 void display_clear(BasicVm *vm) {
     memset(vm->display_buffer, 0, sizeof(vm->display_buffer));
+    vm_dirty_display(vm, 0, DISPLAY_SIZE);
 }
 
 void display_update(BasicVm *vm) {
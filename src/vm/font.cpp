@@ -1,4 +1,5 @@
 #include "architecture.h"
+#include "vm_fork.h"
 #include <string.h>
 
 // Simple 8x8 font bitmap for ASCII characters 0x20-0x7F (printable characters)
@@ -199,4 +200,5 @@ static const uint8_t font_8x8[] = {
 void vm_load_font(BasicVm *vm) {
     // Load font at FONT_ADDR (0x0000)
     memcpy(vm->memory + FONT_ADDR, font_8x8, sizeof(font_8x8));
+    vm_dirty_memory(vm, FONT_ADDR, sizeof(font_8x8));
 }
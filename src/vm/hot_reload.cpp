@@ -0,0 +1,280 @@
+#include "config.h"
+#include "hot_reload.h"
+#include "asm_source.h"
+#include "log.h"
+#include "vm_fork.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+static int label_compare(const void *a, const void *b) {
+  const LabelAddress *left = (const LabelAddress *)a;
+  const LabelAddress *right = (const LabelAddress *)b;
+  if (left->address != right->address) {
+    return left->address < right->address ? -1 : 1;
+  }
+  return strcmp(left->name, right->name);
+}
+
+static void label_map_build(LabelMap *map, const SymbolTable *symbols) {
+  map->count = 0;
+  Symbol *symbol, *tmp;
+  HASH_ITER(hh, symbols->head, symbol, tmp) {
+    if (symbol->kind != SYMBOL_LABEL) {
+      continue;
+    }
+    if (map->count == map->capacity) {
+      size_t capacity = map->capacity ? map->capacity * 2 : 64;
+      LabelAddress *grown = (LabelAddress *)realloc(map->labels, capacity * sizeof(LabelAddress));
+      if (grown == NULL) {
+        break;
+      }
+      map->labels = grown;
+      map->capacity = capacity;
+    }
+    LabelAddress *label = &map->labels[map->count++];
+    label->address = symbol->value;
+    memcpy(label->name, symbol->name, sizeof(label->name));
+  }
+  qsort(map->labels, map->count, sizeof(LabelAddress), label_compare);
+}
+
+// Last label at or before address, or NULL
+static const LabelAddress *label_before(const LabelMap *map, uint32_t address) {
+  size_t low = 0, high = map->count;
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    if (map->labels[mid].address <= address) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low > 0 ? &map->labels[low - 1] : NULL;
+}
+
+// First label after address, or limit
+static uint32_t label_after(const LabelMap *map, uint32_t address, uint32_t limit) {
+  const LabelAddress *before = label_before(map, address);
+  size_t index = before ? (size_t)(before - map->labels) + 1 : 0;
+  for (; index < map->count; index++) {
+    if (map->labels[index].address > address) {
+      return map->labels[index].address < limit ? map->labels[index].address : limit;
+    }
+  }
+  return limit;
+}
+
+static uint8_t instruction_bytes(uint8_t first) {
+  Instruction *instruction = get_instruction_by_opcodefunct3(first);
+  return instruction ? instruction->length / 8 : 0;
+}
+
+// Map a code address in the old image (still in vm memory) to the new
+// image. Addresses outside the old image are data and stay as they are.
+static uint32_t remap_address(const HotReload *reload, const BasicVm *vm, uint32_t address) {
+  uint32_t oldEnd = PROGRAM_ROM + (uint32_t)reload->loadedSize;
+  if (address < PROGRAM_ROM || address >= oldEnd) {
+    return address;
+  }
+
+  // Code before the first label is anchored at the start of the ROM
+  const LabelAddress *oldLabel = label_before(&reload->labels, address);
+  uint32_t oldStart = oldLabel ? oldLabel->address : PROGRAM_ROM;
+  uint32_t newStart = PROGRAM_ROM;
+  if (oldLabel != NULL) {
+    Symbol *symbol = symbol_find(&reload->session.symbols, oldLabel->name, strlen(oldLabel->name));
+    if (symbol == NULL || symbol->kind != SYMBOL_LABEL) {
+      return address; // label was removed; nothing better to go on
+    }
+    newStart = symbol->value;
+  }
+
+  // Instruction index within the old block
+  uint32_t steps = 0;
+  uint32_t pc = oldStart;
+  while (pc < address) {
+    uint8_t length = instruction_bytes(vm->memory[pc]);
+    if (length == 0) {
+      return newStart;
+    }
+    pc += length;
+    steps++;
+  }
+  if (pc != address) {
+    return newStart; // not on an instruction boundary
+  }
+
+  // The same index in the new block, if the block is still that long
+  const RomImage *image = &reload->session.result.image;
+  uint32_t newEnd = PROGRAM_ROM + (uint32_t)image->size;
+  uint32_t blockEnd = label_after(&reload->nextLabels, newStart, newEnd);
+  pc = newStart;
+  for (uint32_t i = 0; i < steps; i++) {
+    uint8_t length = pc < newEnd ? instruction_bytes(image->bytes[pc - PROGRAM_ROM]) : 0;
+    if (length == 0 || pc + length >= blockEnd) {
+      return newStart;
+    }
+    pc += length;
+  }
+  return pc;
+}
+
+#ifdef __linux__
+static void *hot_reload_watcher(void *arg) {
+  HotReload *reload = (HotReload *)arg;
+  const char *slash = strrchr(reload->sourcePath, '/');
+  const char *fileName = slash ? slash + 1 : reload->sourcePath;
+  char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+  while (__atomic_load_n(&reload->running, __ATOMIC_ACQUIRE)) {
+    struct pollfd fd = {reload->notify, POLLIN, 0};
+    if (poll(&fd, 1, 100) <= 0) {
+      continue;
+    }
+    ssize_t n = read(reload->notify, events, sizeof(events));
+    for (char *p = events; n > 0 && p < events + n;) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      if (event->len > 0 && strcmp(event->name, fileName) == 0) {
+        __atomic_store_n(&reload->pending, 1, __ATOMIC_RELEASE);
+      }
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  return NULL;
+}
+#endif
+
+static bool hot_reload_watch(HotReload *reload) {
+#ifdef __linux__
+  char directory[4096] = ".";
+  const char *slash = strrchr(reload->sourcePath, '/');
+  if (slash != NULL) {
+    snprintf(directory, sizeof(directory), "%.*s", (int)(slash - reload->sourcePath), reload->sourcePath);
+  }
+
+  // Editors often save by renaming over the file, so watch the directory
+  reload->notify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (reload->notify < 0 ||
+      inotify_add_watch(reload->notify, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    return false;
+  }
+  reload->running = 1;
+  if (pthread_create(&reload->watcher, NULL, hot_reload_watcher, reload) != 0) {
+    reload->running = 0;
+    return false;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool hot_reload_start(HotReload *reload, BasicVm *vm, const char *sourcePath) {
+  memset(reload, 0, sizeof(*reload));
+  reload->sourcePath = sourcePath;
+  reload->notify = -1;
+  asm_session_init(&reload->session, PROGRAM_ROM);
+
+  if (!hot_reload_apply(reload, vm)) {
+    asm_session_free(&reload->session);
+    return false;
+  }
+
+  reload->watching = hot_reload_watch(reload);
+  if (!reload->watching) {
+    printf("Warning: cannot watch %s, hot reload disabled\n", sourcePath);
+  }
+  return true;
+}
+
+bool hot_reload_apply(HotReload *reload, BasicVm *vm) {
+  __atomic_store_n(&reload->pending, 0, __ATOMIC_RELEASE);
+
+  AsmSource source;
+  if (!asm_source_open(reload->sourcePath, &source)) {
+    printf("Error: Could not open source file: %s\n", reload->sourcePath);
+    return false;
+  }
+  bool ok = asm_session_build(&reload->session, source.data, source.size);
+  asm_source_close(&source);
+
+  const RomImage *image = &reload->session.result.image;
+  if (ok && image->size > PROGRAM_SIZE) {
+    asm_error(&reload->session.result, 0, "Program too large (%zu bytes, max %d)", image->size, PROGRAM_SIZE);
+    ok = false;
+  }
+  if (!ok) {
+    log_flush();
+    asm_print_diagnostics(&reload->session.result, stdout);
+    printf("Hot reload failed, still running the previous program\n");
+    fflush(stdout);
+    // The session's next build starts over, so the whole image is copied then
+    return false;
+  }
+
+  // Remap while memory still holds the old code; old addresses are looked
+  // up by the old labels and new blocks are bounded by the new ones
+  label_map_build(&reload->nextLabels, &reload->session.symbols);
+  uint16_t pc = (uint16_t)remap_address(reload, vm, vm->program_counter);
+
+  // Swap in only the bytes that changed, and clear code that went away
+  size_t start = reload->session.dirtyStart;
+  size_t end = reload->session.dirtyEnd < image->size ? reload->session.dirtyEnd : image->size;
+  if (reload->reloads == 0) {
+    start = 0;
+    end = image->size;
+  }
+  if (start < end) {
+    memcpy(vm->memory + PROGRAM_ROM + start, image->bytes + start, end - start);
+  } else {
+    start = end = image->size;
+  }
+  if (image->size < reload->loadedSize) {
+    memset(vm->memory + PROGRAM_ROM + image->size, 0, reload->loadedSize - image->size);
+    end = reload->loadedSize;
+  }
+  vm_dirty_memory(vm, PROGRAM_ROM + (uint32_t)start, (uint32_t)(end - start));
+  reload->session.writtenSize = image->size;
+  vm->rom_size = (uint32_t)image->size;
+  reload->session.dirtyStart = reload->session.dirtyEnd = 0;
+  reload->changedStart = start;
+  reload->changedEnd = end;
+
+  if (reload->reloads > 0) {
+    if (pc != vm->program_counter) {
+      log_write(LOG_INFO, "Hot reload: PC 0x%04X -> 0x%04X", vm->program_counter, pc);
+    }
+    vm->program_counter = pc;
+    log_write(LOG_INFO, "Hot reload %u: %zu lines re-encoded, ROM bytes 0x%04X-0x%04X replaced",
+              reload->reloads, reload->session.encodedLines,
+              (unsigned)(PROGRAM_ROM + start), (unsigned)(PROGRAM_ROM + end));
+  }
+
+  LabelMap labels = reload->labels;
+  reload->labels = reload->nextLabels;
+  reload->nextLabels = labels;
+  reload->loadedSize = image->size;
+  reload->reloads++;
+  return true;
+}
+
+void hot_reload_stop(HotReload *reload) {
+  if (reload->watching) {
+    __atomic_store_n(&reload->running, 0, __ATOMIC_RELEASE);
+    pthread_join(reload->watcher, NULL);
+  }
+  if (reload->notify >= 0) {
+    close(reload->notify);
+  }
+  free(reload->labels.labels);
+  free(reload->nextLabels.labels);
+  asm_session_free(&reload->session);
+  memset(reload, 0, sizeof(*reload));
+  reload->notify = -1;
+}
@@ -0,0 +1,221 @@
+#include "perf_counters.h"
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static const char *counter_names[PERF_COUNTER_COUNT] = {
+    "cycles", "instructions", "branch-misses", "L1D-misses"};
+
+static const char *opcode_class_name(uint8_t opcode) {
+    switch (opcode) {
+        case 0x01: return "arith";
+        case 0x02: return "arith-imm";
+        case 0x03: return "upper-imm";
+        case 0x04: return "store";
+        case 0x05: return "branch";
+        case 0x06: return "jump";
+        case 0x07: return "load";
+        case 0x08: return "bitwise";
+        case 0x09: return "bitwise-imm";
+        case 0x0A: return "shift";
+        case 0x0B: return "display";
+        case 0x1F: return "byte";
+        default: return "other";
+    }
+}
+
+static void counter_attr(PerfCounterId id, struct perf_event_attr *attr) {
+    memset(attr, 0, sizeof(*attr));
+    attr->size = sizeof(*attr);
+    attr->disabled = 1;
+    attr->exclude_kernel = 1;
+    attr->exclude_hv = 1;
+    attr->read_format = PERF_FORMAT_GROUP;
+
+    switch (id) {
+        case PERF_CYCLES:
+            attr->type = PERF_TYPE_HARDWARE;
+            attr->config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PERF_INSTRUCTIONS:
+            attr->type = PERF_TYPE_HARDWARE;
+            attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PERF_BRANCH_MISSES:
+            attr->type = PERF_TYPE_HARDWARE;
+            attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case PERF_L1D_MISSES:
+            attr->type = PERF_TYPE_HW_CACHE;
+            attr->config = PERF_COUNT_HW_CACHE_L1D |
+                           (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        default:
+            break;
+    }
+}
+
+static int read_paranoid_level() {
+    int level = -99;
+    FILE *fp = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+    if (fp) {
+        if (fscanf(fp, "%d", &level) != 1) {
+            level = -99;
+        }
+        fclose(fp);
+    }
+    return level;
+}
+
+bool perf_counters_open(PerfCounters *counters) {
+    memset(counters, 0, sizeof(*counters));
+    counters->leader_fd = -1;
+
+    int first_errno = 0;
+    for (int id = 0; id < PERF_COUNTER_COUNT; id++) {
+        counters->fds[id] = -1;
+        counters->group_slot[id] = -1;
+
+        struct perf_event_attr attr;
+        counter_attr((PerfCounterId)id, &attr);
+        int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, counters->leader_fd, 0);
+        if (fd < 0) {
+            if (!first_errno) {
+                first_errno = errno;
+            }
+            continue;
+        }
+
+        if (counters->leader_fd < 0) {
+            counters->leader_fd = fd;
+        }
+        counters->fds[id] = fd;
+        counters->group_slot[id] = counters->opened++;
+    }
+
+    if (counters->leader_fd < 0) {
+        printf("Perf counters unavailable (%s, perf_event_paranoid=%d); continuing without them\n",
+               strerror(first_errno), read_paranoid_level());
+        return false;
+    }
+
+    for (int id = 0; id < PERF_COUNTER_COUNT; id++) {
+        if (counters->fds[id] < 0) {
+            printf("Perf counter %s not supported on this host\n", counter_names[id]);
+        }
+    }
+    return true;
+}
+
+void perf_counters_close(PerfCounters *counters) {
+    for (int id = 0; id < PERF_COUNTER_COUNT; id++) {
+        if (counters->fds[id] >= 0) {
+            close(counters->fds[id]);
+            counters->fds[id] = -1;
+        }
+    }
+    counters->leader_fd = -1;
+}
+
+void perf_counters_read(PerfCounters *counters, uint64_t values[PERF_COUNTER_COUNT]) {
+    memset(values, 0, sizeof(uint64_t) * PERF_COUNTER_COUNT);
+    if (counters->leader_fd < 0) {
+        return;
+    }
+
+    // PERF_FORMAT_GROUP layout: nr, then one value per member in open order
+    uint64_t buffer[1 + PERF_COUNTER_COUNT];
+    if (read(counters->leader_fd, buffer, sizeof(buffer)) < (ssize_t)sizeof(uint64_t)) {
+        return;
+    }
+
+    for (int id = 0; id < PERF_COUNTER_COUNT; id++) {
+        int slot = counters->group_slot[id];
+        if (slot >= 0 && (uint64_t)slot < buffer[0]) {
+            values[id] = buffer[1 + slot];
+        }
+    }
+}
+
+void perf_counters_begin(PerfCounters *counters) {
+    if (counters->leader_fd < 0) {
+        return;
+    }
+    ioctl(counters->leader_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(counters->leader_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    perf_counters_read(counters, counters->begin);
+}
+
+void perf_counters_end(PerfCounters *counters, uint64_t guest_instructions) {
+    if (counters->leader_fd < 0) {
+        return;
+    }
+
+    uint64_t end[PERF_COUNTER_COUNT];
+    perf_counters_read(counters, end);
+    ioctl(counters->leader_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    for (int id = 0; id < PERF_COUNTER_COUNT; id++) {
+        counters->totals[id] = end[id] - counters->begin[id];
+    }
+    counters->guest_instructions = guest_instructions;
+}
+
+void perf_counters_attribute(PerfCounters *counters, uint8_t opcode, const uint64_t before[PERF_COUNTER_COUNT]) {
+    if (counters->leader_fd < 0) {
+        return;
+    }
+
+    uint64_t after[PERF_COUNTER_COUNT];
+    perf_counters_read(counters, after);
+
+    uint8_t cls = opcode & (PERF_OPCODE_CLASSES - 1);
+    for (int id = 0; id < PERF_COUNTER_COUNT; id++) {
+        counters->class_totals[cls][id] += after[id] - before[id];
+    }
+    counters->class_instructions[cls]++;
+}
+
+void perf_counters_report(const PerfCounters *counters, FILE *out) {
+    if (counters->leader_fd < 0 || counters->guest_instructions == 0) {
+        return;
+    }
+
+    fprintf(out, "=== Perf counters per guest instruction (%llu executed) ===\n",
+            (unsigned long long)counters->guest_instructions);
+    for (int id = 0; id < PERF_COUNTER_COUNT; id++) {
+        if (counters->fds[id] < 0) {
+            fprintf(out, "%-14s n/a\n", counter_names[id]);
+            continue;
+        }
+        fprintf(out, "%-14s %14llu  %10.3f/instr\n", counter_names[id],
+                (unsigned long long)counters->totals[id],
+                (double)counters->totals[id] / counters->guest_instructions);
+    }
+
+    bool any_class = false;
+    for (int cls = 0; cls < PERF_OPCODE_CLASSES; cls++) {
+        if (counters->class_instructions[cls] == 0) {
+            continue;
+        }
+        if (!any_class) {
+            fprintf(out, "%-12s %10s", "CLASS", "COUNT");
+            for (int id = 0; id < PERF_COUNTER_COUNT; id++) {
+                fprintf(out, " %14s", counter_names[id]);
+            }
+            fprintf(out, "\n");
+            any_class = true;
+        }
+
+        fprintf(out, "%-12s %10llu", opcode_class_name(cls),
+                (unsigned long long)counters->class_instructions[cls]);
+        for (int id = 0; id < PERF_COUNTER_COUNT; id++) {
+            fprintf(out, " %14.3f", (double)counters->class_totals[cls][id] / counters->class_instructions[cls]);
+        }
+        fprintf(out, "\n");
+    }
+}
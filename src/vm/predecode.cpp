@@ -0,0 +1,175 @@
+#include "predecode.h"
+#include "cfg.h"
+#include "log.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void put_header(uint8_t header[PREDECODE_HEADER_SIZE], uint32_t size, uint16_t origin, uint64_t hash) {
+    memset(header, 0, PREDECODE_HEADER_SIZE);
+    memcpy(header, PREDECODE_MAGIC, 4);
+    header[4] = PREDECODE_VERSION;
+    header[5] = sizeof(PredecodedInstruction);
+    memcpy(header + 6, &origin, sizeof(origin));
+    memcpy(header + 8, &size, sizeof(size));
+    memcpy(header + 16, &hash, sizeof(hash));
+}
+
+// Decode the entries at offsets [start, end) of the image
+static void build_entries(const uint8_t *image, uint32_t size, PredecodedInstruction *entries, uint32_t start,
+                          uint32_t end) {
+    memset(entries + start, 0, (size_t)(end - start) * sizeof(PredecodedInstruction));
+    for (uint32_t offset = start; offset < end; offset++) {
+        Instruction *ins = decode_lookup(image[offset], offset + 1 < size ? image[offset + 1] : 0);
+        uint32_t length = ins ? ins->length / 8 : 0;
+        // Leave what vm_step must report as an error to its own path
+        if (length == 0 || offset + length > size) {
+            continue;
+        }
+
+        uint32_t word = 0;
+        for (uint32_t i = 0; i < length; i++) {
+            word |= (uint32_t)image[offset + i] << (i * 8);
+        }
+        DecodedInstruction dec = vm_decode(word, ins);
+        PredecodedInstruction *entry = &entries[offset];
+        entry->word = word;
+        entry->imm = dec.imm;
+        entry->op = dec.op;
+        entry->length = (uint8_t)length;
+        entry->rd = dec.rd;
+        entry->rs1 = dec.rs1;
+        entry->rs2 = dec.rs2;
+        entry->funct4 = dec.funct4;
+    }
+}
+
+static bool map_cache(PredecodeCache *cache, const char *path, const uint8_t expected[PREDECODE_HEADER_SIZE],
+                      uint32_t size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    size_t file_size = PREDECODE_HEADER_SIZE + (size_t)size * sizeof(PredecodedInstruction);
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != file_size) {
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+    if (memcmp(mapping, expected, PREDECODE_HEADER_SIZE) != 0) {
+        munmap(mapping, file_size);
+        return false;
+    }
+
+    cache->mapping = mapping;
+    cache->mappingSize = file_size;
+    cache->entries = (const PredecodedInstruction *)((const uint8_t *)mapping + PREDECODE_HEADER_SIZE);
+    cache->size = size;
+    return true;
+}
+
+// Write through a temporary name, so processes starting together never map a half-written file
+static bool write_cache(const char *dir, const char *path, const uint8_t header[PREDECODE_HEADER_SIZE],
+                        const PredecodedInstruction *entries, uint32_t size) {
+    mkdir(dir, 0755);
+    char temp[512];
+    snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int)getpid());
+
+    FILE *fp = fopen(temp, "wb");
+    if (!fp) {
+        return false;
+    }
+    bool ok = fwrite(header, 1, PREDECODE_HEADER_SIZE, fp) == PREDECODE_HEADER_SIZE &&
+              fwrite(entries, sizeof(PredecodedInstruction), size, fp) == size;
+    if (fclose(fp) != 0) {
+        ok = false;
+    }
+    if (!ok || rename(temp, path) != 0) {
+        remove(temp);
+        return false;
+    }
+    return true;
+}
+
+bool predecode_open(PredecodeCache *cache, const uint8_t *image, uint32_t size, uint16_t origin,
+                    const char *dir) {
+    memset(cache, 0, sizeof(*cache));
+    uint64_t hash = cfg_image_hash(image, size);
+    uint8_t header[PREDECODE_HEADER_SIZE];
+    put_header(header, size, origin, hash);
+
+    char path[480];
+    snprintf(path, sizeof(path), "%s/%016llx.bvmd", dir, (unsigned long long)hash);
+    if (map_cache(cache, path, header, size)) {
+        log_write(LOG_INFO, "Predecode cache: mapped %s", log_text(path));
+        return true;
+    }
+
+    PredecodedInstruction *entries =
+        (PredecodedInstruction *)malloc((size ? size : 1) * sizeof(PredecodedInstruction));
+    if (!entries) {
+        log_write(LOG_ERROR, "Predecode cache: out of memory");
+        return false;
+    }
+    build_entries(image, size, entries, 0, size);
+    cache->entries = entries;
+    cache->size = size;
+
+    if (write_cache(dir, path, header, entries, size)) {
+        log_write(LOG_INFO, "Predecode cache: wrote %s", log_text(path));
+    } else {
+        log_write(LOG_WARN, "Predecode cache: could not write %s", log_text(path));
+    }
+    return true;
+}
+
+bool predecode_update(PredecodeCache *cache, const uint8_t *image, uint32_t size, uint32_t start, uint32_t end) {
+    if (cache->mapping || size != cache->size) {
+        // The file stays that of the image it was built for, so edit a copy
+        PredecodedInstruction *copy =
+            (PredecodedInstruction *)malloc((size ? size : 1) * sizeof(PredecodedInstruction));
+        if (!copy) {
+            log_write(LOG_ERROR, "Predecode cache: out of memory");
+            predecode_close(cache);
+            return false;
+        }
+        uint32_t kept = size < cache->size ? size : cache->size;
+        if (kept > 0) {
+            memcpy(copy, cache->entries, (size_t)kept * sizeof(PredecodedInstruction));
+        }
+        if (kept < size || kept < cache->size) {
+            // Everything past the shorter end, and what was cut off there
+            start = start < kept ? start : kept;
+            end = size;
+        }
+        predecode_close(cache);
+        cache->entries = copy;
+        cache->size = size;
+    }
+
+    // Instructions up to 4 bytes long that start before the range reach into it
+    start = start > 3 ? start - 3 : 0;
+    end = end < size ? end : size;
+    if (start < end) {
+        build_entries(image, size, (PredecodedInstruction *)cache->entries, start, end);
+    }
+    return true;
+}
+
+void predecode_close(PredecodeCache *cache) {
+    if (cache->mapping) {
+        munmap(cache->mapping, cache->mappingSize);
+    } else {
+        free((void *)cache->entries);
+    }
+    memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,126 @@
+#include "profiler.h"
+#include "vm.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+// State shared with the SIGPROF handler. The handler only reads the PC and
+// bumps a counter with a relaxed atomic add, so it never takes a lock.
+static BasicVm *volatile sampled_vm = NULL;
+static PcProfile *volatile sampled_profile = NULL;
+static struct sigaction previous_action;
+
+void profiler_reset(PcProfile *profile, const char *mode) {
+    memset(profile->counts, 0, sizeof(profile->counts));
+    profile->total = 0;
+    profile->mode = mode;
+}
+
+static void profiler_on_sigprof(int signo) {
+    (void)signo;
+    BasicVm *vm = sampled_vm;
+    PcProfile *profile = sampled_profile;
+    if (!vm || !profile) {
+        return;
+    }
+
+    uint16_t pc = __atomic_load_n(&vm->program_counter, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile->counts[pc], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&profile->total, 1, __ATOMIC_RELAXED);
+}
+
+void profiler_start_sampling(BasicVm *vm, PcProfile *profile, long interval_us) {
+    profiler_reset(profile, "sampling");
+    sampled_profile = profile;
+    sampled_vm = vm;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = profiler_on_sigprof;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &previous_action) != 0) {
+        perror("Error installing SIGPROF handler");
+        sampled_vm = NULL;
+        return;
+    }
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = interval_us / 1000000;
+    timer.it_interval.tv_usec = interval_us % 1000000;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        perror("Error arming profiling timer");
+        sigaction(SIGPROF, &previous_action, NULL);
+        sampled_vm = NULL;
+    }
+}
+
+void profiler_stop_sampling(PcProfile *profile) {
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &previous_action, NULL);
+
+    sampled_vm = NULL;
+    sampled_profile = NULL;
+    (void)profile;
+}
+
+static const PcProfile *sort_profile = NULL;
+
+static int compare_pc_counts(const void *a, const void *b) {
+    uint32_t count_a = sort_profile->counts[*(const uint16_t *)a];
+    uint32_t count_b = sort_profile->counts[*(const uint16_t *)b];
+    if (count_a != count_b) {
+        return count_a < count_b ? 1 : -1;
+    }
+    return *(const uint16_t *)a - *(const uint16_t *)b;
+}
+
+void profiler_report(BasicVm *vm, const PcProfile *profile, FILE *out, int max_rows) {
+    uint16_t *pcs = (uint16_t *)malloc(sizeof(uint16_t) * RAM_SIZE);
+    if (!pcs) {
+        return;
+    }
+
+    int used = 0;
+    for (int pc = 0; pc < RAM_SIZE; pc++) {
+        if (profile->counts[pc] != 0) {
+            pcs[used++] = (uint16_t)pc;
+        }
+    }
+
+    sort_profile = profile;
+    qsort(pcs, used, sizeof(uint16_t), compare_pc_counts);
+    sort_profile = NULL;
+
+    fprintf(out, "=== Profile (%s): %llu hits over %d PCs ===\n",
+            profile->mode, (unsigned long long)profile->total, used);
+    fprintf(out, "%-8s %-8s %12s %8s\n", "PC", "INSTR", "COUNT", "SHARE");
+    for (int i = 0; i < used && i < max_rows; i++) {
+        uint16_t pc = pcs[i];
+        Instruction *ins = vm_fetch_instruction(vm, pc);
+        double share = profile->total ? 100.0 * profile->counts[pc] / profile->total : 0.0;
+        fprintf(out, "0x%04X   %-8s %12u %7.2f%%\n",
+                pc, ins ? ins->name : "?", profile->counts[pc], share);
+    }
+
+    free(pcs);
+}
+
+bool profiler_write(const PcProfile *profile, const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        return false;
+    }
+
+    fprintf(out, "; %s profile, %llu hits\n", profile->mode, (unsigned long long)profile->total);
+    for (int pc = 0; pc < RAM_SIZE; pc++) {
+        if (profile->counts[pc] != 0) {
+            fprintf(out, "0x%04X %u\n", pc, profile->counts[pc]);
+        }
+    }
+    return fclose(out) == 0;
+}
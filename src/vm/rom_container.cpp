@@ -0,0 +1,182 @@
+#include "rom_container.h"
+#include "architecture.h"
+#include "cfg.h"
+#include "lz.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint16_t get_u16(const uint8_t *in) {
+    return in[0] | (in[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *in) {
+    return get_u16(in) | ((uint32_t)get_u16(in + 2) << 16);
+}
+
+static uint64_t get_u64(const uint8_t *in) {
+    return get_u32(in) | ((uint64_t)get_u32(in + 4) << 32);
+}
+
+static bool check_section(const RomSection *section, size_t tableEnd, size_t fileSize) {
+    uint16_t known = ROM_SECTION_LZ | ROM_SECTION_BANKED;
+    bool banked = section->flags & ROM_SECTION_BANKED;
+    if ((section->flags & 0xFF & ~known) != 0 || (!banked && ROM_SECTION_BANK(section->flags) != 0)) {
+        return false;
+    }
+    if (!(section->flags & ROM_SECTION_LZ) && section->fileSize != section->size) {
+        return false;
+    }
+    if (section->offset < tableEnd || section->offset > fileSize ||
+        section->fileSize > fileSize - section->offset) {
+        return false;
+    }
+    if (banked) {
+        return ROM_SECTION_BANK(section->flags) != 0 && section->address >= BANK_WINDOW &&
+               section->address + (size_t)section->size <= BANK_WINDOW + BANK_SIZE;
+    }
+    return section->address + (size_t)section->size <= RAM_SIZE;
+}
+
+static bool check_container(RomFile *rom, const char *path) {
+    const uint8_t *header = rom->data;
+    if (header[4] != ROM_VERSION) {
+        printf("Error: %s is ROM container version %u, expected %u\n", path, header[4], ROM_VERSION);
+        return false;
+    }
+    size_t tableEnd = ROM_HEADER_SIZE + (size_t)rom->sectionCount * ROM_SECTION_SIZE;
+    if (rom->sectionCount == 0 || rom->sectionCount > ROM_MAX_SECTIONS || tableEnd > rom->size) {
+        printf("Error: %s has a bad section table\n", path);
+        return false;
+    }
+    if (rom->entry < PROGRAM_ROM) {
+        printf("Error: %s has its entry point 0x%04X outside program ROM\n", path, rom->entry);
+        return false;
+    }
+    if (cfg_image_hash(rom->data + ROM_HEADER_SIZE, rom->size - ROM_HEADER_SIZE) != get_u64(header + 16)) {
+        printf("Error: %s fails its checksum\n", path);
+        return false;
+    }
+
+    rom->bankCount = 1;
+    for (uint16_t i = 0; i < rom->sectionCount; i++) {
+        RomSection section = rom_section(rom, i);
+        if (!check_section(&section, tableEnd, rom->size)) {
+            printf("Error: %s has a bad section %u (0x%04X, %u bytes)\n", path, i, section.address,
+                   (unsigned)section.size);
+            return false;
+        }
+        if (section.flags & ROM_SECTION_BANKED && ROM_SECTION_BANK(section.flags) >= rom->bankCount) {
+            rom->bankCount = ROM_SECTION_BANK(section.flags) + 1;
+        }
+    }
+    return true;
+}
+
+bool rom_open(const char *path, RomFile *rom) {
+    memset(rom, 0, sizeof(*rom));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error: Could not open ROM file: %s\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        printf("Error: Could not open ROM file: %s\n", path);
+        close(fd);
+        return false;
+    }
+
+    // An empty file is an empty headerless image, and mmap() refuses length 0
+    if (st.st_size > 0) {
+        void *mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED) {
+            printf("Error: Could not map ROM file: %s\n", path);
+            close(fd);
+            return false;
+        }
+        // Sections are read front to back once, so let the kernel read ahead
+        madvise(mapping, (size_t)st.st_size, MADV_SEQUENTIAL);
+        rom->data = (const uint8_t *)mapping;
+        rom->size = (size_t)st.st_size;
+    }
+    close(fd);
+
+    rom->container = rom->size >= ROM_HEADER_SIZE && memcmp(rom->data, ROM_MAGIC, 4) == 0;
+    if (!rom->container) {
+        rom->entry = PROGRAM_ROM;
+        rom->sectionCount = 1;
+        rom->bankCount = 1;
+        if (rom->size > PROGRAM_SIZE) {
+            printf("Error: ROM file too large: %s (%zu bytes, max %d)\n", path, rom->size, PROGRAM_SIZE);
+            rom_close(rom);
+            return false;
+        }
+        return true;
+    }
+
+    rom->sectionCount = get_u16(rom->data + 6);
+    rom->entry = get_u16(rom->data + 8);
+    if (!check_container(rom, path)) {
+        rom_close(rom);
+        return false;
+    }
+    return true;
+}
+
+RomSection rom_section(const RomFile *rom, uint16_t index) {
+    RomSection section;
+    if (!rom->container) {
+        section.address = PROGRAM_ROM;
+        section.flags = 0;
+        section.size = (uint32_t)rom->size;
+        section.offset = 0;
+        section.fileSize = (uint32_t)rom->size;
+        return section;
+    }
+
+    const uint8_t *in = rom->data + ROM_HEADER_SIZE + (size_t)index * ROM_SECTION_SIZE;
+    section.address = get_u16(in);
+    section.flags = get_u16(in + 2);
+    section.size = get_u32(in + 4);
+    section.offset = get_u32(in + 8);
+    section.fileSize = get_u32(in + 12);
+    return section;
+}
+
+bool rom_load(const RomFile *rom, uint8_t *memory, uint8_t *banks, uint32_t *romSize) {
+    uint32_t end = PROGRAM_ROM;
+    for (uint16_t i = 0; i < rom->sectionCount; i++) {
+        RomSection section = rom_section(rom, i);
+        uint8_t *target = memory + section.address;
+        if (section.flags & ROM_SECTION_BANKED) {
+            if (!banks) {
+                continue;
+            }
+            target = banks + (size_t)(ROM_SECTION_BANK(section.flags) - 1) * BANK_SIZE +
+                     (section.address - BANK_WINDOW);
+        } else if (section.address >= PROGRAM_ROM && section.address + section.size > end) {
+            end = section.address + section.size;
+        }
+
+        if (section.flags & ROM_SECTION_LZ) {
+            if (!lz_decompress(rom->data + section.offset, section.fileSize, target, section.size)) {
+                return false;
+            }
+        } else if (section.size > 0) {
+            memcpy(target, rom->data + section.offset, section.size);
+        }
+    }
+    *romSize = end - PROGRAM_ROM;
+    return true;
+}
+
+void rom_close(RomFile *rom) {
+    if (rom->data) {
+        munmap((void *)rom->data, rom->size);
+    }
+    memset(rom, 0, sizeof(*rom));
+}
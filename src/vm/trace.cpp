@@ -0,0 +1,232 @@
+#include "trace.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static size_t put_varint(uint8_t *out, uint32_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+static size_t get_varint(const uint8_t *in, size_t size, uint32_t *value) {
+    uint32_t result = 0;
+    for (size_t n = 0; n < size && n < 5; n++) {
+        result |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+        if (!(in[n] & 0x80)) {
+            *value = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t zigzag(int32_t value) {
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static void *trace_writer_thread(void *arg) {
+    TraceWriter *trace = (TraceWriter *)arg;
+    struct timespec idle = {0, 1000000};
+
+    for (;;) {
+        uint64_t head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = trace->tail;
+
+        if (head == tail) {
+            if (!__atomic_load_n(&trace->running, __ATOMIC_ACQUIRE)) {
+                // Re-check after seeing the stop flag so the last records land
+                if (__atomic_load_n(&trace->head, __ATOMIC_ACQUIRE) == tail) {
+                    break;
+                }
+                continue;
+            }
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        // Write the readable span, split in two where it wraps
+        size_t start = tail & (TRACE_RING_SIZE - 1);
+        size_t length = head - tail;
+        if (start + length > TRACE_RING_SIZE) {
+            length = TRACE_RING_SIZE - start;
+        }
+        fwrite(trace->ring + start, 1, length, trace->file);
+        __atomic_store_n(&trace->tail, tail + length, __ATOMIC_RELEASE);
+    }
+
+    fflush(trace->file);
+    return NULL;
+}
+
+static void trace_push(TraceWriter *trace, const uint8_t *bytes, size_t count) {
+    uint64_t head = trace->head;
+    while (head + count - __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE) > TRACE_RING_SIZE) {
+        sched_yield(); // writer is behind, apply backpressure rather than drop
+    }
+
+    size_t start = head & (TRACE_RING_SIZE - 1);
+    size_t first = count;
+    if (start + first > TRACE_RING_SIZE) {
+        first = TRACE_RING_SIZE - start;
+    }
+    memcpy(trace->ring + start, bytes, first);
+    memcpy(trace->ring, bytes + first, count - first);
+
+    __atomic_store_n(&trace->head, head + count, __ATOMIC_RELEASE);
+}
+
+bool trace_open(TraceWriter *trace, const char *path, uint16_t start_pc) {
+    memset(trace, 0, sizeof(*trace));
+    trace->file = fopen(path, "wb");
+    if (!trace->file) {
+        perror("Error opening trace file");
+        return false;
+    }
+
+    trace->ring = (uint8_t *)malloc(TRACE_RING_SIZE);
+    if (!trace->ring) {
+        fclose(trace->file);
+        trace->file = NULL;
+        return false;
+    }
+
+    uint8_t header[7] = {'B', 'V', 'M', 'T', TRACE_VERSION,
+                         (uint8_t)(start_pc & 0xFF), (uint8_t)(start_pc >> 8)};
+    fwrite(header, 1, sizeof(header), trace->file);
+
+    trace->last_pc = start_pc;
+    trace->running = 1;
+    if (pthread_create(&trace->writer, NULL, trace_writer_thread, trace) != 0) {
+        perror("Error starting trace writer");
+        free(trace->ring);
+        fclose(trace->file);
+        trace->ring = NULL;
+        trace->file = NULL;
+        return false;
+    }
+    return true;
+}
+
+void trace_record_step(TraceWriter *trace, BasicVm *vm, uint16_t pc,
+                       const uint8_t registers[16], const DecodedInstruction *dec) {
+    if (!trace->ring) {
+        return;
+    }
+
+    // Worst case: step(6) + 16 registers(2) + 4 memory bytes(5)
+    uint8_t record[6 + 16 * 2 + 4 * 5];
+    size_t n = 0;
+
+    record[n++] = TRACE_STEP;
+    n += put_varint(record + n, zigzag((int32_t)pc - (int32_t)trace->last_pc));
+    trace->last_pc = pc;
+
+    for (int r = 0; r < 16; r++) {
+        if (vm->registers[r] != registers[r]) {
+            record[n++] = (uint8_t)(TRACE_REG | (r << 4));
+            record[n++] = vm->registers[r];
+        }
+    }
+
+    // Stores are the only instructions that write guest memory; recompute
+    // their addresses the way vm_execute_instruction does
+    if (dec->opcode == 0x04) {
+        int width = dec->funct3 == 0x00 ? 1 : dec->funct3 == 0x01 ? 2 : 4;
+        for (int i = 0; i < width; i++) {
+            uint16_t addr = (registers[dec->rs1] + dec->imm + i) & 0xFFF;
+            record[n++] = TRACE_MEM;
+            n += put_varint(record + n, addr);
+            record[n++] = vm->memory[addr];
+        }
+    }
+
+    trace_push(trace, record, n);
+}
+
+void trace_close(TraceWriter *trace) {
+    if (!trace->ring) {
+        return;
+    }
+
+    __atomic_store_n(&trace->running, 0, __ATOMIC_RELEASE);
+    pthread_join(trace->writer, NULL);
+
+    fclose(trace->file);
+    free(trace->ring);
+    trace->file = NULL;
+    trace->ring = NULL;
+}
+
+bool trace_decode(const char *path, FILE *out) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        printf("Error: Could not open trace file: %s\n", path);
+        return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    uint8_t *data = (uint8_t *)malloc(size > 0 ? size : 1);
+    size_t bytes_read = data ? fread(data, 1, size, fp) : 0;
+    fclose(fp);
+
+    if (bytes_read < 7 || memcmp(data, TRACE_MAGIC, 4) != 0 || data[4] != TRACE_VERSION) {
+        printf("Error: %s is not a version %d trace\n", path, TRACE_VERSION);
+        free(data);
+        return false;
+    }
+
+    uint16_t pc = data[5] | (data[6] << 8);
+    uint64_t steps = 0;
+    size_t pos = 7;
+    while (pos < bytes_read) {
+        uint8_t tag = data[pos++];
+        uint32_t value = 0;
+        size_t used = 0;
+
+        switch (tag & 0xF) {
+            case TRACE_STEP:
+                used = get_varint(data + pos, bytes_read - pos, &value);
+                if (!used) {
+                    break;
+                }
+                pos += used;
+                pc = (uint16_t)(pc + unzigzag(value));
+                fprintf(out, "%8llu  PC=0x%04X\n", (unsigned long long)steps++, pc);
+                continue;
+            case TRACE_REG:
+                if (pos >= bytes_read) {
+                    break;
+                }
+                fprintf(out, "          r%d <- 0x%02X\n", tag >> 4, data[pos++]);
+                continue;
+            case TRACE_MEM:
+                used = get_varint(data + pos, bytes_read - pos, &value);
+                if (!used || pos + used >= bytes_read) {
+                    break;
+                }
+                pos += used;
+                fprintf(out, "          [0x%04X] <- 0x%02X\n", value, data[pos++]);
+                continue;
+        }
+
+        printf("Error: Corrupt trace record at offset %zu\n", pos - 1);
+        free(data);
+        return false;
+    }
+
+    free(data);
+    return true;
+}
@@ -6,54 +6,142 @@
 #include "display.h"
 #include "decode.h"
 #include "instructions.h"
+#include "profiler.h"
+#include "perf_counters.h"
+#include "trace.h"
+#include "hot_reload.h"
+#include "cfg.h"
+#include "predecode.h"
+#include "rom_container.h"
+#include "vm_fork.h"
+#include "log.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// ROM banks are shared by every VM and snapshot that maps them and freed
+// with the last one; the count sits in front of the bytes
+typedef struct
+{
+    uint32_t refs;
+    alignas(16) uint8_t bytes[];
+} VmBanks;
+
+static VmBanks *banks_header(const uint8_t *banks)
+{
+    return (VmBanks *)(banks - offsetof(VmBanks, bytes));
+}
+
+uint8_t *vm_banks_alloc(size_t size)
+{
+    VmBanks *header = (VmBanks *)calloc(1, sizeof(VmBanks) + size);
+    if (!header)
+    {
+        return NULL;
+    }
+    header->refs = 1;
+    return header->bytes;
+}
+
+void vm_banks_retain(const uint8_t *banks)
+{
+    if (banks)
+    {
+        __atomic_add_fetch(&banks_header(banks)->refs, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void vm_banks_release(const uint8_t *banks)
+{
+    if (banks && __atomic_sub_fetch(&banks_header(banks)->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        free(banks_header(banks));
+    }
+}
+
 void vm_init(BasicVm *vm)
 {
     memset(vm, 0, sizeof(BasicVm));
     vm->stack_pointer = 0;
     vm->program_counter = PROGRAM_ROM;
+    vm->bank_count = 1;
     vm_load_font(vm);
     display_init(vm);
 }
 
+void vm_release(BasicVm *vm)
+{
+    vm_fork_release(vm);
+    vm_banks_release(vm->banks);
+    vm->banks = NULL;
+    vm->bank_window = NULL;
+    vm->bank_count = 1;
+    vm->bank = 0;
+}
+
+bool vm_load_image(BasicVm *vm, const uint8_t *bytes, size_t size)
+{
+    if (size > PROGRAM_SIZE)
+    {
+        printf("Error: ROM image too large (%zu bytes, max %d)\n", size, PROGRAM_SIZE);
+        return false;
+    }
+    memcpy(vm->memory + PROGRAM_ROM, bytes, size);
+    vm_dirty_memory(vm, PROGRAM_ROM, (uint32_t)size);
+    vm->rom_size = (uint32_t)size;
+    return true;
+}
+
 bool vm_load_rom(BasicVm *vm, const char *filename)
 {
-    FILE *fp = fopen(filename, "rb");
-    if (!fp)
+    // Sections are copied or decompressed straight from the page cache into
+    // guest memory, with no read buffer in between
+    RomFile rom;
+    if (!rom_open(filename, &rom))
     {
-        printf("Error: Could not open ROM file: %s\n", filename);
         fflush(stdout);
         return false;
     }
-
-    // Get file size
-    fseek(fp, 0, SEEK_END);
-    long file_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-
-    if (file_size > PROGRAM_SIZE)
+    uint8_t *banks = NULL;
+    if (rom.bankCount > 1)
     {
-        printf("Error: ROM file too large: %s (%ld bytes, max %d)\n", filename, file_size, PROGRAM_SIZE);
-        fclose(fp);
+        banks = vm_banks_alloc((size_t)(rom.bankCount - 1) * BANK_SIZE);
+        if (!banks)
+        {
+            printf("Error: Out of memory for %u ROM banks: %s\n", rom.bankCount, filename);
+            fflush(stdout);
+            rom_close(&rom);
+            return false;
+        }
+    }
+    if (!rom_load(&rom, vm->memory, banks, &vm->rom_size))
+    {
+        printf("Error: ROM file has a corrupt compressed section: %s\n", filename);
+        fflush(stdout);
+        vm_banks_release(banks);
+        rom_close(&rom);
         return false;
     }
-
-    // Load into program ROM area (0x1000)
-    size_t bytes_read = fread(vm->memory + PROGRAM_ROM, 1, file_size, fp);
-    fclose(fp);
+    vm_dirty_memory(vm, 0, RAM_SIZE); // sections may land anywhere
+    vm_banks_release(vm->banks); // snapshots and forks may still map the old ones
+    vm->banks = banks;
+    vm->bank_count = rom.bankCount;
+    vm_select_bank(vm, 0);
+    vm->program_counter = rom.entry;
 
 #ifdef VERBOSE
-    printf("Loaded ROM: %s (%zu bytes)\n", filename, bytes_read);
+    printf("Loaded ROM: %s (%zu bytes, %u sections, %u banks, entry 0x%04X)\n", filename, rom.size,
+           rom.sectionCount, rom.bankCount, rom.entry);
     fflush(stdout);
 #endif
+    rom_close(&rom);
     return true;
 }
 
 void vm_print_state(BasicVm *vm)
 {
+    log_flush(); // keep queued diagnostics ahead of the synchronous dump
     printf("PC: 0x%04X | IR: 0x%04X | SP: %d | I: 0x%04X\n",
            vm->program_counter, vm->opcode, vm->stack_pointer, vm->index_register);
     printf("Registers: ");
@@ -66,65 +154,16 @@ void vm_print_state(BasicVm *vm)
 
 void vm_print_instruction(BasicVm *vm, DecodedInstruction decodedInstruction)
 {
-    if (decodedInstruction.instruction && decodedInstruction.instruction->name[0] != 'N')
+    if (!log_enabled(LOG_DEBUG))
     {
-        printf("[%s] ", decodedInstruction.instruction->name);
-        switch (decodedInstruction.opcode)
-        {
-        case 0x01: // Arithmetic R-type
-        case 0x08: // Bitwise R-type
-            printf("[funct4=0x%X] r%d, r%d, r%d\n", decodedInstruction.funct4, decodedInstruction.rd, decodedInstruction.rs1, decodedInstruction.rs2);
-            break;
-        case 0x02: // Immediates I-type
-        case 0x07: // Loads I-type
-        case 0x09: // Bitwise Immediates I-type
-            printf("r%d, r%d, 0x%04X\n", decodedInstruction.rd, decodedInstruction.rs1, decodedInstruction.imm);
-            break;
-        case 0x03: // Upper Immediates U-type (LUI/AUIPC)
-            // Format: opcode(5)|funct3(3) | funct4(4) | rd(4) | imm(16)
-            printf("[funct4=0x%X] r%d, 0x%04X\n", decodedInstruction.funct4, decodedInstruction.rd, decodedInstruction.imm);
-            break;
-        case 0x04: // Stores S-type
-            printf("r%d, 0x%04X(r%d)\n", decodedInstruction.rs2, decodedInstruction.imm, decodedInstruction.rs1);
-            break;
-        case 0x05: // Branches B-type
-            printf("r%d, r%d, 0x%04X\n", decodedInstruction.rs1, decodedInstruction.rs2, decodedInstruction.imm);
-            break;
-        case 0x06: // Jumps
-            if (decodedInstruction.funct3 == 0x02)
-            { // JALR (funct3=0x02)
-                printf("r%d, r%d, 0x%04X\n", decodedInstruction.rd, decodedInstruction.rs1, decodedInstruction.imm);
-            }
-            else
-            { // JAL (funct3=0x01)
-                printf("r%d, 0x%05X\n", decodedInstruction.rd, decodedInstruction.imm);
-            }
-            break;
-        case 0x0A: // Shifts
-            // opcode_funct3 0x50 = SLL/SRL (24-bit, register-based)
-            // opcode_funct3 0x51 = SLLI/SRLI (32-bit, immediate-based)
-            if (decodedInstruction.opcode_funct3 == 0x50)
-            {
-                // 24-bit: SLL/SRL - register-based
-                printf("[funct4=0x%X] r%d, r%d, r%d\n",
-                       decodedInstruction.funct4, decodedInstruction.rd, decodedInstruction.rs1, decodedInstruction.rs2);
-            }
-            else
-            {
-                // 32-bit: SLLI/SRLI - immediate-based (8-bit immediate)
-                printf("[funct4=0x%X] r%d, r%d, 0x%01X\n",
-                       decodedInstruction.funct4, decodedInstruction.rd, decodedInstruction.rs1, decodedInstruction.imm & 0xFF);
-            }
-            break;
-        case 0x1F: // HALT
-            if(decodedInstruction.opcode_funct3 == 0xFF){
-                printf("\n");
-            }
-            break;
-        default:
-            printf("opcode=0x%02X funct3=0x%X\n", decodedInstruction.opcode, decodedInstruction.funct3);
-            break;
-        }
+        return;
+    }
+
+    if (decodedInstruction.instruction && decodedInstruction.op != ISA_NULL)
+    {
+        char text[LOG_TEXT_SIZE];
+        isa_disassemble(&decodedInstruction, text, sizeof(text));
+        log_write(LOG_DEBUG, "%s", log_text(text));
     }
 }
 
@@ -132,7 +171,7 @@ static void push_stack(BasicVm *vm, uint16_t value)
 {
     if (vm->stack_pointer >= 16)
     {
-        printf("Error: Stack overflow!\n");
+        log_write(LOG_ERROR, "Stack overflow!");
         return;
     }
     vm->stack[vm->stack_pointer++] = value;
@@ -142,7 +181,7 @@ static uint16_t pop_stack(BasicVm *vm)
 {
     if (vm->stack_pointer == 0)
     {
-        printf("Error: Stack underflow!\n");
+        log_write(LOG_ERROR, "Stack underflow!");
         return 0;
     }
     return vm->stack[--vm->stack_pointer];
@@ -158,87 +197,110 @@ static bool check_halt(BasicVm *vm, DecodedInstruction *dec)
     return false;
 }
 
-DecodedInstruction vm_step(BasicVm *vm)
+// Little-endian instruction bytes at pc. Plain memory unless a bank other
+// than 0 is mapped, so flat ROMs pay one test per fetch for banking.
+static uint32_t vm_code_word(const BasicVm *vm, uint16_t pc, int length)
 {
-    // Fetch instruction from program ROM
-    if (vm->program_counter >= PROGRAM_ROM + PROGRAM_SIZE)
+    uint32_t word = 0;
+    if (!vm->bank_window)
     {
-        printf("Error: PC out of bounds (0x%04X)\n", vm->program_counter);
-        return (DecodedInstruction){0};
+        for (int i = 0; i < length; i++)
+        {
+            word |= vm->memory[(uint16_t)(pc + i)] << (i * 8);
+        }
+        return word;
     }
-
-    // Read first byte to determine opcode and instruction length
-    uint8_t byte0 = vm->memory[vm->program_counter];
-    uint8_t funct3 = byte0 & 0x7;
-    uint8_t opcode = (byte0 >> 3) & 0x1F;
-    uint8_t opcode_funct3 = byte0;
-
-    Instruction *ins = NULL;
-
-    // Check if this is a 24-bit R-type instruction that needs funct4 lookup
-    if (opcode_funct3 == 0x08 || opcode_funct3 == 0x40 || opcode_funct3 == 0x50 || opcode_funct3 == 0x51)
+    for (int i = 0; i < length; i++)
     {
-        // For 24-bit instructions, we need funct4 to distinguish ADD/SUB/MUL/DIV etc.
-        // Read byte1 to get funct4
-        uint8_t byte1 = vm->memory[vm->program_counter + 1];
-        uint8_t funct4 = byte1 & 0xF;
-        ins = get_instruction_by_all(opcode, funct3, funct4);
+        word |= vm_code_byte(vm, pc + i) << (i * 8);
     }
-    else if (opcode == 0x03)
+    return word;
+}
+
+Instruction *vm_fetch_instruction(BasicVm *vm, uint16_t pc)
+{
+    // The first byte and the funct4 nibble of the second select the row
+    uint32_t head = vm_code_word(vm, pc, 2);
+    return decode_lookup(head & 0xFF, head >> 8);
+}
+
+bool vm_select_bank(BasicVm *vm, uint8_t bank)
+{
+    if (bank >= vm->bank_count)
     {
-        // For 32-bit instructions that use funct4 (LUI/AUIPC)
-        // Format: opcode(5)|funct3(3) | rd(4) | funct4(4) | imm(16)
-        // funct4 is in bits 0-3 of byte1, rd is in bits 4-7
-        uint8_t byte1 = vm->memory[vm->program_counter + 1];
-        uint8_t funct4 = byte1 & 0xF; // Read bits 0-3 for funct4
-        ins = get_instruction_by_all(opcode, funct3, funct4);
+        return false;
     }
-    else
+    vm->bank = bank;
+    vm->bank_window = bank == 0 ? NULL : vm->banks + (size_t)(bank - 1) * BANK_SIZE;
+    return true;
+}
+
+#ifdef PREDECODE_CACHE
+static PredecodeCache vm_predecode;
+#endif
+
+// Fetch and decode the instruction at the PC; false if none decodes there
+static bool vm_fetch_decode(BasicVm *vm, DecodedInstruction *dec, int *instr_length)
+{
+#ifdef PREDECODE_CACHE
+    // The cache holds bank 0; other banks decode as they run
+    uint32_t offset = vm->program_counter - PROGRAM_ROM;
+    bool banked = vm->bank_window && (uint16_t)(vm->program_counter - BANK_WINDOW) < BANK_SIZE;
+    if (!banked && predecode_fetch(&vm_predecode, offset, dec))
     {
-        // For other 32-bit instructions, use opcode and funct3 only
-        ins = get_instruction_by_opcode_funct3(opcode, funct3);
+        *instr_length = vm_predecode.entries[offset].length;
+        vm->opcode = vm_predecode.entries[offset].word;
+        return true;
     }
+#endif
+
+    Instruction *ins = vm_fetch_instruction(vm, vm->program_counter);
 
     if (!ins)
     {
-        printf("Error: Unknown instruction at PC=0x%04X (opcode=0x%02X, funct3=0x%X)\n", vm->program_counter, opcode, funct3);
-        return (DecodedInstruction){0};
-    }
-#ifdef VERBOSE
-    else
-    {
-        printf("Fetched instruction: %s at PC=0x%04X\n", ins->name, vm->program_counter);
+        uint8_t byte0 = vm_code_byte(vm, vm->program_counter);
+        log_write(LOG_ERROR, "Unknown instruction at PC=0x%04X (opcode=0x%02X, funct3=0x%X)", vm->program_counter, (byte0 >> 3) & 0x1F, byte0 & 0x7);
+        return false;
     }
-#endif
+
+    log_write(LOG_TRACE, "Fetched instruction: %s at PC=0x%04X", ins->name, vm->program_counter);
 
     // Determine instruction length (24-bit = 3 bytes, 32-bit = 4 bytes)
     // Check if this is a 32-bit instruction format
-    int instr_length = ins->length / 8; // Convert bits to bytes
-    if (instr_length == 0)
+    *instr_length = ins->length / 8; // Convert bits to bytes
+    if (*instr_length == 0)
     {
-        instr_length = 3; // Default to 24-bit instructions if length is not set properly
+        *instr_length = 3; // Default to 24-bit instructions if length is not set properly
     }
 
     // Read instruction bytes (little-endian)
-    uint32_t instruction = byte0;
-    for (int i = 1; i < instr_length; i++)
-    {
-        instruction |= (vm->memory[vm->program_counter + i] << (i * 8));
-    }
+    uint32_t instruction = vm_code_word(vm, vm->program_counter, *instr_length);
 
     vm->opcode = instruction; // Store full instruction
 
-    DecodedInstruction dec = vm_decode(instruction, *ins);
+    *dec = vm_decode(instruction, ins);
+    return true;
+}
 
-    // Print debug info
-    vm_print_instruction(vm, dec);
+DecodedInstruction vm_step(BasicVm *vm)
+{
+    // Fetch instruction from program ROM
+    if (vm->program_counter >= PROGRAM_ROM + PROGRAM_SIZE)
+    {
+        log_write(LOG_ERROR, "PC out of bounds (0x%04X)", vm->program_counter);
+        return (DecodedInstruction){0};
+    }
 
-    // Check for HALT
-    if (dec.isHalt)
+    DecodedInstruction dec;
+    int instr_length;
+    if (!vm_fetch_decode(vm, &dec, &instr_length))
     {
-        return dec;
+        return (DecodedInstruction){0};
     }
 
+    // Print debug info
+    vm_print_instruction(vm, dec);
+
     // Increment PC for next instruction (will be adjusted by branches/jumps)
     uint16_t next_pc = vm->program_counter + instr_length;
 
@@ -256,6 +318,60 @@ DecodedInstruction vm_step(BasicVm *vm)
     return dec;
 }
 
+#if defined(PROFILE_EXACT) || defined(PROFILE_SAMPLING)
+static PcProfile vm_profile;
+#endif
+
+#ifdef PERF_COUNTERS
+static PerfCounters vm_perf;
+#endif
+
+#ifdef TRACE
+static TraceWriter vm_trace;
+#endif
+
+#ifdef HOT_RELOAD
+static HotReload *vm_hot_reload;
+
+void vm_attach_hot_reload(HotReload *reload)
+{
+    vm_hot_reload = reload;
+}
+#endif
+
+#ifdef BLOCK_MAP
+static CfgMap vm_blocks;
+
+bool vm_load_block_map(BasicVm *vm, const char *path)
+{
+    const uint8_t *image = vm->memory + PROGRAM_ROM;
+    cfg_free(&vm_blocks);
+    if (path != NULL && cfg_read(path, &vm_blocks))
+    {
+        if (cfg_matches(&vm_blocks, image, vm->rom_size, PROGRAM_ROM))
+        {
+            log_write(LOG_INFO, "Block map: %zu blocks from %s", vm_blocks.count, log_text(path));
+            return true;
+        }
+        log_write(LOG_INFO, "Block map %s is for another ROM, recovering it", log_text(path));
+        cfg_free(&vm_blocks);
+    }
+
+    if (!cfg_recover(image, vm->rom_size, PROGRAM_ROM, &vm_blocks))
+    {
+        log_write(LOG_ERROR, "Block map: out of memory");
+        return false;
+    }
+    log_write(LOG_INFO, "Block map: %zu blocks recovered", vm_blocks.count);
+    return true;
+}
+
+const CfgMap *vm_block_map(void)
+{
+    return &vm_blocks;
+}
+#endif
+
 bool vm_run(BasicVm *vm)
 {
 #ifdef VERBOSE
@@ -268,52 +384,143 @@ bool vm_run(BasicVm *vm)
 #endif
 
     int instruction_count = 0;
+    bool halted = false;
     const int MAX_INSTRUCTIONS = 1000000; // Safety limit
+#ifdef HOT_RELOAD
+    // A program being edited live runs until it halts
+    const int instruction_limit = vm_hot_reload != NULL ? INT_MAX : MAX_INSTRUCTIONS;
+#else
+    const int instruction_limit = MAX_INSTRUCTIONS;
+#endif
 
 #ifdef VERBOSE
     printf("Entering execution loop...\n");
     fflush(stdout);
 #endif
 
-    while (instruction_count < MAX_INSTRUCTIONS)
+#if defined(PROFILE_SAMPLING)
+    profiler_start_sampling(vm, &vm_profile, PROFILE_SAMPLE_US);
+#elif defined(PROFILE_EXACT)
+    profiler_reset(&vm_profile, "exact");
+#endif
+
+#ifdef PERF_COUNTERS
+    perf_counters_open(&vm_perf);
+    perf_counters_begin(&vm_perf);
+#endif
+
+#ifdef TRACE
+    trace_open(&vm_trace, TRACE_PATH, vm->program_counter);
+#endif
+
+#ifdef BLOCK_MAP
+    vm_load_block_map(vm, BLOCK_MAP_PATH);
+#endif
+
+#ifdef PREDECODE_CACHE
+    predecode_close(&vm_predecode);
+    predecode_open(&vm_predecode, vm->memory + PROGRAM_ROM, vm->rom_size, PROGRAM_ROM, PREDECODE_CACHE_DIR);
+#endif
+
+    while (instruction_count < instruction_limit)
     {
+#ifdef HOT_RELOAD
+        if (vm_hot_reload != NULL)
+        {
+            if (hot_reload_pending(vm_hot_reload))
+            {
+                hot_reload_apply(vm_hot_reload, vm);
+#ifdef BLOCK_MAP
+                vm_load_block_map(vm, NULL); // the image changed under the map
+#endif
+#ifdef PREDECODE_CACHE
+                // Only the replaced bytes need decoding again
+                predecode_update(&vm_predecode, vm->memory + PROGRAM_ROM, vm->rom_size,
+                                 (uint32_t)vm_hot_reload->changedStart, (uint32_t)vm_hot_reload->changedEnd);
+#endif
+            }
+        }
+#endif
 #ifdef VERBOSE
         printf("Step %d: PC=0x%04X\n", instruction_count, vm->program_counter);
         fflush(stdout);
+#endif
+#ifdef PROFILE_EXACT
+        profiler_record(&vm_profile, vm->program_counter);
+#endif
+#ifdef PERF_COUNTERS_BY_CLASS
+        uint64_t perf_before[PERF_COUNTER_COUNT];
+        perf_counters_read(&vm_perf, perf_before);
+#endif
+#ifdef TRACE
+        uint16_t trace_pc = vm->program_counter;
+        uint8_t trace_registers[16];
+        memcpy(trace_registers, vm->registers, sizeof(trace_registers));
 #endif
         DecodedInstruction dec = vm_step(vm);
+#ifdef TRACE
+        trace_record_step(&vm_trace, vm, trace_pc, trace_registers, &dec);
+#endif
+#ifdef PERF_COUNTERS_BY_CLASS
+        perf_counters_attribute(&vm_perf, dec.opcode, perf_before);
+#endif
 
         if (dec.isHalt)
         {
-            return true;
+            halted = true;
+            break;
         }
         else if (dec.opcode == 0)
         {
+            log_flush();
             printf("VM error at instruction %d\n", instruction_count);
             fflush(stdout);
+#ifdef PROFILE_SAMPLING
+            profiler_stop_sampling(&vm_profile);
+#endif
+#ifdef PERF_COUNTERS
+            perf_counters_close(&vm_perf);
+#endif
+#ifdef TRACE
+            trace_close(&vm_trace);
+#endif
             return false;
         }
         instruction_count++;
-
-        // Check if PC is at a halt or out of bounds
-        if (vm->opcode == 0)
-        {
-            // Null instruction, continue
-            continue;
-        }
-
-        if (dec.opcode_funct3 == 0xFF)
-        {
-            break;
-        }
     }
 
-    if (instruction_count >= MAX_INSTRUCTIONS)
+    log_flush();
+    if (instruction_count >= instruction_limit)
     {
         printf("Warning: Reached maximum instruction limit\n");
     }
 
-    printf("Executed %d instructions\n", instruction_count);
-    vm_print_state(vm);
+#ifdef PROFILE_SAMPLING
+    profiler_stop_sampling(&vm_profile);
+#endif
+#ifdef PERF_COUNTERS
+    perf_counters_end(&vm_perf, instruction_count);
+#endif
+#ifdef TRACE
+    trace_close(&vm_trace);
+#endif
+
+    // HALT stops quietly; the summary is for runs cut off by the limit
+    if (!halted)
+    {
+        printf("Executed %d instructions\n", instruction_count);
+        vm_print_state(vm);
+    }
+
+#if defined(PROFILE_EXACT) || defined(PROFILE_SAMPLING)
+    profiler_report(vm, &vm_profile, stdout, 20);
+    if (!profiler_write(&vm_profile, PROFILE_PATH)) {
+        printf("Warning: could not write %s\n", PROFILE_PATH);
+    }
+#endif
+#ifdef PERF_COUNTERS
+    perf_counters_report(&vm_perf, stdout);
+    perf_counters_close(&vm_perf);
+#endif
     return true;
 }
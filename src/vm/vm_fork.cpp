@@ -0,0 +1,162 @@
+#include "vm_fork.h"
+#include "vm.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint32_t refs;
+    uint8_t bytes[VM_PAGE_SIZE];
+} VmPage;
+
+struct VmSnapshot {
+    uint32_t refs;
+    VmPage *pages[VM_PAGES];  // memory pages, then display buffer pages
+    uint8_t registers[16];
+    uint16_t program_counter;
+    uint16_t opcode;
+    uint16_t index_register;
+    uint16_t stack[16];
+    uint8_t stack_pointer;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint32_t rom_size;
+    const uint8_t *bank_window;
+    const uint8_t *banks;
+    uint16_t bank_count;
+    uint8_t bank;
+};
+
+static uint8_t *page_bytes(BasicVm *vm, uint32_t page) {
+    if (page < VM_MEMORY_PAGES) {
+        return vm->memory + (size_t)page * VM_PAGE_SIZE;
+    }
+    return (uint8_t *)vm->display_buffer + (size_t)(page - VM_MEMORY_PAGES) * VM_PAGE_SIZE;
+}
+
+// Whether the VM's copy of page may differ from its base snapshot's
+static bool page_written(const BasicVm *vm, uint32_t page) {
+#ifdef VM_FORK
+    return !vm->snapshot || (vm->dirty_pages[page / 64] >> (page % 64) & 1);
+#else
+    (void)vm;
+    (void)page;
+    return true;
+#endif
+}
+
+static void page_release(VmPage *page) {
+    if (page && __atomic_sub_fetch(&page->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(page);
+    }
+}
+
+// Make snapshot the VM's base, dropping the old one; nothing is written since
+static void set_base(BasicVm *vm, VmSnapshot *snapshot) {
+    vm_snapshot_retain(snapshot);
+    if (vm->snapshot) {
+        vm_snapshot_release(vm->snapshot);
+    }
+    vm->snapshot = snapshot;
+    memset(vm->dirty_pages, 0, sizeof(vm->dirty_pages));
+}
+
+VmSnapshot *vm_snapshot(BasicVm *vm) {
+    VmSnapshot *snapshot = (VmSnapshot *)calloc(1, sizeof(VmSnapshot));
+    if (!snapshot) {
+        return NULL;
+    }
+    snapshot->refs = 1;
+
+    for (uint32_t i = 0; i < VM_PAGES; i++) {
+        if (!page_written(vm, i)) {
+            snapshot->pages[i] = vm->snapshot->pages[i];
+            __atomic_add_fetch(&snapshot->pages[i]->refs, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        VmPage *page = (VmPage *)malloc(sizeof(VmPage));
+        if (!page) {
+            vm_snapshot_release(snapshot);
+            return NULL;
+        }
+        page->refs = 1;
+        memcpy(page->bytes, page_bytes(vm, i), VM_PAGE_SIZE);
+        snapshot->pages[i] = page;
+    }
+
+    memcpy(snapshot->registers, vm->registers, sizeof(vm->registers));
+    snapshot->program_counter = vm->program_counter;
+    snapshot->opcode = vm->opcode;
+    snapshot->index_register = vm->index_register;
+    memcpy(snapshot->stack, vm->stack, sizeof(vm->stack));
+    snapshot->stack_pointer = vm->stack_pointer;
+    snapshot->delay_timer = vm->delay_timer;
+    snapshot->sound_timer = vm->sound_timer;
+    snapshot->rom_size = vm->rom_size;
+    snapshot->bank_window = vm->bank_window;
+    snapshot->banks = vm->banks;
+    vm_banks_retain(snapshot->banks);
+    snapshot->bank_count = vm->bank_count;
+    snapshot->bank = vm->bank;
+
+    set_base(vm, snapshot);
+    return snapshot;
+}
+
+void vm_restore(BasicVm *vm, VmSnapshot *snapshot) {
+    for (uint32_t i = 0; i < VM_PAGES; i++) {
+        if (!page_written(vm, i) && vm->snapshot->pages[i] == snapshot->pages[i]) {
+            continue; // the very same page, and the VM has not touched it
+        }
+        memcpy(page_bytes(vm, i), snapshot->pages[i]->bytes, VM_PAGE_SIZE);
+    }
+
+    memcpy(vm->registers, snapshot->registers, sizeof(vm->registers));
+    vm->program_counter = snapshot->program_counter;
+    vm->opcode = snapshot->opcode;
+    vm->index_register = snapshot->index_register;
+    memcpy(vm->stack, snapshot->stack, sizeof(vm->stack));
+    vm->stack_pointer = snapshot->stack_pointer;
+    vm->delay_timer = snapshot->delay_timer;
+    vm->sound_timer = snapshot->sound_timer;
+    vm->rom_size = snapshot->rom_size;
+    vm_banks_retain(snapshot->banks);
+    vm_banks_release(vm->banks);
+    vm->bank_window = snapshot->bank_window;
+    vm->banks = snapshot->banks;
+    vm->bank_count = snapshot->bank_count;
+    vm->bank = snapshot->bank;
+
+    set_base(vm, snapshot);
+}
+
+bool vm_fork(BasicVm *parent, BasicVm *child) {
+    VmSnapshot *snapshot = vm_snapshot(parent);
+    if (!snapshot) {
+        return false;
+    }
+    vm_restore(child, snapshot);
+    vm_snapshot_release(snapshot);
+    return true;
+}
+
+void vm_snapshot_retain(VmSnapshot *snapshot) {
+    __atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_RELAXED);
+}
+
+void vm_snapshot_release(VmSnapshot *snapshot) {
+    if (__atomic_sub_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < VM_PAGES; i++) {
+        page_release(snapshot->pages[i]);
+    }
+    vm_banks_release(snapshot->banks);
+    free(snapshot);
+}
+
+void vm_fork_release(BasicVm *vm) {
+    if (vm->snapshot) {
+        vm_snapshot_release(vm->snapshot);
+        vm->snapshot = NULL;
+    }
+}
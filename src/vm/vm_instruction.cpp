@@ -1,252 +1,226 @@
 #include "vm_instruction.h"
+#include "vm.h"
+#include "vm_fork.h"
 #include "config.h"
 #include "display.h"
+#include "log.h"
 #include <stdio.h>
 
 #ifndef DISABLE_EXECUTION
 void vm_execute_instruction(BasicVm *vm, DecodedInstruction dec, uint16_t next_pc) {
-    switch (dec.opcode) {
-        case 0x01: // Arithmetic R-type (ADD, SUB, MUL, DIV)
-            switch (dec.funct4) {
-                case 0x00: // ADD
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] + vm->registers[dec.rs2];
-                    break;
-                case 0x01: // SUB
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] - vm->registers[dec.rs2];
-                    break;
-                case 0x02: // MUL
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] * vm->registers[dec.rs2];
-                    break;
-                case 0x03: // DIV
-                    if (vm->registers[dec.rs2] != 0) {
-                        vm->registers[dec.rd] = vm->registers[dec.rs1] / vm->registers[dec.rs2];
-                    } else {
-                        printf("Error: Division by zero\n");
-                    }
-                    break;
+    // One case per row of INSTRUCTION_LIST, dense enough for a jump table
+    switch (dec.op) {
+        // Arithmetic R-type
+        case ISA_ADD:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] + vm->registers[dec.rs2];
+            break;
+        case ISA_SUB:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] - vm->registers[dec.rs2];
+            break;
+        case ISA_MUL:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] * vm->registers[dec.rs2];
+            break;
+        case ISA_DIV:
+            if (vm->registers[dec.rs2] != 0) {
+                vm->registers[dec.rd] = vm->registers[dec.rs1] / vm->registers[dec.rs2];
+            } else {
+                log_write(LOG_WARN, "Division by zero at PC=0x%04X", vm->program_counter);
             }
-            vm->program_counter = next_pc;
             break;
 
-        case 0x02: // Immediates I-type (ADDI, SUBI, MULI, DIVI)
-            switch (dec.funct3) {
-                case 0x00: // ADDI
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] + (dec.imm & 0xFF);
-                    break;
-                case 0x01: // SUBI
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] - (dec.imm & 0xFF);
-                    break;
-                case 0x02: // MULI
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] * (dec.imm & 0xFF);
-                    break;
-                case 0x03: // DIVI
-                    if ((dec.imm & 0xFF) != 0) {
-                        vm->registers[dec.rd] = vm->registers[dec.rs1] / (dec.imm & 0xFF);
-                    } else {
-                        printf("Error: Division by zero\n");
-                    }
-                    break;
+        // Immediates I-type
+        case ISA_ADDI:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] + (dec.imm & 0xFF);
+            break;
+        case ISA_SUBI:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] - (dec.imm & 0xFF);
+            break;
+        case ISA_MULI:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] * (dec.imm & 0xFF);
+            break;
+        case ISA_DIVI:
+            if ((dec.imm & 0xFF) != 0) {
+                vm->registers[dec.rd] = vm->registers[dec.rs1] / (dec.imm & 0xFF);
+            } else {
+                log_write(LOG_WARN, "Division by zero at PC=0x%04X", vm->program_counter);
             }
-            vm->program_counter = next_pc;
             break;
 
-        case 0x03: // Upper Immediates U-type (LUI, AUIPC)
-            switch (dec.funct4) {
-                case 0x00: // LUI: rd = imm << 8
-                    vm->registers[dec.rd] = (dec.imm >> 8) & 0xFF;
-                    break;
-                case 0x01: // AUIPC: rd = PC + (imm << 8)
-                    vm->registers[dec.rd] = ((next_pc + (dec.imm << 8)) >> 8) & 0xFF;
-                    break;
-            }
-            vm->program_counter = next_pc;
+        // Upper Immediates U-type
+        case ISA_LUI: // rd = imm << 8
+            vm->registers[dec.rd] = (dec.imm >> 8) & 0xFF;
+            break;
+        case ISA_AUIPC: // rd = PC + (imm << 8)
+            vm->registers[dec.rd] = ((next_pc + (dec.imm << 8)) >> 8) & 0xFF;
             break;
 
-        case 0x04: // Stores S-type (SB, SH, SW)
-            switch (dec.funct3) {
-                case 0x00: // SB: store byte
-                    vm->memory[(vm->registers[dec.rs1] + dec.imm) & 0xFFF] = vm->registers[dec.rs2];
-                    break;
-                case 0x01: // SH: store halfword (2 bytes)
-                    vm->memory[(vm->registers[dec.rs1] + dec.imm) & 0xFFF] = vm->registers[dec.rs2] & 0xFF;
-                    vm->memory[(vm->registers[dec.rs1] + dec.imm + 1) & 0xFFF] = (vm->registers[dec.rs2] >> 8) & 0xFF;
-                    break;
-                case 0x02: // SW: store word (4 bytes, using two registers)
-                    vm->memory[(vm->registers[dec.rs1] + dec.imm) & 0xFFF] = vm->registers[dec.rs2] & 0xFF;
-                    vm->memory[(vm->registers[dec.rs1] + dec.imm + 1) & 0xFFF] = (vm->registers[dec.rs2] >> 8) & 0xFF;
-                    vm->memory[(vm->registers[dec.rs1] + dec.imm + 2) & 0xFFF] = vm->registers[dec.rs2+1] & 0xFF;
-                    vm->memory[(vm->registers[dec.rs1] + dec.imm + 3) & 0xFFF] = (vm->registers[dec.rs2+1] >> 8) & 0xFF;
-                    break;
-            }
-            vm->program_counter = next_pc;
+        // Stores S-type, masked into 0x0000-0x0FFF: the first VM_PAGE_SIZE page
+        case ISA_SB: // store byte
+            vm->memory[(vm->registers[dec.rs1] + dec.imm) & 0xFFF] = vm->registers[dec.rs2];
+            vm_dirty_pages(vm, 0, 0);
+            break;
+        case ISA_SH: // store halfword (2 bytes)
+            vm->memory[(vm->registers[dec.rs1] + dec.imm) & 0xFFF] = vm->registers[dec.rs2] & 0xFF;
+            vm->memory[(vm->registers[dec.rs1] + dec.imm + 1) & 0xFFF] = (vm->registers[dec.rs2] >> 8) & 0xFF;
+            vm_dirty_pages(vm, 0, 0);
+            break;
+        case ISA_SW: // store word (4 bytes, using two registers)
+            vm->memory[(vm->registers[dec.rs1] + dec.imm) & 0xFFF] = vm->registers[dec.rs2] & 0xFF;
+            vm->memory[(vm->registers[dec.rs1] + dec.imm + 1) & 0xFFF] = (vm->registers[dec.rs2] >> 8) & 0xFF;
+            vm->memory[(vm->registers[dec.rs1] + dec.imm + 2) & 0xFFF] = vm->registers[dec.rs2+1] & 0xFF;
+            vm->memory[(vm->registers[dec.rs1] + dec.imm + 3) & 0xFFF] = (vm->registers[dec.rs2+1] >> 8) & 0xFF;
+            vm_dirty_pages(vm, 0, 0);
             break;
 
-        case 0x05: // Branches B-type (BEQ, BNE, BLT, BGT, BLE, BGE)
-            switch (dec.funct3) {
-                case 0x00: // BEQ: if rs1 == rs2, PC = PC + imm
-                    if (vm->registers[dec.rs1] == vm->registers[dec.rs2]) {
-                        vm->program_counter = next_pc + (int16_t)dec.imm;
-                    } else {
-                        vm->program_counter = next_pc;
-                    }
-                    break;
-                case 0x01: // BNE: if rs1 != rs2, PC = PC + imm
-                    if (vm->registers[dec.rs1] != vm->registers[dec.rs2]) {
-                        vm->program_counter = next_pc + (int16_t)dec.imm;
-                    } else {
-                        vm->program_counter = next_pc;
-                    }
-                    break;
-                case 0x02: // BLT: if rs1 < rs2 (signed), PC = PC + imm
-                    if ((int8_t)vm->registers[dec.rs1] < (int8_t)vm->registers[dec.rs2]) {
-                        vm->program_counter = next_pc + (int16_t)dec.imm;
-                    } else {
-                        vm->program_counter = next_pc;
-                    }
-                    break;
-                case 0x03: // BGT: if rs1 > rs2 (signed), PC = PC + imm
-                    if ((int8_t)vm->registers[dec.rs1] > (int8_t)vm->registers[dec.rs2]) {
-                        vm->program_counter = next_pc + (int16_t)dec.imm;
-                    } else {
-                        vm->program_counter = next_pc;
-                    }
-                    break;
-                case 0x04: // BLE: if rs1 <= rs2 (signed), PC = PC + imm
-                    if ((int8_t)vm->registers[dec.rs1] <= (int8_t)vm->registers[dec.rs2]) {
-                        vm->program_counter = next_pc + (int16_t)dec.imm;
-                    } else {
-                        vm->program_counter = next_pc;
-                    }
-                    break;
-                case 0x05: // BGE: if rs1 >= rs2 (signed), PC = PC + imm
-                    if ((int8_t)vm->registers[dec.rs1] >= (int8_t)vm->registers[dec.rs2]) {
-                        vm->program_counter = next_pc + (int16_t)dec.imm;
-                    } else {
-                        vm->program_counter = next_pc;
-                    }
-                    break;
+        // Branches B-type: PC = PC + imm if taken, comparisons are signed
+        case ISA_BEQ:
+            if (vm->registers[dec.rs1] == vm->registers[dec.rs2]) {
+                next_pc += (int16_t)dec.imm;
             }
             break;
-
-        case 0x06: // Jumps (JAL, JALR)
-            if (dec.funct4 == 0x01) {
-                // JALR: rd = PC + 4, PC = (rs1 + imm) & ~1
-                vm->registers[dec.rd] = (next_pc >> 8) & 0xFF;
-                vm->program_counter = (vm->registers[dec.rs1] + (int16_t)dec.imm) & ~1;
-            } else {
-                // JAL: rd = PC + 4, PC = PC + imm
-                vm->registers[dec.rd] = (next_pc >> 8) & 0xFF;
-                vm->program_counter = next_pc + (int16_t)dec.imm;
+        case ISA_BNE:
+            if (vm->registers[dec.rs1] != vm->registers[dec.rs2]) {
+                next_pc += (int16_t)dec.imm;
             }
             break;
-
-        case 0x07: // Loads I-type (LW, LH, LB)
-            switch (dec.funct3) {
-                case 0x00: // LW: load word (4 bytes)
-                case 0x01: // LH: load halfword (2 bytes)
-                case 0x02: { // LB: load byte
-                    uint16_t addr = (vm->registers[dec.rs1] + dec.imm) & 0xFFF;
-                    if (dec.funct3 == 0x02) { // LB
-                        vm->registers[dec.rd] = vm->memory[addr];
-                    } else if (dec.funct3 == 0x01) { // LH
-                        vm->registers[dec.rd] = vm->memory[addr] | (vm->memory[(addr + 1) & 0xFFF] << 8);
-                    } else { // LW
-                        vm->registers[dec.rd] = vm->memory[addr] | (vm->memory[(addr + 1) & 0xFFF] << 8);
-                        vm->registers[dec.rd + 1] = vm->memory[(addr + 2) & 0xFFF] | (vm->memory[(addr + 3) & 0xFFF] << 8);
-                    }
-                    break;
-                }
+        case ISA_BLT:
+            if ((int8_t)vm->registers[dec.rs1] < (int8_t)vm->registers[dec.rs2]) {
+                next_pc += (int16_t)dec.imm;
             }
-            vm->program_counter = next_pc;
             break;
-
-        case 0x08: // Bitwise R-type (AND, OR, XOR)
-            switch (dec.funct4) {
-                case 0x00: // AND
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] & vm->registers[dec.rs2];
-                    break;
-                case 0x01: // OR
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] | vm->registers[dec.rs2];
-                    break;
-                case 0x02: // XOR
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] ^ vm->registers[dec.rs2];
-                    break;
+        case ISA_BGT:
+            if ((int8_t)vm->registers[dec.rs1] > (int8_t)vm->registers[dec.rs2]) {
+                next_pc += (int16_t)dec.imm;
             }
-            vm->program_counter = next_pc;
             break;
-
-        case 0x09: // Bitwise Immediates I-type (ANDI, ORI, XORI)
-            switch (dec.funct3) {
-                case 0x00: // ANDI
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] & (dec.imm & 0xFF);
-                    break;
-                case 0x01: // ORI
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] | (dec.imm & 0xFF);
-                    break;
-                case 0x02: // XORI
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] ^ (dec.imm & 0xFF);
-                    break;
+        case ISA_BLE:
+            if ((int8_t)vm->registers[dec.rs1] <= (int8_t)vm->registers[dec.rs2]) {
+                next_pc += (int16_t)dec.imm;
             }
-            vm->program_counter = next_pc;
             break;
-
-        case 0x0A: // Shifts (SLL, SRL)
-            switch (dec.funct4) {
-                case 0x00: // SLL: rd = rs1 << rs2
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] << (vm->registers[dec.rs2] & 0x1F);
-                    break;
-                case 0x01: // SRL: rd = rs1 >> rs2
-                    vm->registers[dec.rd] = vm->registers[dec.rs1] >> (vm->registers[dec.rs2] & 0x1F);
-                    break;
+        case ISA_BGE:
+            if ((int8_t)vm->registers[dec.rs1] >= (int8_t)vm->registers[dec.rs2]) {
+                next_pc += (int16_t)dec.imm;
             }
-            vm->program_counter = next_pc;
             break;
 
-        case 0x0C: // Immediate Shifts (SLLI, SRLI)
-            switch (dec.funct3) {
-                case 0x01: // Shifts
-                    if (dec.funct4 == 0) { // SLLI
-                        vm->registers[dec.rd] = vm->registers[dec.rs1] << (dec.imm & 0x1F);
-                    } else { // SRLI
-                        vm->registers[dec.rd] = vm->registers[dec.rs1] >> (dec.imm & 0x1F);
-                    }
-                    break;
-            }
-            vm->program_counter = next_pc;
+        // Jumps
+        case ISA_JAL: // rd = return page, PC = PC + imm
+            vm->registers[dec.rd] = (next_pc >> 8) & 0xFF;
+            next_pc += (int16_t)dec.imm;
+            break;
+        case ISA_JALR: { // rd = return page, PC = (rs1 + imm) & ~1
+            uint16_t target = (vm->registers[dec.rs1] + (int16_t)dec.imm) & ~1;
+            vm->registers[dec.rd] = (next_pc >> 8) & 0xFF;
+            next_pc = target;
+            break;
+        }
+
+        // Loads I-type
+        case ISA_LW: { // load word (4 bytes)
+            uint16_t addr = (vm->registers[dec.rs1] + dec.imm) & 0xFFF;
+            vm->registers[dec.rd] = vm->memory[addr] | (vm->memory[(addr + 1) & 0xFFF] << 8);
+            vm->registers[dec.rd + 1] = vm->memory[(addr + 2) & 0xFFF] | (vm->memory[(addr + 3) & 0xFFF] << 8);
+            break;
+        }
+        case ISA_LH: { // load halfword (2 bytes)
+            uint16_t addr = (vm->registers[dec.rs1] + dec.imm) & 0xFFF;
+            vm->registers[dec.rd] = vm->memory[addr] | (vm->memory[(addr + 1) & 0xFFF] << 8);
+            break;
+        }
+        case ISA_LB: // load byte
+            vm->registers[dec.rd] = vm->memory[(vm->registers[dec.rs1] + dec.imm) & 0xFFF];
+            break;
+
+        // Bitwise R-type
+        case ISA_AND:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] & vm->registers[dec.rs2];
+            break;
+        case ISA_OR:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] | vm->registers[dec.rs2];
+            break;
+        case ISA_XOR:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] ^ vm->registers[dec.rs2];
+            break;
+
+        // Bitwise Immediates I-type
+        case ISA_ANDI:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] & (dec.imm & 0xFF);
+            break;
+        case ISA_ORI:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] | (dec.imm & 0xFF);
+            break;
+        case ISA_XORI:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] ^ (dec.imm & 0xFF);
             break;
 
-        case 0x0B: // Display
-            switch (dec.funct3) {
-                case 0x00: // CLS: clear screen
-                    display_clear(vm);
-                    break;
-                case 0x01: { // CHAR: draw character
-                    uint8_t font_idx = dec.rd;       // font character index
-                    uint8_t x = dec.rs1;              // x position
-                    uint8_t y = dec.rs2;              // y position
-                    // Draw 8x8 character from font space at (x*8, y*8)
-                    uint16_t font_addr = FONT_ADDR + (font_idx * 8);
-                    uint16_t screen_x = x * 8;
-                    uint16_t screen_y = y * 8;
-                    for (int row = 0; row < 8; row++) {
-                        uint8_t font_row = vm->memory[font_addr + row];
-                        for (int col = 0; col < 8; col++) {
-                            if (font_row & (0x80 >> col)) {
-                                uint32_t pixel_idx = (screen_y + row) * DISPLAY_WIDTH + (screen_x + col);
-                                if (pixel_idx < DISPLAY_SIZE) {
-                                    vm->display_buffer[pixel_idx] = 0xFFFFFFFF; // white
-                                }
-                            }
+        // Shifts
+        case ISA_SLL: // rd = rs1 << rs2
+            vm->registers[dec.rd] = vm->registers[dec.rs1] << (vm->registers[dec.rs2] & 0x1F);
+            break;
+        case ISA_SRL: // rd = rs1 >> rs2
+            vm->registers[dec.rd] = vm->registers[dec.rs1] >> (vm->registers[dec.rs2] & 0x1F);
+            break;
+        case ISA_SLLI:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] << (dec.imm & 0x1F);
+            break;
+        case ISA_SRLI:
+            vm->registers[dec.rd] = vm->registers[dec.rs1] >> (dec.imm & 0x1F);
+            break;
+
+        // Display
+        case ISA_CHAR: { // draw character rd at (rs1, rs2)
+            uint8_t font_idx = dec.rd;       // font character index
+            uint8_t x = dec.rs1;              // x position
+            uint8_t y = dec.rs2;              // y position
+            // Draw 8x8 character from font space at (x*8, y*8)
+            uint16_t font_addr = FONT_ADDR + (font_idx * 8);
+            uint16_t screen_x = x * 8;
+            uint16_t screen_y = y * 8;
+            uint32_t first_pixel = screen_y * DISPLAY_WIDTH + screen_x;
+            if (first_pixel < DISPLAY_SIZE) {
+                uint32_t span = 7 * DISPLAY_WIDTH + 8; // the 8 rows, clipped like the writes below
+                if (span > DISPLAY_SIZE - first_pixel) {
+                    span = DISPLAY_SIZE - first_pixel;
+                }
+                vm_dirty_display(vm, first_pixel, span);
+            }
+            for (int row = 0; row < 8; row++) {
+                uint8_t font_row = vm->memory[font_addr + row];
+                for (int col = 0; col < 8; col++) {
+                    if (font_row & (0x80 >> col)) {
+                        uint32_t pixel_idx = (screen_y + row) * DISPLAY_WIDTH + (screen_x + col);
+                        if (pixel_idx < DISPLAY_SIZE) {
+                            vm->display_buffer[pixel_idx] = 0xFFFFFFFF; // white
                         }
                     }
-                    break;
                 }
             }
-            vm->program_counter = next_pc;
+            break;
+        }
+        case ISA_CLS:
+            display_clear(vm);
+            break;
+
+        // Banking: map bank rs1 + imm into the window, rd gets the old bank
+        case ISA_BANK: {
+            uint8_t previous = vm->bank;
+            uint8_t bank = (uint8_t)(vm->registers[dec.rs1] + dec.imm);
+            if (!vm_select_bank(vm, bank)) {
+                log_write(LOG_ERROR, "BANK %u: the ROM has %u banks", bank, vm->bank_count);
+            }
+            vm->registers[dec.rd] = previous;
+            break;
+        }
+
+        // Byte instructions (vm_run stops on HALT)
+        case ISA_HALT:
             break;
 
         default:
-            printf("Error: Unknown opcode 0x%02X\n", dec.opcode);
+            log_write(LOG_ERROR, "Unknown opcode 0x%02X", dec.opcode);
+            break;
     }
+    vm->program_counter = next_pc;
 }
 #endif // DISABLE_EXECUTION
@@ -1,6 +1,35 @@
 #include "config.h"
 #include "vm.h"
+#include "assembler.h"
+#include "asm_source.h"
+#include "builtin_roms.h"
+#include "hot_reload.h"
+#include "log.h"
 #include <stdio.h>
+#include <string.h>
+
+// Assemble an .asm file straight into program ROM (no rom.bin round trip)
+static bool vm_load_asm(BasicVm *vm, const char *path)
+{
+    AsmSource source;
+    if (!asm_source_open(path, &source)) {
+        printf("Error: Could not open source file: %s\n", path);
+        fflush(stdout);
+        return false;
+    }
+
+    AsmResult result = {};
+    bool ok = assemble_into_vm(vm, source.data, source.size, &result);
+    if (!ok) {
+        log_flush();
+        asm_print_diagnostics(&result, stdout);
+        fflush(stdout);
+    }
+
+    asm_result_free(&result);
+    asm_source_close(&source);
+    return ok;
+}
 
 int vm_main(int argc, char *argv[])
 {
@@ -12,7 +41,39 @@ int vm_main(int argc, char *argv[])
         rom_path = argv[1];
     }
 
-    if (!vm_load_rom(&vm, rom_path)) {
+    // "@name" runs a ROM compiled into the binary
+    if (rom_path[0] == '@') {
+        const BuiltinRom *rom = builtin_rom_find(rom_path + 1);
+        if (rom == NULL) {
+            printf("Error: No built-in ROM '%s'. Built-in ROMs:\n", rom_path + 1);
+            for (size_t i = 0; i < builtin_rom_count; i++) {
+                printf("  @%-10s %s\n", builtin_roms[i].name, builtin_roms[i].description);
+            }
+            return 1;
+        }
+        if (!vm_load_image(&vm, rom->bytes, rom->size)) {
+            return 1;
+        }
+        vm_run(&vm);
+        return 0;
+    }
+
+    size_t length = strlen(rom_path);
+    bool is_source = length > 4 && strcmp(rom_path + length - 4, ".asm") == 0;
+#ifdef HOT_RELOAD
+    if (is_source) {
+        static HotReload reload;
+        if (!hot_reload_start(&reload, &vm, rom_path)) {
+            return 1;
+        }
+        vm_attach_hot_reload(&reload);
+        vm_run(&vm);
+        vm_attach_hot_reload(NULL);
+        hot_reload_stop(&reload);
+        return 0;
+    }
+#endif
+    if (is_source ? !vm_load_asm(&vm, rom_path) : !vm_load_rom(&vm, rom_path)) {
         return 1;
     }
 
@@ -0,0 +1,2 @@
+gcc trace_decode.cpp src/**/*.cpp -Iinclude -Isrc -lm -lpthread -o trace_decode
+./trace_decode "$@"
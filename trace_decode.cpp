@@ -0,0 +1,10 @@
+#include "trace.h"
+
+//------------------------------------------------------------------------------------
+// Trace decoder entry point (built by trace_decode.bash)
+//------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    const char *trace_path = argc > 1 ? argv[1] : "roms/trace.bin";
+    return trace_decode(trace_path, stdout) ? 0 : 1;
+}